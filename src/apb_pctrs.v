@@ -0,0 +1,169 @@
+/* APB performance counters
+ *
+ * A small set of 64-bit counters, each counting one selectable event, with
+ * an interrupt on overflow (so that software can sample, e.g. Linux perf,
+ * by preloading a counter with -period).
+ *
+ * Events (SEL[6:0]):
+ *	0-63	The CPU's pctrs[n] event lines (pipeline events: commits,
+ *		stalls, cache misses etc.; see mr_pctrs)
+ *	64	Cycles
+ *	65	events[65] onwards, from the instantiator (mr_top.v gives MIC
+ *	...	events here)
+ *
+ * Registers (32-bit):
+ *	0x00	CTRL	[0] global enable, [1] write 1 to zero all counters
+ *	0x04	OVF	Overflow status, bit per counter; write 1 to clear
+ *	0x08	OVF_EN	Overflow IRQ enable, bit per counter
+ *	0x0c	INFO	RO: [7:0] number of counters, [15:8] number of events
+ *	0x10+16n	Counter n:
+ *		+0	SEL	[6:0] event, [31] enable
+ *		+8	CNT_LO	Reading latches CNT_HI, so read LO then HI
+ *		+c	CNT_HI
+ *
+ * IRQ pulses for a cycle when an enabled overflow becomes pending (for an
+ * edge-triggered INTC input), rather than being held while any is.
+ *
+ * Copyright 2020-2022 Matt Evans
+ * SPDX-License-Identifier: Apache-2.0 WITH SHL-2.1
+ *
+ * Licensed under the Solderpad Hardware License v 2.1 (the “License”); you may
+ * not use this file except in compliance with the License, or, at your option,
+ * the Apache License version 2.0. You may obtain a copy of the License at
+ *
+ *  https://solderpad.org/licenses/SHL-2.1/
+ *
+ * Unless required by applicable law or agreed to in writing, any work
+ * distributed under the License is distributed on an “AS IS” BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+module apb_pctrs #(parameter NR_COUNTERS = 4,
+		   parameter NR_EVENTS = 68 /* At least 66 */
+		   )
+		(input wire         clk,
+		 input wire         reset,
+
+		 input wire         PENABLE,
+		 input wire         PSEL,
+		 input wire         PWRITE,
+		 input wire [6:0]   PADDR,
+		 input wire [31:0]  PWDATA,
+		 output reg [31:0]  PRDATA,
+
+		 /* [63:0] are the CPU's pctrs, [64] is overridden by cycles */
+		 input wire [NR_EVENTS-1:0] events,
+
+		 output wire        IRQ
+		 );
+
+   localparam [7:0] INFO_COUNTERS = NR_COUNTERS;
+   localparam [7:0] INFO_EVENTS = NR_EVENTS;
+
+   reg 				    enable;
+   reg [NR_COUNTERS-1:0] 	    ovf;
+   reg [NR_COUNTERS-1:0] 	    ovf_en;
+   reg [6:0] 			    sel[NR_COUNTERS-1:0];
+   reg [NR_COUNTERS-1:0] 	    cnt_en;
+   reg [63:0] 			    cnt[NR_COUNTERS-1:0];
+   reg [31:0] 			    hi_latch;
+   reg [NR_COUNTERS-1:0] 	    new_ovf; // Wire
+   reg [NR_COUNTERS-1:0] 	    irq_last;
+
+   wire [127:0] 		    ev = {{(128-NR_EVENTS){1'b0}}, events[NR_EVENTS-1:65],
+					  1'b1, events[63:0]};
+
+   wire 			    access = PSEL && PENABLE;
+   wire 			    wr = access && PWRITE;
+   wire 			    rd = access && !PWRITE;
+   wire [2:0] 			    ctr_n = PADDR[6:4] - 3'd1;
+   wire 			    ctr_reg = (PADDR[6:4] != 3'd0) && (ctr_n < NR_COUNTERS);
+
+   wire [NR_COUNTERS-1:0] 	    irq_pend = ovf & ovf_en;
+
+   assign IRQ = |(irq_pend & ~irq_last);
+
+   /* Register reads */
+   always @(*) begin
+      PRDATA = 32'h0;
+
+      if (!ctr_reg) begin
+	 case (PADDR[3:2])
+	   2'd0:	PRDATA = {31'h0, enable};
+	   2'd1:	PRDATA = {{(32-NR_COUNTERS){1'b0}}, ovf};
+	   2'd2:	PRDATA = {{(32-NR_COUNTERS){1'b0}}, ovf_en};
+	   2'd3:	PRDATA = {16'h0, INFO_EVENTS, INFO_COUNTERS};
+	 endcase
+      end else begin
+	 case (PADDR[3:2])
+	   2'd0:	PRDATA = {cnt_en[ctr_n], 24'h0, sel[ctr_n]};
+	   2'd2:	PRDATA = cnt[ctr_n][31:0];
+	   2'd3:	PRDATA = hi_latch;
+	   default:	PRDATA = 32'h0;
+	 endcase
+      end
+   end
+
+   integer i;
+
+   always @(*) begin
+      for (i = 0; i < NR_COUNTERS; i = i + 1)
+	new_ovf[i] = enable && cnt_en[i] && ev[sel[i]] && (cnt[i] == 64'hffffffffffffffff);
+   end
+
+   always @(posedge clk) begin
+      /* Count; an overflow in the same cycle as clearing OVF isn't lost */
+      for (i = 0; i < NR_COUNTERS; i = i + 1) begin
+	 if (enable && cnt_en[i] && ev[sel[i]])
+	   cnt[i] <= cnt[i] + 64'h1;
+      end
+      ovf <= ovf | new_ovf;
+      irq_last <= irq_pend;
+
+      if (rd && ctr_reg && PADDR[3:2] == 2'd2)
+	hi_latch <= cnt[ctr_n][63:32];
+
+      /* Register writes take priority over counting */
+      if (wr) begin
+	 if (!ctr_reg) begin
+	    case (PADDR[3:2])
+	      2'd0: begin
+		 enable <= PWDATA[0];
+		 if (PWDATA[1]) begin
+		    for (i = 0; i < NR_COUNTERS; i = i + 1)
+		      cnt[i] <= 64'h0;
+		 end
+	      end
+	      2'd1:	ovf <= (ovf & ~PWDATA[NR_COUNTERS-1:0]) | new_ovf;
+	      2'd2:	ovf_en <= PWDATA[NR_COUNTERS-1:0];
+	      default: ;
+	    endcase
+	 end else begin
+	    case (PADDR[3:2])
+	      2'd0: begin
+		 sel[ctr_n] <= PWDATA[6:0];
+		 cnt_en[ctr_n] <= PWDATA[31];
+	      end
+	      2'd2:	cnt[ctr_n][31:0] <= PWDATA;
+	      2'd3:	cnt[ctr_n][63:32] <= PWDATA;
+	      default: ;
+	    endcase
+	 end
+      end
+
+      if (reset) begin
+	 enable <= 1'b0;
+	 ovf <= {NR_COUNTERS{1'b0}};
+	 ovf_en <= {NR_COUNTERS{1'b0}};
+	 irq_last <= {NR_COUNTERS{1'b0}};
+	 cnt_en <= {NR_COUNTERS{1'b0}};
+	 for (i = 0; i < NR_COUNTERS; i = i + 1) begin
+	    sel[i] <= 7'd64;
+	    cnt[i] <= 64'h0;
+	 end
+      end
+   end
+
+endmodule // apb_pctrs
@@ -21,7 +21,7 @@
 
 import sys
 import struct
-from debugpipe import DebugPipe
+from debugpipe import DebugPipe, SimBackdoor
 import getopt
 
 
@@ -105,6 +105,7 @@ def     usage(s):
           "\t\t-s <serial tty>                Connect using serial link via tty\n" \
           "\t\t-t <hostname>                  Connect using TCP socket to host\n" \
           "\t\t-f <url>                       Connect using FTDI url\n" \
+          "\t\t-m <hostname>                  Connect to a sim's memory backdoor (fast)\n" \
           "\t\t-v                             Verbose debug\n" \
           "\t\t-b                             Big-endian read/write word\n" \
           "\tCommands: \n" \
@@ -119,7 +120,7 @@ def     usage(s):
 
 
 try:
-    opts, args = getopt.getopt(sys.argv[1:], "hvbs:t:f:")
+    opts, args = getopt.getopt(sys.argv[1:], "hvbs:t:f:m:")
 except getopt.GetoptError as err:
     usage(sys.argv[0])
     print("Invocation error: " + str(err))
@@ -138,7 +139,7 @@ for o, a in opts:
         verbose = True
     elif o == "-b":
         big_endian = True
-    elif o == "-s" or o == "-t" or o == "-f":
+    elif o == "-s" or o == "-t" or o == "-f" or o == "-m":
         if conn is not None:
             usage(sys.argv[0])
             print("Multiple connections specified");
@@ -150,7 +151,7 @@ for o, a in opts:
 dp = None
 if conn is None:
     usage(sys.argv[0])
-    print("Need one of -s or -t!");
+    print("Need one of -s, -t, -f or -m!");
     sys.exit(1)
 elif conn == "-s":
     dp = DebugPipe(tty=conn_arg, debug=verbose)
@@ -158,6 +159,8 @@ elif conn == "-t":
     dp = DebugPipe(host=conn_arg, debug=verbose)
 elif conn == "-f":
     dp = DebugPipe(url=conn_arg, debug=verbose)
+elif conn == "-m":
+    dp = SimBackdoor(host=conn_arg, debug=verbose)
 
 
 # Parse commands:
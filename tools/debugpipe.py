@@ -234,5 +234,67 @@ class DebugPipe:
         if self.conduit is not None:
             self.conduit.disconnect()
 
+class SimBackdoor:
+    'Bulk memory access to a Verilator sim, via its memory backdoor port'
+
+    # Constants
+    CMD_READ = 1
+    CMD_WRITE = 2
+    MAX_XFER_SIZE = (64*1024*1024)
+
+    def __init__(self, host, port=2002, debug=False):
+        self.debug = debug
+        self.s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        try:
+            self.s.connect((host, port))
+        except Exception as e:
+            print(e)
+            raise Exception("Connection failed")
+
+    def _xfer(self, cmd, address, length, data=None):
+        whdr = struct.pack('<IIQ', cmd, length, address)
+        if self.debug:
+            print("B:Hdr: " + str(list(whdr)))
+        self.s.sendall(whdr)
+        if data is not None:
+            self.s.sendall(data)
+        (status, rlen) = struct.unpack('<II', self.s.recv(8, socket.MSG_WAITALL))
+        assert (status != 2), "Backdoor rejected request (cmd %d len %d)" % (cmd, length)
+        assert (status == 0), "Backdoor access to 0x%x failed (not RAM?)" % (address)
+        rdata = bytes()
+        while len(rdata) < rlen:
+            rdata += self.s.recv(rlen - len(rdata), socket.MSG_WAITALL)
+        return rdata
+
+    def read(self, address, length, verbose=False):
+        data = bytes()
+        while length > 0:
+            l = min(length, self.MAX_XFER_SIZE)
+            data += self._xfer(self.CMD_READ, address, l)
+            address += l
+            length -= l
+        return data
+
+    def read32(self, address, big_endian=False):
+        d = self.read(address, 4)
+        (i,) = struct.unpack('>I' if big_endian else '<I', d)
+        return i
+
+    def write(self, address, data, verbose=False, sync=False):
+        data = bytes(data)
+        while len(data) > 0:
+            l = min(len(data), self.MAX_XFER_SIZE)
+            self._xfer(self.CMD_WRITE, address, l, data[:l])
+            data = data[l:]
+            address += l
+        if verbose:
+            print("Done")
+
+    def write32(self, address, data, big_endian=False):
+        self.write(address, struct.pack('>I' if big_endian else '<I', data))
+
+    def disconnect(self):
+        self.s.close()
+
 if __name__ == "__main__":
     print("Don't run this directly, import it into another program.")
@@ -0,0 +1,156 @@
+#!/usr/bin/env python3
+#
+# Decodes a probe file written by the Verilated sim (Vtb_top -P ...) into
+# text, one line per event in cycle order.
+#
+# Copyright 2020-2022 Matt Evans
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import sys
+import struct
+import getopt
+
+
+################################################################################
+
+# Must match probe_file_hdr_t/probe_rec_t in verilator/probe.h
+MAGIC = b'MRPROBE2'
+PROBE_MAX = 16
+PROBE_NAME_LEN = 16
+HDR_FMT = '<8sII' + ('%ds' % PROBE_NAME_LEN) * PROBE_MAX
+REC_FMT = '<QHHIIIIIII'
+
+def     fmt_branch(r):
+    return "%08x -> %08x" % (r[3], r[4])
+
+def     fmt_syscall(r):
+    return "%08x: sc(%4d): args=%08x %08x %08x %08x %08x" % (r[3], r[4], r[5], r[6], r[7], r[8], r[9])
+
+def     fmt_exception(r):
+    return "%08x: fault %d, MSR %08x, instr %08x" % (r[3], r[4], r[5], r[6])
+
+def     fmt_rfi(r):
+    return "%08x: rfi to %08x, MSR %08x" % (r[3], r[4], r[5])
+
+def     fmt_mmu_fault(r):
+    if r[6] == 0x400:
+        return "%08x: ISI" % r[3]
+    return "%08x: DSI, DAR %08x DSISR %08x" % (r[3], r[4], r[5])
+
+def     fmt_irq(r):
+    return "%08x: INTC pending %08x enabled %08x" % (r[3], r[4], r[5])
+
+def     fmt_uart_tx(r):
+    c = r[4] & 0xff
+    return "%08x: %02x %s" % (r[3], c, repr(chr(c)))
+
+FORMATTERS = {
+    'branch': fmt_branch,
+    'syscall': fmt_syscall,
+    'exception': fmt_exception,
+    'rfi': fmt_rfi,
+    'mmu_fault': fmt_mmu_fault,
+    'irq': fmt_irq,
+    'uart_tx': fmt_uart_tx,
+}
+
+def     fmt_default(r):
+    return "%08x: %08x %08x %08x %08x %08x %08x" % (r[3], r[4], r[5], r[6], r[7], r[8], r[9])
+
+
+def     read_probes(name):
+    with open(name, "rb") as f:
+        data = f.read()
+
+    hsize = struct.calcsize(HDR_FMT)
+    if len(data) < hsize:
+        raise ValueError("Truncated header")
+    h = struct.unpack_from(HDR_FMT, data, 0)
+    if h[0] != MAGIC:
+        raise ValueError("Not a probe file")
+    rec_size = h[1]
+    nprobes = h[2]
+    names = [ n.rstrip(b'\0').decode() for n in h[3:3+nprobes] ]
+    if rec_size != struct.calcsize(REC_FMT):
+        raise ValueError("Unexpected record size %d" % (rec_size))
+
+    nrecs = (len(data) - hsize) // rec_size
+    recs = [ struct.unpack_from(REC_FMT, data, hsize + i*rec_size) for i in range(nrecs) ]
+    # Each probe's records are in order, but they're interleaved in chunks:
+    recs.sort(key=lambda r: (r[0], r[1]))
+    return names, recs
+
+
+def     usage(s):
+    print("%s [options] <probe file>\n" \
+          "\tOptions: \n" \
+          "\t\t-p <probe,probe...>            Only show these probes\n" \
+          "\t\t-s <cycle>                     Start at cycle\n" \
+          "\t\t-e <cycle>                     End at cycle\n" \
+          "\t\t-c                             Just count events per probe\n" \
+          % (s))
+
+################################################################################
+
+
+try:
+    opts, args = getopt.getopt(sys.argv[1:], "hcp:s:e:")
+except getopt.GetoptError as err:
+    usage(sys.argv[0])
+    print("Invocation error: " + str(err))
+    sys.exit(1)
+
+only = None
+start = 0
+end = None
+counts = False
+
+for o, a in opts:
+    if o == "-h":
+        usage(sys.argv[0])
+        sys.exit(1)
+    elif o == "-p":
+        only = a.split(",")
+    elif o == "-s":
+        start = int(a, 0)
+    elif o == "-e":
+        end = int(a, 0)
+    elif o == "-c":
+        counts = True
+
+if len(args) != 1:
+    usage(sys.argv[0])
+    sys.exit(1)
+
+try:
+    names, recs = read_probes(args[0])
+except (OSError, ValueError) as err:
+    print("Can't read '%s': %s" % (args[0], err))
+    sys.exit(1)
+
+n = {}
+for r in recs:
+    if r[0] < start or (end is not None and r[0] > end):
+        continue
+    name = names[r[1]] if r[1] < len(names) else "probe%d" % (r[1])
+    if only is not None and name not in only:
+        continue
+    if counts:
+        n[name] = n.get(name, 0) + 1
+    else:
+        print("%12d %-10s %s" % (r[0], name, FORMATTERS.get(name, fmt_default)(r)))
+
+if counts:
+    for name in names:
+        print("%-12s %d" % (name, n.get(name, 0)))
@@ -0,0 +1,185 @@
+#!/usr/bin/env python3
+#
+# Simulator throughput benchmark: runs the Verilated model on a fixed set of
+# workloads, and collects the stats each run writes (Vtb_top -J) into one
+# JSON file.  Optionally compares against an earlier run and fails if any
+# workload's cycles/sec has dropped by more than a threshold.
+#
+# Copyright 2020-2022 Matt Evans
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import sys
+import os
+import json
+import getopt
+import subprocess
+import tempfile
+
+
+################################################################################
+
+# The corpus.  Workloads needing a checkpoint are skipped if it isn't given:
+#  - 'kernel' is a checkpoint taken just after the bootloader has started the
+#    kernel's decompressor
+#  - 'linux' is a checkpoint of Linux booted to a shell prompt
+#
+# The user loop's -e string is computed by the shell, so the echo of the
+# typed command doesn't match it.
+WORKLOADS = [
+    { 'name': 'boot_rom',
+      'desc': 'Boot ROM to the download prompt',
+      'needs': None,
+      'args': [ '-e', 'Waiting for host download', '-l', '100000000' ] },
+    { 'name': 'kernel_decompress',
+      'desc': 'Kernel decompression, from a checkpoint',
+      'needs': 'kernel',
+      'args': [ '-l', '50000000' ] },
+    { 'name': 'user_loop',
+      'desc': 'User-space shell loop, from a booted Linux checkpoint',
+      'needs': 'linux',
+      'args': [ '-i', 'i=0; while [ $i -lt 20000 ]; do i=$((i+1)); done; echo bench-$((6*7))\n',
+                '-e', 'bench-42', '-l', '500000000' ] },
+]
+
+def     run_workload(sim, w, ckpt, verbose):
+    fd, stats_name = tempfile.mkstemp(prefix='sim_bench_', suffix='.json')
+    os.close(fd)
+
+    cmd = [ sim, '-J', stats_name ] + w['args']
+    if ckpt is not None:
+        cmd += [ '-R', ckpt ]
+    if verbose:
+        print("Running: %s" % (cmd))
+
+    out = None if verbose else subprocess.DEVNULL
+    r = subprocess.run(cmd, stdout=out, stderr=out)
+    try:
+        with open(stats_name, "r") as f:
+            stats = json.load(f)
+    except (OSError, ValueError):
+        stats = None
+    os.unlink(stats_name)
+
+    if r.returncode != 0 or stats is None:
+        print("%s: FAILED (exit status %d)" % (w['name'], r.returncode))
+        return None
+    if not stats['finished'] and '-e' in w['args']:
+        print("WARNING: %s hit its cycle limit before finishing" % (w['name']))
+    return stats
+
+
+def     print_stats(name, s):
+    print("%-20s %12d cycles %10.0f cycles/s %8.3f MIPS  IPC %.3f  RSS %dMB" % \
+          (name, s['cycles'], s['cycles_per_sec'], s['mips'], s['ipc'],
+           s['peak_rss_kb'] // 1024))
+
+
+def     compare(results, baseline_name, threshold):
+    with open(baseline_name, "r") as f:
+        baseline = json.load(f)['workloads']
+
+    regressed = False
+    for name, s in results.items():
+        if name not in baseline:
+            continue
+        old = baseline[name]['cycles_per_sec']
+        change = (s['cycles_per_sec'] - old) * 100.0 / old if old else 0.0
+        flag = ""
+        if change < -threshold:
+            flag = "  <-- REGRESSION"
+            regressed = True
+        print("%-20s %+7.2f%% cycles/s vs baseline%s" % (name, change, flag))
+    return regressed
+
+
+def     usage(s):
+    print("%s [options]\n" \
+          "\tOptions: \n" \
+          "\t\t-x <sim>                       Simulator (default ./verilator/obj_dir/Vtb_top)\n" \
+          "\t\t-k <checkpoint>                Kernel-decompress checkpoint\n" \
+          "\t\t-u <checkpoint>                Booted-Linux checkpoint\n" \
+          "\t\t-w <workload>                  Only run this workload (repeatable)\n" \
+          "\t\t-o <file>                      Write results as JSON\n" \
+          "\t\t-c <file>                      Compare to baseline results\n" \
+          "\t\t-t <percent>                   Regression threshold (default 5)\n" \
+          "\t\t-v                             Verbose (show sim output)\n" \
+          "\tWorkloads: %s\n" \
+          % (s, ", ".join([w['name'] for w in WORKLOADS])))
+
+################################################################################
+
+
+try:
+    opts, args = getopt.getopt(sys.argv[1:], "hvx:k:u:w:o:c:t:")
+except getopt.GetoptError as err:
+    usage(sys.argv[0])
+    print("Invocation error: " + str(err))
+    sys.exit(1)
+
+sim = "./verilator/obj_dir/Vtb_top"
+ckpts = { 'kernel': None, 'linux': None }
+only = []
+out_name = None
+baseline_name = None
+threshold = 5.0
+verbose = False
+
+for o, a in opts:
+    if o == "-h":
+        usage(sys.argv[0])
+        sys.exit(1)
+    elif o == "-v":
+        verbose = True
+    elif o == "-x":
+        sim = a
+    elif o == "-k":
+        ckpts['kernel'] = a
+    elif o == "-u":
+        ckpts['linux'] = a
+    elif o == "-w":
+        only.append(a)
+    elif o == "-o":
+        out_name = a
+    elif o == "-c":
+        baseline_name = a
+    elif o == "-t":
+        threshold = float(a)
+
+results = {}
+failed = False
+for w in WORKLOADS:
+    if only and w['name'] not in only:
+        continue
+    ckpt = None
+    if w['needs'] is not None:
+        ckpt = ckpts[w['needs']]
+        if ckpt is None:
+            print("%-20s skipped (no '%s' checkpoint)" % (w['name'], w['needs']))
+            continue
+    s = run_workload(sim, w, ckpt, verbose)
+    if s is None:
+        failed = True
+        continue
+    results[w['name']] = s
+    print_stats(w['name'], s)
+
+if out_name is not None:
+    with open(out_name, "w") as f:
+        json.dump({ 'sim': sim, 'workloads': results }, f, indent=2)
+        f.write("\n")
+
+if baseline_name is not None and compare(results, baseline_name, threshold):
+    failed = True
+
+sys.exit(1 if failed else 0)
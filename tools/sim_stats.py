@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+#
+# Shows the live stats of running Verilated sims, read from the shared
+# memory pages they publish (Vtb_top --stats-shm <name>), one line per sim.
+# A sim whose cycle count doesn't move between two samples is flagged as
+# wedged.
+#
+# Copyright 2020-2022 Matt Evans
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import sys
+import os
+import time
+import struct
+import getopt
+
+
+################################################################################
+
+# Must match stats_page_t in verilator/status.h
+MAGIC = 0x4d525354
+VERSION = 1
+PAGE_FMT = '=IIIIQQQQQQII64Q'
+SHM_DIR = '/dev/shm'
+
+def     read_page(path):
+    size = struct.calcsize(PAGE_FMT)
+    # Retry if caught mid-update (seq odd, or changed whilst reading)
+    for i in range(10):
+        try:
+            with open(path, "rb") as f:
+                data = f.read(size)
+        except OSError:
+            return None
+        if len(data) < size:
+            return None
+        p = struct.unpack(PAGE_FMT, data)
+        if p[0] != MAGIC or p[1] != VERSION:
+            return None
+        seq = p[2]
+        if seq & 1:
+            time.sleep(0.001)
+            continue
+        return { 'pid': p[3], 'cycles': p[4], 'instrs': p[5], 'stalls': p[6],
+                 'uart': p[7], 'host_ms': p[8], 'cps': p[9], 'finished': p[10],
+                 'pctrs': p[12:12+64] }
+    return None
+
+
+def     find_pages():
+    names = []
+    for n in sorted(os.listdir(SHM_DIR)):
+        if read_page(os.path.join(SHM_DIR, n)) is not None:
+            names.append(n)
+    return names
+
+
+def     alive(pid):
+    try:
+        os.kill(pid, 0)
+    except ProcessLookupError:
+        return False
+    except PermissionError:
+        pass
+    return True
+
+
+def     show(names, interval, pctrs):
+    before = { n: read_page(os.path.join(SHM_DIR, n)) for n in names }
+    time.sleep(interval)
+    print("%-20s %8s %14s %12s %12s %7s %10s %8s  %s" % \
+          ("name", "pid", "cycles", "cycles/s", "instrs", "IPC", "UART", "time", "state"))
+    for n in names:
+        p = read_page(os.path.join(SHM_DIR, n))
+        b = before[n]
+        if p is None or b is None:
+            continue
+        state = "running"
+        if p['finished']:
+            state = "finished"
+        elif not alive(p['pid']):
+            state = "DEAD"
+        elif p['cycles'] == b['cycles']:
+            state = "WEDGED?"
+        print("%-20s %8d %14d %12d %12d %7.3f %10d %7ds  %s" % \
+              (n, p['pid'], p['cycles'], p['cps'], p['instrs'],
+               p['instrs'] / p['cycles'] if p['cycles'] else 0.0, p['uart'],
+               p['host_ms'] // 1000, state))
+        if pctrs:
+            ev = [ "%d:%d" % (i, c) for i, c in enumerate(p['pctrs']) if c ]
+            print("%20s pctrs %s" % ("", " ".join(ev) if ev else "(none)"))
+
+
+def     usage(s):
+    print("%s [options] [shm name...]\n" \
+          "\tOptions: \n" \
+          "\t\t-i <secs>                      Sample interval, for wedge detection (default 2)\n" \
+          "\t\t-w                             Watch: repeat until interrupted\n" \
+          "\t\t-p                             Show non-zero perf event counts\n" \
+          "\tWithout names, shows every stats page in %s\n" \
+          % (s, SHM_DIR))
+
+################################################################################
+
+
+try:
+    opts, args = getopt.getopt(sys.argv[1:], "hwpi:")
+except getopt.GetoptError as err:
+    usage(sys.argv[0])
+    print("Invocation error: " + str(err))
+    sys.exit(1)
+
+interval = 2.0
+watch = False
+pctrs = False
+
+for o, a in opts:
+    if o == "-h":
+        usage(sys.argv[0])
+        sys.exit(1)
+    elif o == "-i":
+        interval = float(a)
+    elif o == "-w":
+        watch = True
+    elif o == "-p":
+        pctrs = True
+
+names = [ n.lstrip('/') for n in args ]
+try:
+    while True:
+        show(names if names else find_pages(), interval, pctrs)
+        if not watch:
+            break
+        print("")
+except KeyboardInterrupt:
+    pass
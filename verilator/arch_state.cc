@@ -17,10 +17,15 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "testbench.h"
+#include "cpu_signals.h"
 #include "arch_state.h"
 
 
@@ -30,327 +35,1209 @@ typedef struct {
 	uint64_t 	data;
 } ss_chunk_t;
 
-
-#define STS_GPR_FMT	"GPR%02d"
-#define STS_SR_FMT	"SR%02d"
+/* Chunks are a name (NUL-padded to 8 bytes) and len, followed by len bytes,
+ * of which the first 8 are the data field:
+ *
+ *	<reg>	A register's value
+ *	MEMBLK	data is the PA, followed by the memory's contents
+ *	MEMZERO	data is the PA, followed by a 64-bit size of zeroed memory
+ *	PAD	Padding, ignored (so that MEMBLK contents can be mapped)
+ *
+ * MR-ISS reads and writes only registers and MEMBLKs, which is what
+ * tb_save_arch_state() writes unless asked for a sparse save.
+ */
 #define STS_MEM		"MEMBLK"
+#define STS_MEMZERO	"MEMZERO"
+#define STS_PAD		"PAD"
+
+#define STS_PAGE_SZ	4096
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Register descriptors
+
+/* Get/set of a register in the model, for an index i in [0, count) for
+ * multi-named registers:
+ */
+#define AR_REG(id, lval)							\
+	static uint64_t	ar_get_##id(Testbench *tb, int i)		{ return lval; } \
+	static void	ar_set_##id(Testbench *tb, int i, uint64_t v)	{ lval = v; }
+
+#define SPRF(tb)	(CPU(tb)->DE->SPRF)
+#define INTC(tb)	((tb)->getTop()->tb_top->MR->INTC)
+#define CON(tb)		((tb)->getTop()->tb_top->MR->CONSOLE_UART->REGIF)
+
+AR_REG(gpr, CPU(tb)->DE->GPRF->registers[i])
+AR_REG(sr, CPU(tb)->MEM->segment[i])
+AR_REG(lr, SPRF(tb)->as_LR)
+AR_REG(ctr, SPRF(tb)->as_CTR)
+AR_REG(sprg0, SPRF(tb)->as_SPRG0)
+AR_REG(sprg1, SPRF(tb)->as_SPRG1)
+AR_REG(sprg2, SPRF(tb)->as_SPRG2)
+AR_REG(sprg3, SPRF(tb)->as_SPRG3)
+AR_REG(srr0, SPRF(tb)->as_SRR0)
+AR_REG(srr1, SPRF(tb)->as_SRR1)
+AR_REG(dar, SPRF(tb)->as_DAR)
+AR_REG(dsisr, SPRF(tb)->as_DSISR)
+AR_REG(sdr1, SPRF(tb)->as_SDR1)
+AR_REG(dec, CPU(tb)->DE->TBDEC->as_DEC)
+AR_REG(tb, CPU(tb)->DE->TBDEC->as_TB)
+AR_REG(ibat0u, SPRF(tb)->as_IBAT0U)
+AR_REG(ibat0l, SPRF(tb)->as_IBAT0L)
+AR_REG(ibat1u, SPRF(tb)->as_IBAT1U)
+AR_REG(ibat1l, SPRF(tb)->as_IBAT1L)
+AR_REG(ibat2u, SPRF(tb)->as_IBAT2U)
+AR_REG(ibat2l, SPRF(tb)->as_IBAT2L)
+AR_REG(ibat3u, SPRF(tb)->as_IBAT3U)
+AR_REG(ibat3l, SPRF(tb)->as_IBAT3L)
+AR_REG(dbat0u, SPRF(tb)->as_DBAT0U)
+AR_REG(dbat0l, SPRF(tb)->as_DBAT0L)
+AR_REG(dbat1u, SPRF(tb)->as_DBAT1U)
+AR_REG(dbat1l, SPRF(tb)->as_DBAT1L)
+AR_REG(dbat2u, SPRF(tb)->as_DBAT2U)
+AR_REG(dbat2l, SPRF(tb)->as_DBAT2L)
+AR_REG(dbat3u, SPRF(tb)->as_DBAT3U)
+AR_REG(dbat3l, SPRF(tb)->as_DBAT3L)
+AR_REG(ic_ier, INTC(tb)->enabled)
+AR_REG(con_isr, CON(tb)->irq_status)
+AR_REG(con_ier, CON(tb)->irq_enable)
+
+/* The PC/MSR are those of the instruction in MEM, and set fetch's */
+static uint64_t	ar_get_pc(Testbench *tb, int i)		{ return CPU_MEM_PC(CPU(tb)); }
+static uint64_t	ar_get_msr(Testbench *tb, int i)	{ return CPU_MEM_MSR(CPU(tb)); }
+
+static void	ar_set_pc(Testbench *tb, int i, uint64_t v)
+{
+	CPU(tb)->IF->current_pc = v;
+	CPU(tb)->IF->fetch_pc = v;
+}
+
+static void	ar_set_msr(Testbench *tb, int i, uint64_t v)
+{
+	CPU(tb)->IF->current_msr = v;
+	CPU(tb)->IF->fetch_msr = v;
+}
 
-#define STS_MEM_CHUNK_SZ	0x200000
+/* XER[SO,OV,CA] and XER[6:0] live above CR in as_XERCR */
+static uint64_t	ar_get_xer(Testbench *tb, int i)
+{
+	uint64_t xercr = CPU(tb)->DE->as_XERCR;
+	return ((xercr >> 3) & 0xe0000000) | ((xercr >> 35) & 0x7f);
+}
+
+static void	ar_set_xer(Testbench *tb, int i, uint64_t v)
+{
+	CPU(tb)->DE->as_XERCR = ((v & 0x7f) << 35) | ((v & 0xe0000000) << 3) |
+		(CPU(tb)->DE->as_XERCR & 0xffffffff);
+}
+
+static uint64_t	ar_get_cr(Testbench *tb, int i)
+{
+	return CPU(tb)->DE->as_XERCR & 0xffffffff;
+}
+
+static void	ar_set_cr(Testbench *tb, int i, uint64_t v)
+{
+	CPU(tb)->DE->as_XERCR = (CPU(tb)->DE->as_XERCR & ~0xffffffffULL) | (v & 0xffffffff);
+}
 
+/* This is the captured state of edge inputs, assuming levels will sort
+ * themselves out in due course.
+ */
+static uint64_t	ar_get_ic_isr(Testbench *tb, int i)	{ return (uint64_t)INTC(tb)->pending << 4; }
+static void	ar_set_ic_isr(Testbench *tb, int i, uint64_t v)	{ INTC(tb)->pending = v >> 4; } // FIXME, probe size
+
+static uint64_t	ar_get_ic_mer(Testbench *tb, int i)
+{
+	return INTC(tb)->me | (INTC(tb)->hie << 1);
+}
+
+static void	ar_set_ic_mer(Testbench *tb, int i, uint64_t v)
+{
+	INTC(tb)->me = v & 1;
+	INTC(tb)->hie = !!(v & 2);
+}
+
+/* Each register also has its place in an arch_regs_t (the registers MR-ISS
+ * has, and the INTC/console ones), if any, from which tb_read_arch_regs()/
+ * tb_write_arch_regs() work.
+ */
+typedef struct {
+	const char	*name;		// printf format, with count > 1
+	int		count;
+	uint64_t	(*get)(Testbench *tb, int i);		// NULL if not in the model
+	void		(*set)(Testbench *tb, int i, uint64_t v);
+	int		regs_off;	// Of [0] in arch_regs_t, or -1
+	int		regs_size;	// Per register
+} arch_reg_desc_t;
+
+#define AR_FIELD(f)		offsetof(arch_regs_t, f), sizeof(((arch_regs_t *)0)->f)
+#define AR(name, id, f)		{ name, 1, ar_get_##id, ar_set_##id, AR_FIELD(f) }
+#define AR_N(fmt, n, id, f)	{ fmt, n, ar_get_##id, ar_set_##id, AR_FIELD(f[0]) }
+#define AR_NONE(name)		{ name, 1, NULL, NULL, -1, 0 }
+
+static const arch_reg_desc_t arch_reg_descs[] = {
+	AR("PC", pc, pc),		AR("MSR", msr, msr),		AR("CR", cr, cr),
+	AR("XER", xer, xer),		AR("LR", lr, lr),		AR("CTR", ctr, ctr),
+	AR_N("GPR%02d", 32, gpr, gpr),
+	AR("SPRG0", sprg0, sprg[0]),	AR("SPRG1", sprg1, sprg[1]),	AR("SPRG2", sprg2, sprg[2]),
+	AR("SPRG3", sprg3, sprg[3]),	AR("SRR0", srr0, srr0),		AR("SRR1", srr1, srr1),
+	AR("DAR", dar, dar),		AR("DSISR", dsisr, dsisr),	AR("SDR1", sdr1, sdr1),
+	AR("DEC", dec, dec),		AR("TB", tb, tb),
+	AR("IBAT0U", ibat0u, ibat[0]),	AR("IBAT0L", ibat0l, ibat[1]),
+	AR("IBAT1U", ibat1u, ibat[2]),	AR("IBAT1L", ibat1l, ibat[3]),
+	AR("IBAT2U", ibat2u, ibat[4]),	AR("IBAT2L", ibat2l, ibat[5]),
+	AR("IBAT3U", ibat3u, ibat[6]),	AR("IBAT3L", ibat3l, ibat[7]),
+	AR("DBAT0U", dbat0u, dbat[0]),	AR("DBAT0L", dbat0l, dbat[1]),
+	AR("DBAT1U", dbat1u, dbat[2]),	AR("DBAT1L", dbat1l, dbat[3]),
+	AR("DBAT2U", dbat2u, dbat[4]),	AR("DBAT2L", dbat2l, dbat[5]),
+	AR("DBAT3U", dbat3u, dbat[6]),	AR("DBAT3L", dbat3l, dbat[7]),
+	AR_N("SR%02d", 16, sr, sr),
+	/* Not in MR-ISS's CPU state: */
+	AR("IC_ISR", ic_isr, ic_isr),	AR("IC_IER", ic_ier, ic_ier),	AR("IC_MER", ic_mer, ic_mer),
+	AR("CON_ISR", con_isr, con_isr), AR("CON_IER", con_ier, con_ier),
+	/* No register (CON_SR is calculated live from FIFO status; FIFOs
+	 * are empty):
+	 */
+	AR_NONE("HID0"),	AR_NONE("HID1"),	AR_NONE("IRQ"),
+	AR_NONE("CON_SR"),
+};
+
+#define NUM_ARCH_REG_DESCS	(sizeof(arch_reg_descs) / sizeof(arch_reg_descs[0]))
+
+/* Every name, expanded, as the 8-byte chunk name */
+#define MAX_ARCH_REG_NAMES	128
+
+static struct {
+	uint64_t		name;
+	const arch_reg_desc_t	*desc;
+	int			i;
+} arch_reg_names[MAX_ARCH_REG_NAMES];
+static int arch_reg_names_num = 0;
+
+static uint64_t	chunk_name(const char *s)
+{
+	uint64_t n = 0;
+	strncpy((char *)&n, s, sizeof(n));
+	return n;
+}
+
+static void	arch_reg_names_init(void)
+{
+	if (arch_reg_names_num)
+		return;
+
+	for (unsigned int d = 0; d < NUM_ARCH_REG_DESCS; d++) {
+		for (int i = 0; i < arch_reg_descs[d].count; i++) {
+			char n[16];
+
+			snprintf(n, sizeof(n), arch_reg_descs[d].name, i);
+			arch_reg_names[arch_reg_names_num].name = chunk_name(n);
+			arch_reg_names[arch_reg_names_num].desc = &arch_reg_descs[d];
+			arch_reg_names[arch_reg_names_num].i = i;
+			arch_reg_names_num++;
+		}
+	}
+}
+
+static int	arch_reg_write(Testbench *tb, uint64_t name, uint64_t data)
+{
+	arch_reg_names_init();
+
+	for (int n = 0; n < arch_reg_names_num; n++) {
+		if (arch_reg_names[n].name == name) {
+			if (arch_reg_names[n].desc->set)
+				arch_reg_names[n].desc->set(tb, arch_reg_names[n].i, data);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* Sets a register in the model, by its arch state chunk name; returns
+ * non-zero if the name's unknown.
+ */
+int	tb_write_arch_reg(Testbench *tb, const char *name, uint64_t data)
+{
+	return arch_reg_write(tb, chunk_name(name), data);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Restore
+
+/* Memory whose offset in the file is congruent, modulo the page size, with
+ * its host address in RAM (as tb_save_arch_state() pads it to be) has its
+ * interior pages mapped over the RAM copy-on-write, rather than copied.
+ */
+static int	restore_mem(Testbench *tb, int fd, uint64_t base, const uint8_t *src,
+			    uint64_t file_off, uint64_t len, uint64_t *mapped)
+{
+	uint64_t avail;
+	uint8_t *to = tb->ram_ptr(base, &avail);	// Only BRAM, not REAL_RAM
+
+	if (!to || avail < len) {
+		printf("Memory chunk at %08x isn't in RAM!\n", (uint32_t)base);
+		return -1;
+	}
+
+	uint64_t head = (STS_PAGE_SZ - (uintptr_t)to % STS_PAGE_SZ) % STS_PAGE_SZ;
+	uint64_t map_len = len > head ? (len - head) & ~(uint64_t)(STS_PAGE_SZ - 1) : 0;
+
+	if (map_len && ((uintptr_t)to % STS_PAGE_SZ) == (file_off % STS_PAGE_SZ) &&
+	    mmap(to + head, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+		 fd, file_off + head) != MAP_FAILED) {
+		memcpy(to, src, head);
+		*mapped += map_len;
+		src += head + map_len;
+		to += head + map_len;
+		len -= head + map_len;
+	}
+	memcpy(to, src, len);
+	return 0;
+}
 
 int 	tb_restore_arch_state(int fd, Testbench *tb)
 {
-	uint64_t 	val;
-	ss_chunk_t	ch;
-	int		r;
+	struct stat st;
+	uint8_t *f;
+	uint64_t off = 0;
+	uint64_t restored = 0, mapped = 0, zeroed = 0;
+	int r = 0;
+
+	if (fstat(fd, &st) != 0)
+		return -1;
+	f = (uint8_t *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (f == MAP_FAILED)
+		return -1;
 
-	do {
-		r = read(fd, &ch, sizeof(ch));
-		if (r != sizeof(ch)) 	break;
+	while (off + sizeof(ss_chunk_t) <= (uint64_t)st.st_size) {
+		ss_chunk_t *ch = (ss_chunk_t *)(f + off);
+		uint64_t extra = ch->len > 8 ? ch->len - 8 : 0;
+		uint64_t payload = off + sizeof(ss_chunk_t);
+
+		if (payload + extra > (uint64_t)st.st_size) {
+			printf("Truncated arch state chunk at offset %lu\n", off);
+			r = -1;
+			break;
+		}
 
 		// What's the chunk just read?
-		if (!strcmp("PC", (char *)&ch.name)) {
-			tb->getTop()->tb_top->MR->CPU->CPU->IF->current_pc = ch.data;
-			tb->getTop()->tb_top->MR->CPU->CPU->IF->fetch_pc = ch.data;
-		} else if (!strcmp("MSR", (char *)&ch.name)) {
-			tb->getTop()->tb_top->MR->CPU->CPU->IF->current_msr = ch.data;
-			tb->getTop()->tb_top->MR->CPU->CPU->IF->fetch_msr = ch.data;
-		} else if (!strcmp("CTR", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_CTR = ch.data;
-		else if (!strcmp("LR", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_LR = ch.data;
-		else if (!strcmp("XER", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->as_XERCR =
-				((ch.data & 0x7f) << 35) | ((ch.data & 0xe0000000) << 3) |
-				(tb->getTop()->tb_top->MR->CPU->CPU->DE->as_XERCR & 0xffffffff);
-		else if (!strcmp("CR", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->as_XERCR =
-				(tb->getTop()->tb_top->MR->CPU->CPU->DE->as_XERCR & ~0xffffffff) |
-				(ch.data & 0xffffffff);
-		else if (!strcmp("HID0", (char *)&ch.name))
-		{ /* No register */ }
-		else if (!strcmp("HID1", (char *)&ch.name))
-		{ /* No register */ }
-		else if (!strcmp("SPRG0", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_SPRG0 = ch.data;
-		else if (!strcmp("SPRG1", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_SPRG1 = ch.data;
-		else if (!strcmp("SPRG2", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_SPRG2 = ch.data;
-		else if (!strcmp("SPRG3", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_SPRG3 = ch.data;
-		else if (!strcmp("SRR0", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_SRR0 = ch.data;
-		else if (!strcmp("SRR1", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_SRR1 = ch.data;
-		else if (!strcmp("DAR", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_DAR = ch.data;
-		else if (!strcmp("DSISR", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_DSISR = ch.data;
-		else if (!strcmp("DEC", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->TBDEC->as_DEC = ch.data;
-		else if (!strcmp("TB", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->TBDEC->as_TB = ch.data;
-		else if (!strcmp("SDR1", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_SDR1 = ch.data;
-		else if (!strcmp("IBAT0U", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_IBAT0U = ch.data;
-		else if (!strcmp("IBAT0L", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_IBAT0L = ch.data;
-		else if (!strcmp("IBAT1U", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_IBAT1U = ch.data;
-		else if (!strcmp("IBAT1L", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_IBAT1L = ch.data;
-		else if (!strcmp("IBAT2U", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_IBAT2U = ch.data;
-		else if (!strcmp("IBAT2L", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_IBAT2L = ch.data;
-		else if (!strcmp("IBAT3U", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_IBAT3U = ch.data;
-		else if (!strcmp("IBAT3L", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_IBAT3L = ch.data;
-		else if (!strcmp("DBAT0U", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_DBAT0U = ch.data;
-		else if (!strcmp("DBAT0L", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_DBAT0L = ch.data;
-		else if (!strcmp("DBAT1U", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_DBAT1U = ch.data;
-		else if (!strcmp("DBAT1L", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_DBAT1L = ch.data;
-		else if (!strcmp("DBAT2U", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_DBAT2U = ch.data;
-		else if (!strcmp("DBAT2L", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_DBAT2L = ch.data;
-		else if (!strcmp("DBAT3U", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_DBAT3U = ch.data;
-		else if (!strcmp("DBAT3L", (char *)&ch.name))
-			tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_DBAT3L = ch.data;
-		else if (!strcmp("IRQ", (char *)&ch.name))
-		{ /* No register yet */ }
-		else if (!strcmp("IC_ISR", (char *)&ch.name)) {
-                        /* This is the captured state of edge inputs,
-                         * assuming levels will sort themselves out in
-                         * due course.
-                         */
-                        tb->getTop()->tb_top->MR->INTC->pending = ch.data >> 4; // FIXME, probe size
-                } else if (!strcmp("IC_IER", (char *)&ch.name)) {
-                        tb->getTop()->tb_top->MR->INTC->enabled = ch.data;
-                } else if (!strcmp("IC_MER", (char *)&ch.name)) {
-                        tb->getTop()->tb_top->MR->INTC->me = ch.data & 1;
-                        tb->getTop()->tb_top->MR->INTC->hie = !!(ch.data & 2);
-                } else if (!strcmp("CON_SR", (char *)&ch.name))	{
-                        /* Actually, wat.. this is calculated live
-                         * from FIFO status, which isn't supported
-                         * yet.  FIFOs are empty.
-                         */
-		} else if (!strcmp("CON_ISR", (char *)&ch.name)) {
-                        tb->getTop()->tb_top->MR->CONSOLE_UART->REGIF->irq_status = ch.data;
-		} else if (!strcmp("CON_IER", (char *)&ch.name)) {
-                        tb->getTop()->tb_top->MR->CONSOLE_UART->REGIF->irq_enable = ch.data;
-                } else if (!strcmp(STS_MEM, (char *)&ch.name)) {
+		if (ch->name == chunk_name(STS_MEM)) {
 			/* Memory block */
-			uint64_t base = ch.data;
-			uint64_t len = ch.len;
-#ifndef REAL_RAM
-			// MR3 platform has two banks, starting at 0 and starting 0x01000000:
-                        void *to;
-                        if (base < 0x01000000)
-                                to = &tb->getTop()->tb_top->MR->genblk1__DOT__RAMA_BRAM->RAM[base/8];
-                        else
-                                to = &tb->getTop()->tb_top->MR->genblk1__DOT__RAMB_BRAM->RAM[(base-0x01000000)/8];
-                        r = read(fd, to, len-8);
-#else
-#warning "Arch state restore only supported when using BRAM"
-                        r = -1;
-#endif
-			if (r < len-8) {
-				printf("Short read on memory chunk! (%d)\n", r);
+			r = restore_mem(tb, fd, ch->data, f + payload, payload, extra, &mapped);
+			if (r)
+				break;
+			restored += extra;
+		} else if (ch->name == chunk_name(STS_MEMZERO)) {
+			if (ch->len < 16) {
+				printf("Bad MEMZERO chunk at offset %lu\n", off);
+				r = -1;
 				break;
-			}
-			printf("Restored RAM chunk %08x-%08x\n", (uint32_t)base, (uint32_t)(base+len-8-1));
-		} else {
-			// Multi-named things
-			int found = 0;
-
-			// SRs
-			for (int i = 0; i < 16; i++) {
-				char name[8];
-				sprintf(name, STS_SR_FMT, i);
-				if (!strcmp(name, (char *)&ch.name)) {
-					tb->getTop()->tb_top->MR->CPU->CPU->MEM->segment[i] = ch.data;
-					found = 1;
-					break;
-				}
 			}
 
-			// GPRs
-			if (!found) {
-				for (int i = 0; i < 32; i++) {
-					char name[8];
-					sprintf(name, STS_GPR_FMT, i);
-					if (!strcmp(name, (char *)&ch.name)) {
-						tb->getTop()->tb_top->MR->CPU->CPU->DE->GPRF->registers[i] = ch.data;
-						found = 1;
-						break;
-					}
-				}
-			}
+			uint64_t avail, len = *(uint64_t *)(f + payload);
+			uint8_t *to = tb->ram_ptr(ch->data, &avail);
 
-			if (!found) {
-				printf("--- Unknown arch state chunk '%s', ignoring\n",
-				       (char *)&ch.name);
+			if (!to || avail < len) {
+				printf("Memory chunk at %08x isn't in RAM!\n", (uint32_t)ch->data);
+				r = -1;
+				break;
 			}
+			memset(to, 0, len);
+			zeroed += len;
+		} else if (ch->name == chunk_name(STS_PAD)) {
+			/* Nothing */
+		} else if (arch_reg_write(tb, ch->name, ch->data) != 0) {
+			char name[9] = {};
+
+			memcpy(name, &ch->name, 8);
+			printf("--- Unknown arch state chunk '%s', ignoring\n", name);
+		}
+		off = payload + extra;
+	}
+	munmap(f, st.st_size);		// Leaves RAM's mappings
+
+	printf("Restored %lu bytes of RAM (%lu mapped), zeroed %lu\n", restored, mapped, zeroed);
+	return r;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Save
+
+static int	save_chunk(int fd, uint64_t *off, const char *name, uint64_t data,
+			   const void *extra, uint64_t extra_len)
+{
+	ss_chunk_t ch;
+
+	ch.name = chunk_name(name);
+	ch.len = 8 + extra_len;
+	ch.data = data;
+	if (write(fd, &ch, sizeof(ch)) != sizeof(ch) ||
+	    (extra_len && write(fd, extra, extra_len) != (ssize_t)extra_len))
+		return -1;
+	*off += sizeof(ch) + extra_len;
+	return 0;
+}
+
+static bool	page_is_zero(const uint8_t *p)
+{
+	const uint64_t *w = (const uint64_t *)p;
+
+	for (unsigned int i = 0; i < STS_PAGE_SZ / 8; i++)
+		if (w[i])
+			return false;
+	return true;
+}
+
+/* A bank of RAM as one MEMBLK or, if sparse, as runs of MEMBLKs (padded for
+ * restore_mem() to map) and MEMZEROs
+ */
+static int	save_mem(int fd, uint64_t *off, uint64_t base, const uint8_t *mem, uint64_t size,
+			 bool sparse)
+{
+	static const uint8_t zeroes[STS_PAGE_SZ] = {};
+
+	if (!sparse)
+		return save_chunk(fd, off, STS_MEM, base, mem, size);
+
+	for (uint64_t p = 0; p < size; ) {
+		bool zero = page_is_zero(mem + p);
+		uint64_t end = p + STS_PAGE_SZ;
+
+		while (end < size && page_is_zero(mem + end) == zero)
+			end += STS_PAGE_SZ;
+
+		if (zero) {
+			uint64_t len = end - p;
+
+			if (save_chunk(fd, off, STS_MEMZERO, base + p, &len, sizeof(len)))
+				return -1;
+		} else {
+			/* Pad so that this MEMBLK's contents are at the same
+			 * offset in a page as the RAM is in this process, so a
+			 * restore (by the same build) can map them:
+			 */
+			uint64_t align = (uintptr_t)(mem + p) % STS_PAGE_SZ;
+			uint64_t pad = (align + STS_PAGE_SZ -
+					(*off + 2 * sizeof(ss_chunk_t)) % STS_PAGE_SZ) % STS_PAGE_SZ;
+
+			if ((*off + sizeof(ss_chunk_t)) % STS_PAGE_SZ != align &&
+			    save_chunk(fd, off, STS_PAD, 0, zeroes, pad))
+				return -1;
+			if (save_chunk(fd, off, STS_MEM, base + p, mem + p, end - p))
+				return -1;
+		}
+		p = end;
+	}
+	return 0;
+}
+
+/* Writes the architected state in the -A format: registers, RAM (the BRAM
+ * banks, with zero pages elided if sparse), then, in a CPU_INTERNALS build,
+ * any dirty D-cache lines over it.
+ * It should be taken at a commit of an instruction not accessing memory,
+ * with no MIC request outstanding, so that the state from before that
+ * instruction is consistent.
+ */
+int	tb_save_arch_state(int fd, Testbench *tb, bool sparse)
+{
+	static const uint64_t banks[] = { 0, 0x01000000 };
+	uint64_t off = 0;
+
+	arch_reg_names_init();
+	for (int n = 0; n < arch_reg_names_num; n++) {
+		const arch_reg_desc_t *d = arch_reg_names[n].desc;
+
+		if (d->get && save_chunk(fd, &off, (const char *)&arch_reg_names[n].name,
+					 d->get(tb, arch_reg_names[n].i), NULL, 0))
+			return -1;
+	}
+
+	for (unsigned int b = 0; b < sizeof(banks) / sizeof(banks[0]); b++) {
+		uint64_t avail;
+		uint8_t *p = tb->ram_ptr(banks[b], &avail);
+
+		if (!p) {
+			printf("Arch state save only supported when using BRAM\n");
+			return -1;
 		}
-	} while (r > 0);
+		if (save_mem(fd, &off, banks[b], p, avail, sparse))
+			return -1;
+	}
+
+#ifdef CPU_INTERNALS
+	auto *c = CPU(tb);
+
+	for (unsigned int i = 0; i < CPU_NR(CPU_DC_VALID(c)); i++) {
+		if (!CPU_DC_VALID(c)[i] || !CPU_DC_DIRTY(c)[i])
+			continue;
+
+		uint64_t data[CPU_CL_WORDS];
 
+		for (int w = 0; w < CPU_CL_WORDS; w++)
+			data[w] = CPU_DC_DATA(c)[i * CPU_CL_WORDS + w];
+		if (save_chunk(fd, &off, STS_MEM, CPU_DC_LINE_PA(c, i), data, sizeof(data)))
+			return -1;
+	}
+#endif
 	return 0;
 }
 
+
+void	tb_read_arch_regs(Testbench *tb, arch_regs_t *r)
+{
+	for (unsigned int d = 0; d < NUM_ARCH_REG_DESCS; d++) {
+		const arch_reg_desc_t *desc = &arch_reg_descs[d];
+
+		if (desc->regs_off < 0)
+			continue;
+		for (int i = 0; i < desc->count; i++) {
+			uint8_t *p = (uint8_t *)r + desc->regs_off + i * desc->regs_size;
+			uint64_t v = desc->get(tb, i);
+
+			if (desc->regs_size == 8)
+				*(uint64_t *)p = v;
+			else
+				*(uint32_t *)p = v;
+		}
+	}
+}
+
+/* The inverse of tb_read_arch_regs() */
+void	tb_write_arch_regs(Testbench *tb, const arch_regs_t *r)
+{
+	for (unsigned int d = 0; d < NUM_ARCH_REG_DESCS; d++) {
+		const arch_reg_desc_t *desc = &arch_reg_descs[d];
+
+		if (desc->regs_off < 0)
+			continue;
+		for (int i = 0; i < desc->count; i++) {
+			const uint8_t *p = (const uint8_t *)r + desc->regs_off + i * desc->regs_size;
+
+			desc->set(tb, i, desc->regs_size == 8 ? *(const uint64_t *)p :
+				  *(const uint32_t *)p);
+		}
+	}
+}
+
 #ifdef CHECKER
 
 /* The checker uses (parts of) MR-ISS to execute an interpreted instruction
- * when WB commits a real instruction, comparing register state after and looking
- * for differences.
+ * when WB commits a real instruction, comparing the results for differences.
+ *
+ * The sim thread only captures a compact record of each commit (PC,
+ * instruction, writeback ports, XERCR, load/store) into a ring; a checker
+ * thread runs the interpreter on another core.  The interpreter keeps its
+ * own architectural state, which is synced from the model (a full
+ * arch_regs_t, pushed alongside) only at the first commit, after a gap in
+ * checking, or after a fault (exception/interrupt entry, which the
+ * interpreter doesn't see).  When a result mismatches, it's reported and the
+ * model's value is adopted so one bug doesn't cascade.
+ *
+ * By default, GPR/XER/CR writebacks are compared.  Options add:
+ *
+ *	--check-full	MSR, and stores (address/size/data) per instruction,
+ *			and the whole state (SPRs, SRs, BATs, SDR1) after
+ *			every instruction that writes an SPR
+ *	--check-mem	A shadow memory of committed stores, against which
+ *			load data is checked (catches stale cache data;
+ *			memory written by DMA gives false positives)
+ *	--check-hash N	Instead of per-instruction comparisons, compare a
+ *			hash of the whole state and of the store stream every
+ *			N instructions.  On a mismatch, the interval is
+ *			replayed from the last good state with comparisons
+ *			on, to find the instruction that diverged.
  *
- * This relies on an MR-ISS build (make libiss.a DUMMY_MEM_ACCESS=1) in the same directory.
+ * Stores (and so --check-mem) need the load/store signals that are only in
+ * a CPU_INTERNALS build; otherwise, only register state is checked.
+ * Checking stores against the interpreter's, and comparing SDR1/BATs/SRs,
+ * also need MR-ISS API not there yet (an ISS_EXT_API build; see iss.cc).
+ *
+ * This relies on an MR-ISS build (make libiss.a DUMMY_MEM_ACCESS=1) in the same directory,
+ * used through iss.cc.
  */
 
-#include "MR-ISS/PPCCPUState.h"
-#define DUMMY_MEM_ACCESS 1
-#include "MR-ISS/PPCInterpreter.h"
-#include "MR-ISS/PPCMMU.h"
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <atomic>
+#include "ring.h"
+#include "iss.h"
+
+#define CHECKER_RING_LOG2	16
+#define CHECKER_REGS_RING_LOG2	6
+#define CHECKER_IDLE_SPINS	100	// Before sleeping until the sim wakes it
 
-uint32_t log_enables_mask = 0;
-PPCCPUState pcs; // FIXME construct from vars
-PPCInterpreter interp;
-PPCMMU mmu;
+#define CR_GPR0		0x01
+#define CR_GPR1		0x02
+#define CR_XERCR	0x04
+#define CR_SYNC		0x08	// Sync interpreter state from the next arch_regs_t
+#define CR_COMPARE	0x10	// Compare interpreter state with the next arch_regs_t
+#define CR_HASH		0x20	// Compare against state_hash
+#define CR_LOAD		0x40
+#define CR_STORE	0x80
 
+typedef struct {
+	uint64_t	cycle;
+	uint32_t	pc;
+	uint32_t	inst;
+	uint32_t	msr;
+	uint32_t	dec;
+	uint32_t	r0;		// For mftb, see below
+	uint32_t	gpr_val[2];
+	uint8_t		gpr_reg[2];
+	uint8_t		flags;
+	uint8_t		ls_size;
+	uint64_t	load_data;
+	uint64_t	xercr;
+	uint32_t	ls_ea;
+	uint32_t	ls_pa;
+	uint64_t	st_data;
+	uint64_t	state_hash;	// CR_HASH: of the state before this instruction
+} commit_rec_t;
 
-void checker_init(Testbench *tb, uint32_t log_flags)
+static bool check_full = false;
+static bool check_mem = false;
+static uint64_t check_hash_every = 0;
+
+static SpscRing<commit_rec_t, CHECKER_RING_LOG2> *checker_ring;
+static SpscRing<arch_regs_t, CHECKER_REGS_RING_LOG2> *checker_regs_ring;
+static pthread_t checker_thread;
+static std::atomic<bool> checker_stop(false);
+static std::atomic<bool> checker_want_sync(false);
+static std::atomic<bool> checker_sleeping(false);
+static int checker_wake_fd = -1;
+static bool checker_running = false;
+
+/* Sim thread: */
+static uint64_t checker_last_cycle = ~0ULL;
+static bool checker_need_sync = true;
+static bool checker_need_compare = false;
+static uint64_t checker_until_hash = 0;
+static uint64_t checker_stalls = 0;
+
+/* Checker thread: */
+static uint64_t checker_checked = 0;
+static uint64_t checker_syncs = 0;
+static uint64_t checker_mismatches = 0;
+static uint64_t checker_hashes = 0;
+static bool checker_diff_at_sync = false;
+static bool checker_sync_pending = false;
+static uint64_t iss_store_hash;
+static uint64_t rtl_store_hash;
+
+
+void	checker_set_full(void)
+{
+	check_full = true;
+}
+
+void	checker_set_mem(void)
+{
+	check_mem = true;
+}
+
+void	checker_set_hash(uint64_t every)
+{
+	check_hash_every = every;
+}
+
+void	checker_init(Testbench *tb, uint32_t log_flags)
 {
         printf("Initialising checker\n");
-        interp.setCPUState(&pcs);
-        interp.setMMU(&mmu);
+	iss_init(log_flags);
+
+	checker_ring = new SpscRing<commit_rec_t, CHECKER_RING_LOG2>();
+	checker_regs_ring = new SpscRing<arch_regs_t, CHECKER_REGS_RING_LOG2>();
+	if (check_hash_every)
+		printf("Checker: comparing state hashes every %lu instructions\n", check_hash_every);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Architected state
+
+/* The fields of arch_regs_t, for comparing/hashing.  DEC and TB aren't
+ * compared; they're given to the interpreter from the model.  Nor are
+ * SDR1, the BATs and SRs unless MR-ISS can read them back (ISS_EXT_API).
+ */
+typedef struct {
+	const char	*name;
+	size_t		offset;
+	int		count;
+	bool		compare;
+} checker_field_t;
+
+#ifdef ISS_EXT_API
+#define CF_MMU		true
+#else
+#define CF_MMU		false
+#endif
+
+#define CF(f, n, c)	{ #f, offsetof(arch_regs_t, f), n, c }
+
+static const checker_field_t checker_fields[] = {
+	CF(gpr, 32, true),	CF(pc, 1, true),	CF(msr, 1, true),
+	CF(cr, 1, true),	CF(xer, 1, true),	CF(lr, 1, true),
+	CF(ctr, 1, true),	CF(sprg, 4, true),	CF(srr0, 1, true),
+	CF(srr1, 1, true),	CF(dar, 1, true),	CF(dsisr, 1, true),
+	CF(sdr1, 1, CF_MMU),	CF(dec, 1, false),	CF(ibat, 8, CF_MMU),
+	CF(dbat, 8, CF_MMU),	CF(sr, 16, CF_MMU),
+};
+
+#define NUM_CHECKER_FIELDS	(sizeof(checker_fields) / sizeof(checker_fields[0]))
+
+static inline uint64_t	fnv1a(uint64_t h, uint32_t v)
+{
+	for (int i = 0; i < 4; i++) {
+		h ^= (v >> (i * 8)) & 0xff;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static uint64_t	arch_regs_hash(const arch_regs_t *r)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	for (unsigned int f = 0; f < NUM_CHECKER_FIELDS; f++) {
+		const uint32_t *v = (const uint32_t *)((const char *)r + checker_fields[f].offset);
+
+		if (!checker_fields[f].compare)
+			continue;
+		for (int i = 0; i < checker_fields[f].count; i++)
+			h = fnv1a(h, v[i]);
+	}
+	return h;
+}
+
+/* Prints differences between the model's and interpreter's state, returning
+ * the number of differing registers.
+ */
+static int	arch_regs_diff(const arch_regs_t *rtl, const arch_regs_t *iss, uint64_t cycle)
+{
+	int n = 0;
+
+	for (unsigned int f = 0; f < NUM_CHECKER_FIELDS; f++) {
+		const checker_field_t *cf = &checker_fields[f];
+		const uint32_t *hv = (const uint32_t *)((const char *)rtl + cf->offset);
+		const uint32_t *iv = (const uint32_t *)((const char *)iss + cf->offset);
+
+		if (!cf->compare)
+			continue;
+		for (int i = 0; i < cf->count; i++) {
+			if (hv[i] == iv[i])
+				continue;
+			if (cf->count > 1)
+				printf("*** %08x (cycle %10ld):  %s%d: model %08x vs interp %08x\n",
+				       rtl->pc, cycle, cf->name, i, hv[i], iv[i]);
+			else
+				printf("*** %08x (cycle %10ld):  %s: model %08x vs interp %08x\n",
+				       rtl->pc, cycle, cf->name, hv[i], iv[i]);
+			n++;
+		}
+	}
+	return n;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Shadow memory
+
+/* Bytes written by committed stores, by physical address, in lazily
+ * allocated pages with a valid bit per byte.
+ */
+#define SHADOW_PAGE_SHIFT	12
+#define SHADOW_PAGE_SIZE	(1 << SHADOW_PAGE_SHIFT)
+#define SHADOW_LINE_SIZE	32		// Zeroed by dcbz (MR's cache line)
+
+typedef struct {
+	uint8_t		data[SHADOW_PAGE_SIZE];
+	uint8_t		valid[SHADOW_PAGE_SIZE / 8];
+} shadow_page_t;
+
+static shadow_page_t *shadow_pages[1 << (32 - SHADOW_PAGE_SHIFT)];
+static uint64_t shadow_load_mismatches = 0;
+
+static void	shadow_store(uint32_t pa, int size, uint64_t data)
+{
+	for (int i = 0; i < size; i++) {
+		uint32_t a = pa + i;
+		shadow_page_t **pp = &shadow_pages[a >> SHADOW_PAGE_SHIFT];
+		uint32_t o = a & (SHADOW_PAGE_SIZE - 1);
+
+		if (!*pp)
+			*pp = (shadow_page_t *)calloc(1, sizeof(shadow_page_t));
+		(*pp)->data[o] = data >> ((size - 1 - i) * 8);
+		(*pp)->valid[o / 8] |= 1 << (o % 8);
+	}
+}
+
+/* Returns false if any byte hasn't been stored to */
+static bool	shadow_load(uint32_t pa, int size, uint64_t *data)
+{
+	uint64_t v = 0;
+
+	for (int i = 0; i < size; i++) {
+		uint32_t a = pa + i;
+		shadow_page_t *p = shadow_pages[a >> SHADOW_PAGE_SHIFT];
+		uint32_t o = a & (SHADOW_PAGE_SIZE - 1);
+
+		if (!p || !(p->valid[o / 8] & (1 << (o % 8))))
+			return false;
+		v = (v << 8) | p->data[o];
+	}
+	*data = v;
+	return true;
+}
+
+static bool	ls_dcbz(uint32_t inst)
+{
+	return (inst >> 26) == 31 && ((inst >> 1) & 0x3ff) == 1014;
+}
+
+/* Plain (not byte-reversed/string/multiple) integer loads and stores,
+ * whose load data is the memory value, right-aligned.
+ */
+static bool	ls_plain(uint32_t inst)
+{
+	unsigned int op = inst >> 26;
+	unsigned int xo = (inst >> 1) & 0x3ff;
+
+	if (op >= 32 && op <= 45)
+		return true;
+	if (op != 31)
+		return false;
+	switch (xo) {
+	case 23: case 55: case 87: case 119: case 279: case 311: case 343: case 375:
+	case 151: case 183: case 215: case 247: case 407: case 439:
+		return true;
+	default:
+		return false;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Checker thread
+
+/* Store data is right-aligned, and the rest of the word is don't-care */
+#define SIZE_MASK(size)			((size) >= 8 ? ~0ULL : (1ULL << ((size) * 8)) - 1)
+#define HASH_STORE(h, ea, size, data)	fnv1a(fnv1a(fnv1a(fnv1a((h), (ea)), (size)), \
+						    (uint32_t)((data) & SIZE_MASK(size))), \
+					      (uint32_t)(((data) & SIZE_MASK(size)) >> 32))
+
+/* Hash mode keeps the interval since the last matching hash, to replay */
+static commit_rec_t *replay_buf = NULL;
+static uint64_t replay_num = 0;
+static bool replay_overflow = false;
+static arch_regs_t replay_start;
+static uint64_t replay_iss_store_hash;
+static uint64_t replay_rtl_store_hash;
+static bool replaying = false;
+
+static void	checker_check(const commit_rec_t *r, bool compare)
+{
+	uint32_t pc = r->pc;
+	uint32_t inst = r->inst;
+	bool full = check_full || replaying;
+	int mismatch = 0;
+
+	/* Records queued before a requested resync are only executed */
+	if (r->flags & CR_SYNC)
+		checker_sync_pending = false;
+	else if (checker_sync_pending)
+		compare = false;
 
-        log_enables_mask = log_flags;
+	if (r->flags & (CR_SYNC | CR_COMPARE)) {
+		arch_regs_t regs, iregs;
+
+		/* Pushed before the record, so it's there: */
+		checker_regs_ring->pop(&regs);
+		iss_get_regs(&iregs);
+		if ((r->flags & CR_COMPARE) || checker_diff_at_sync)
+			mismatch += arch_regs_diff(&regs, &iregs, r->cycle) != 0;
+		if (r->flags & CR_SYNC) {
+			iss_set_regs(&regs);
+			iss_store_hash = rtl_store_hash = 0;
+			checker_diff_at_sync = false;
+			checker_syncs++;
+		}
+	} else if (compare && iss_get_pc() != pc) {
+		printf("*** %08x (cycle %10ld) %08x:  PC: WB %08x vs interp %08x\n",
+		       pc, r->cycle, inst, pc, iss_get_pc());
+		/* Most likely an interrupt the interpreter didn't see, which
+		 * changed SRR0/SRR1/MSR too, so resync all of the state:
+		 */
+		iss_set_pc(pc);
+		checker_want_sync = true;
+		checker_sync_pending = true;
+		mismatch = 1;
+	} else if (compare && full && iss_get_msr() != r->msr) {
+		printf("*** %08x (cycle %10ld) %08x:  MSR: model %08x vs interp %08x\n",
+		       pc, r->cycle, inst, r->msr, iss_get_msr());
+		mismatch = 1;
+	}
+
+	/* Per-commit state the interpreter can't track itself: */
+	if (!check_full && !check_hash_every)
+		iss_set_msr(r->msr);
+	/* TB is annoying because right now it's 1 or 2 cycles ahead of the value read.
+	 * So, just capture the result to work around so that mftb works OK:
+	 */
+	iss_set_timers(r->dec, r->r0 | ((uint64_t)r->r0 << 32));
+
+	/* Hack for loads: the read data from MR's cache is given to the
+	 * interpreter, and a store captured.
+	 */
+	iss_store_t st;
+
+	iss_exec(pc, inst, r->load_data, &st);
+
+#if defined(CPU_INTERNALS) && defined(ISS_EXT_API)
+	if (st.size)
+		iss_store_hash = HASH_STORE(iss_store_hash, st.addr, st.size, st.data);
+	if (r->flags & CR_STORE)
+		rtl_store_hash = HASH_STORE(rtl_store_hash, r->ls_ea, r->ls_size, r->st_data);
+#endif
+
+	/* Compare state: */
+	if (!compare)
+		goto done;
+
+	for (int p = 0; p < 2; p++) {
+		if (!(r->flags & (CR_GPR0 << p)))
+			continue;
+
+		unsigned int gpr = r->gpr_reg[p];
+		uint32_t iv = iss_get_gpr(gpr);
+		uint32_t hv = r->gpr_val[p];
+
+		if (iv != hv) {
+			printf("*** %08x (cycle %10ld) %08x:  GPR%02d: WB %08x vs interp %08x (p%d)\n",
+			       pc, r->cycle, inst, gpr, hv, iv, p);
+			iss_set_gpr(gpr, hv);
+			mismatch = 1;
+		}
+	}
+	if (r->flags & CR_XERCR) {
+		uint32_t hxer = ((r->xercr >> 3) & 0xe0000000) | ((r->xercr >> 35) & 0x7f);
+		uint32_t hcr = r->xercr & 0xffffffff;
+
+		if ((iss_get_cr() != hcr) || (iss_get_xer() != hxer)) {
+			printf("*** %08x (cycle %10ld) %08x:  WB XER %08x CR %08x vs interp XER %08x CR %08x\n",
+			       pc, r->cycle, inst, hxer, hcr, iss_get_xer(), iss_get_cr());
+			iss_set_xer(hxer);
+			iss_set_cr(hcr);
+			mismatch = 1;
+		}
+	}
+#if defined(CPU_INTERNALS) && defined(ISS_EXT_API)
+	if (full && ((r->flags & CR_STORE) || st.size)) {
+		uint64_t mask = SIZE_MASK(r->ls_size);
+
+		if (!(r->flags & CR_STORE) || !st.size ||
+		    r->ls_ea != st.addr || r->ls_size != st.size ||
+		    (r->st_data & mask) != (st.data & mask)) {
+			printf("*** %08x (cycle %10ld) %08x:  Store: model %d@%08x = %lx vs interp %d@%08x = %lx\n",
+			       pc, r->cycle, inst,
+			       (r->flags & CR_STORE) ? r->ls_size : 0, r->ls_ea, r->st_data,
+			       st.size, st.addr, st.data);
+			mismatch = 1;
+		}
+	}
+#endif
+
+done:
+	/* Loads against the shadow memory (unless in the IO region), which
+	 * stores and dcbz (zeroing its line) update:
+	 */
+	if (check_mem && !replaying && ls_dcbz(inst) && (r->flags & (CR_LOAD | CR_STORE)) &&
+	    (r->ls_pa >> 30) != 2) {
+		uint32_t line = r->ls_pa & ~(SHADOW_LINE_SIZE - 1);
+
+		for (int i = 0; i < SHADOW_LINE_SIZE; i += 8)
+			shadow_store(line + i, 8, 0);
+	} else if (check_mem && !replaying && ls_plain(inst) && (r->ls_pa >> 30) != 2) {
+		if (r->flags & CR_STORE) {
+			shadow_store(r->ls_pa, r->ls_size, r->st_data);
+		} else if (r->flags & CR_LOAD) {
+			uint64_t sv;
+			uint64_t mask = SIZE_MASK(r->ls_size);
+
+			if (shadow_load(r->ls_pa, r->ls_size, &sv) &&
+			    sv != (r->load_data & mask)) {
+				printf("*** %08x (cycle %10ld) %08x:  Load %d@%08x (PA %08x): "
+				       "model %lx vs last stored %lx\n",
+				       pc, r->cycle, inst, r->ls_size, r->ls_ea, r->ls_pa,
+				       r->load_data & mask, sv);
+				/* Report once (e.g. if it was DMA) */
+				shadow_store(r->ls_pa, r->ls_size, r->load_data);
+				shadow_load_mismatches++;
+				mismatch = 1;
+			}
+		}
+	}
+
+	checker_checked++;
+	checker_mismatches += mismatch;
+}
+
+static void	replay_begin(void)
+{
+	iss_get_regs(&replay_start);
+	replay_iss_store_hash = iss_store_hash;
+	replay_rtl_store_hash = rtl_store_hash;
+	replay_num = 0;
+	replay_overflow = false;
+}
+
+/* The state hash in r (the model's, before r executes) against the
+ * interpreter's, and the store streams since the last sync.
+ */
+static void	checker_hash(const commit_rec_t *r)
+{
+	arch_regs_t iregs;
+
+	iss_get_regs(&iregs);
+	checker_hashes++;
+
+	if (arch_regs_hash(&iregs) == r->state_hash && iss_store_hash == rtl_store_hash) {
+		replay_begin();
+		return;
+	}
+
+	printf("*** %08x (cycle %10ld):  State hash mismatch, replaying %lu instructions\n",
+	       r->pc, r->cycle, replay_num);
+	if (replay_overflow)
+		printf("*** (Interval was longer than the replay buffer; it's incomplete)\n");
+
+	uint64_t before = checker_mismatches;
+
+	iss_set_regs(&replay_start);
+	iss_store_hash = replay_iss_store_hash;
+	rtl_store_hash = replay_rtl_store_hash;
+	replaying = true;
+	for (uint64_t i = 0; i < replay_num && checker_mismatches == before; i++) {
+		checker_check(&replay_buf[i], true);
+		checker_checked--;
+	}
+	replaying = false;
+	if (checker_mismatches == before) {
+		printf("*** No writeback/store differs; diffing state at next sync\n");
+		checker_mismatches++;
+	}
+	/* Resync from the model (which diffs the state first) */
+	checker_diff_at_sync = true;
+	checker_want_sync = true;
+	replay_begin();
 }
 
-void checker(Testbench *tb)
+static void	*checker_thread_main(void *arg)
 {
+	commit_rec_t r;
+	unsigned int idle = 0;
+
+	for (;;) {
+		if (checker_ring->pop(&r)) {
+			idle = 0;
+			if (!check_hash_every) {
+				checker_check(&r, true);
+				continue;
+			}
+			if (r.flags & CR_HASH)
+				checker_hash(&r);
+			checker_check(&r, false);
+			if (r.flags & CR_SYNC)
+				replay_begin();		// The interval starts after it
+			else if (replay_num < check_hash_every * 2)
+				replay_buf[replay_num++] = r;
+			else
+				replay_overflow = true;
+		} else if (checker_stop.load()) {
+			if (checker_ring->empty())
+				break;
+		} else if (++idle < CHECKER_IDLE_SPINS) {
+			sched_yield();
+		} else {
+			/* The sim's stopped checking (or stopped), so sleep.
+			 * It checks checker_sleeping after each push, and this
+			 * checks the ring after setting it, so a push isn't
+			 * missed.
+			 */
+			uint64_t v;
+
+			checker_sleeping = true;
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (checker_ring->empty() && !checker_stop.load())
+				read(checker_wake_fd, &v, sizeof(v));
+			checker_sleeping = false;
+			idle = 0;
+		}
+	}
+	return NULL;
+}
+
+static void	checker_wake(void)
+{
+	uint64_t v = 1;
+
+	write(checker_wake_fd, &v, sizeof(v));
+}
+
+static void	checker_start(void)
+{
+	/* Started on the first check, not at init, so that a fork server's
+	 * children (which don't inherit threads) each get one.
+	 */
+	if (check_hash_every)
+		replay_buf = new commit_rec_t[check_hash_every * 2];
+	if ((checker_wake_fd = eventfd(0, 0)) == -1) {
+		perror("Can't create eventfd\n");
+		exit(1);
+	}
+
+	sigset_t ss, oss;
+	sigfillset(&ss);
+	pthread_sigmask(SIG_BLOCK, &ss, &oss);
+	if (pthread_create(&checker_thread, NULL, checker_thread_main, NULL)) {
+		perror("Can't create checker thread\n");
+		exit(1);
+	}
+	pthread_sigmask(SIG_SETMASK, &oss, NULL);
+	checker_running = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Sim thread
+
+static void	checker_push_regs(Testbench *tb)
+{
+	arch_regs_t regs;
+
+	tb_read_arch_regs(tb, &regs);
+	while (!checker_regs_ring->push(regs))
+		sched_yield();
+}
+
+void	checker(Testbench *tb)
+{
+	auto *c = CPU(tb);
+	uint64_t now = tb->get_tickcount();
+
         /* If this cycle commits a valid instruction (and not a
-         * fault), then execute the instruction in the interpreter and
-         * compare any integer/flags results.
+         * fault), then record it for the checker thread to execute the
+         * instruction in the interpreter and compare any integer/flags
+         * results.
          *
          * Loads are supported in so far as the value from MR's cache
          * is forwarded to the instruction; realistically, this just
-         * validates the update forms.  Stores are a NOP.
+         * validates the update forms (--check-mem checks the data).
          *
          * Faults from memory ops or IF are hard to check, so are
-         * ignored.  Illegal/syscall could be, but "looks like it
+         * ignored, other than resyncing the interpreter from the model
+         * after them.  Illegal/syscall could be, but "looks like it
          * works" so not spending that effort yet.
          *
          * In future will have to disable forwarding for this to work!
          * Reg file assumed up to date!
          */
-        if (tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_valid_i &&
-            tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_fault_r == 0) {
-                uint32_t inst = tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_instr_r;
-                uint32_t pc = tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_pc_r;
-
-                /* Dig out the arch state: */
-                for (int i = 0; i < 32; i++) {
-                        pcs.setGPR(i, tb->getTop()->tb_top->MR->CPU->CPU->DE->GPRF->registers[i]);
-                }
-                pcs.setPC(pc);
-                pcs.setMSR(tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_msr_r);
-                pcs.setCTR(tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_CTR);
-                pcs.setLR(tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_LR);
-                pcs.setXER(((tb->getTop()->tb_top->MR->CPU->CPU->DE->as_XERCR >> 3) & 0xe0000000) |
-                           ((tb->getTop()->tb_top->MR->CPU->CPU->DE->as_XERCR >> 35) & 0x7f));
-                pcs.setCR(tb->getTop()->tb_top->MR->CPU->CPU->DE->as_XERCR & 0xffffffff);
-                /* TB is annoying because right now it's 1 or 2 cycles ahead of the value read.
-                 * So, just capture the result to work around so that mftb works OK:
-                 */
-                pcs.setTB(tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_R0_r |
-                          ((uint64_t)tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_R0_r << 32));
-                pcs.setDEC(tb->getTop()->tb_top->MR->CPU->CPU->DE->TBDEC->as_DEC);
-                pcs.setSPRG0(tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_SPRG0);
-                pcs.setSPRG1(tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_SPRG1);
-                pcs.setSPRG2(tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_SPRG2);
-                pcs.setSPRG3(tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_SPRG3);
-                pcs.setSRR0(tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_SRR0);
-                pcs.setSRR1(tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_SRR1);
-                pcs.setDAR(tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_DAR);
-                pcs.setDSISR(tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_DSISR);
-
-                // FIXME: BATs and SRs, SDR1
-
-                /* Hack for loads: furtle out the read data and return that via PPCMMU: */
-                interp.read_data = tb->getTop()->tb_top->MR->CPU->CPU->MEM->DTC->DCACHE->DFMTR->data;
-
-                interp.setPCInst(pc, inst); // For interpreter's disassembler
-                interp.decode(inst);
-
-                /* Compare state: */
-                uint32_t iv, hv;
-                int mismatch = 0;
-                if (tb->getTop()->tb_top->MR->CPU->CPU->WB->writeback_gpr_port0_en_int) {
-                        unsigned int gpr = tb->getTop()->tb_top->MR->CPU->CPU->WB->writeback_gpr_port0_reg_int;
-                        iv = pcs.getGPR(gpr);
-                        hv = tb->getTop()->tb_top->MR->CPU->CPU->WB->writeback_gpr_port0_value_int;
-
-                        if (iv != hv) {
-                                printf("*** %08x (cycle %10ld) %08x:  GPR%02d: WB %08x vs interp %08x (p0)\n",
-                                       pc, tb->get_tickcount(), inst, gpr, hv, iv);
-                                mismatch = 1;
-                        }
-                }
-                if (tb->getTop()->tb_top->MR->CPU->CPU->WB->writeback_gpr_port1_en_int) {
-                        unsigned int gpr = tb->getTop()->tb_top->MR->CPU->CPU->WB->writeback_gpr_port1_reg_int;
-                        iv = pcs.getGPR(gpr);
-                        hv = tb->getTop()->tb_top->MR->CPU->CPU->WB->writeback_gpr_port1_value_int;
-
-                        if (iv != hv) {
-                                printf("*** %08x (cycle %10ld) %08x:  GPR%02d: WB %08x vs interp %08x (p1)\n",
-                                       pc, tb->get_tickcount(), inst, gpr, hv, iv);
-                                mismatch = 1;
-                        }
-                }
-                if (tb->getTop()->tb_top->MR->CPU->CPU->WB->writeback_xercr_en_int) {
-                        uint64_t v = tb->getTop()->tb_top->MR->CPU->CPU->WB->writeback_xercr_value_int;
-                        uint32_t hxer = ((v >> 3) & 0xe0000000) | ((v >> 35) & 0x7f);
-                        uint32_t hcr = v & 0xffffffff;
-
-                        if ((pcs.getCR() != hcr) || (pcs.getXER() != hxer)) {
-                                printf("*** %08x (cycle %10ld) %08x:  WB XER %08x CR %08x vs interp XER %08x CR %08x\n",
-                                       pc, tb->get_tickcount(), inst, hxer, hcr, pcs.getXER(), pcs.getCR());
-                                mismatch = 1;
-                        }
-                }
-                // FIXME, SPR alteration:
-                // tb_top->MR->CPU->CPU->WB->writeback_spr_en_int
-                // tb_top->MR->CPU->CPU->WB->writeback_sspr_en_int
-
-                if (mismatch) {
-                }
-        }
-}
-
-/* Misc support for MR-ISS junk */
-
-int     lprintf(const char *format, ...)
-{
-        va_list va;
-        va_start(va, format);
-        vfprintf(stderr, format, va);
-        va_end(va);
-        return 0;
-}
-
-void    sim_quit(void)
-{
-        printf("Quitty quit quit\n");
+	if (now != checker_last_cycle + 1)
+		checker_need_sync = true;		// Start, or a gap in checking
+	checker_last_cycle = now;
+
+	if (!c->MEM->memory_valid_i)
+		return;
+	if (c->MEM->memory_fault_r != 0) {
+		checker_need_sync = true;
+		return;
+	}
+
+	if (!checker_running)
+		checker_start();
+
+	commit_rec_t r;
+
+	r.cycle = now;
+	r.pc = c->MEM->memory_pc_r;
+	r.inst = c->MEM->memory_instr_r;
+	r.msr = c->MEM->memory_msr_r;
+	r.dec = c->DE->TBDEC->as_DEC;
+	r.r0 = c->MEM->memory_R0_r;
+	r.load_data = CPU_LD_DATA(c);
+	r.flags = 0;
+	if (c->WB->writeback_gpr_port0_en_int) {
+		r.flags |= CR_GPR0;
+		r.gpr_reg[0] = c->WB->writeback_gpr_port0_reg_int;
+		r.gpr_val[0] = c->WB->writeback_gpr_port0_value_int;
+	}
+	if (c->WB->writeback_gpr_port1_en_int) {
+		r.flags |= CR_GPR1;
+		r.gpr_reg[1] = c->WB->writeback_gpr_port1_reg_int;
+		r.gpr_val[1] = c->WB->writeback_gpr_port1_value_int;
+	}
+	if (c->WB->writeback_xercr_en_int) {
+		r.flags |= CR_XERCR;
+		r.xercr = c->WB->writeback_xercr_value_int;
+	}
+#ifdef CPU_INTERNALS
+	if (CPU_LS_VALID(c)) {
+		r.flags |= CPU_LS_STORE(c) ? CR_STORE : CR_LOAD;
+		r.ls_ea = CPU_LS_EA(c);
+		r.ls_pa = CPU_LS_PA(c);
+		r.ls_size = CPU_LS_SIZE(c);
+		r.st_data = CPU_ST_DATA(c);
+	}
+#endif
+
+	if (checker_want_sync.exchange(false))
+		checker_need_sync = true;
+
+	if (checker_need_sync) {
+		checker_push_regs(tb);
+		r.flags |= CR_SYNC;
+		checker_need_sync = false;
+		checker_until_hash = check_hash_every;
+	} else if (checker_need_compare) {
+		checker_push_regs(tb);
+		r.flags |= CR_COMPARE;
+	} else if (check_hash_every && --checker_until_hash == 0) {
+		arch_regs_t regs;
+
+		tb_read_arch_regs(tb, &regs);
+		r.state_hash = arch_regs_hash(&regs);
+		r.flags |= CR_HASH;
+		checker_until_hash = check_hash_every;
+	}
+	/* An SPR write is visible in the state read at the next commit: */
+	checker_need_compare = check_full && !check_hash_every && CPU_SPR_WRITE(c);
+
+	while (!checker_ring->push(r)) {
+		checker_stalls++;
+		sched_yield();
+	}
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (checker_sleeping.load(std::memory_order_relaxed))
+		checker_wake();
 }
 
+/* Waits for the checker to catch up with everything recorded */
+void	checker_finish(void)
+{
+	if (!checker_running)
+		return;
+
+	checker_stop = true;
+	checker_wake();
+	pthread_join(checker_thread, NULL);
+	close(checker_wake_fd);
+	checker_running = false;
+	printf("Checker: %lu instructions checked, %lu mismatches, %lu resyncs (%lu stalls)\n",
+	       checker_checked, checker_mismatches, checker_syncs, checker_stalls);
+	if (check_hash_every)
+		printf("Checker: %lu state hashes compared\n", checker_hashes);
+	if (check_mem)
+		printf("Checker: %lu loads differed from shadow memory\n", shadow_load_mismatches);
+}
 
 #endif // CHECKER
@@ -18,7 +18,45 @@
 #define ARCH_STATE_H
 
 
+/* Architected register state, as read out of the model */
+typedef struct {
+	uint32_t	gpr[32];
+	uint32_t	pc;
+	uint32_t	msr;
+	uint32_t	cr;
+	uint32_t	xer;
+	uint32_t	lr;
+	uint32_t	ctr;
+	uint32_t	sprg[4];
+	uint32_t	srr0;
+	uint32_t	srr1;
+	uint32_t	dar;
+	uint32_t	dsisr;
+	uint32_t	sdr1;
+	uint32_t	dec;
+	uint64_t	tb;
+	uint32_t	ibat[8];		// 0U, 0L, 1U, ...
+	uint32_t	dbat[8];
+	uint32_t	sr[16];
+	/* Not in MR-ISS's CPU state, but restored with it (by -A) */
+	uint32_t	ic_isr, ic_ier, ic_mer;
+	uint32_t	con_isr, con_ier;
+} arch_regs_t;
+
 int 	tb_restore_arch_state(int fd, Testbench *tb);
+int	tb_save_arch_state(int fd, Testbench *tb, bool sparse);
+int	tb_write_arch_reg(Testbench *tb, const char *name, uint64_t data);
+void	tb_read_arch_regs(Testbench *tb, arch_regs_t *r);
+void	tb_write_arch_regs(Testbench *tb, const arch_regs_t *r);
+
+#ifdef CHECKER
+void	checker_init(Testbench *tb, uint32_t log_flags);
+void	checker(Testbench *tb);
+void	checker_finish(void);
+void	checker_set_full(void);
+void	checker_set_mem(void);
+void	checker_set_hash(uint64_t every);
+#endif
 
 
 #endif
@@ -0,0 +1,266 @@
+/* MR-sys verilated sim cache statistics
+ *
+ * Copyright 2020-2022 Matt Evans
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <deque>
+
+#include "testbench.h"
+#include "monitor.h"
+#include "cpu_signals.h"
+#include "imix.h"
+#include "cachestats.h"
+
+/* The caches and TLBs are inside the CPU, but everything they miss on goes
+ * out over the CPU's MIC port, so their misses are counted from that port's
+ * handshakes.  A request packet of one beat is a read (an I-/D-cache fill, a
+ * hash table walk, or an uncached load); a longer one carries data, so is a
+ * write (a D-cache writeback or an uncached store).  For each:
+ *
+ *	packets		Requests made
+ *	busy		Cycles with at least one outstanding
+ *	latency		First request beat to last response beat, summed
+ *
+ * They're given per 1000 committed instructions and per 1000 memory
+ * instructions (loads, stores, cache/TLB ops).  Totals are printed at exit.
+ * With an interval, each interval's counts are also written as a time
+ * series: CSV, or JSON if the filename ends ".json".
+ */
+
+#define CS_MAX_OUTSTANDING	64
+
+enum { CS_READ = 0, CS_WRITE, CS_NUM };
+
+static const char *cs_names[CS_NUM] = { "reads", "writes" };
+
+typedef struct {
+	uint64_t	pkts;
+	uint64_t	busy;
+	uint64_t	latency;
+} cs_kind_t;
+
+typedef struct {
+	uint64_t	instrs;
+	uint64_t	memops;
+	cs_kind_t	k[CS_NUM];
+} cs_counts_t;
+
+typedef struct {
+	uint64_t	start;
+	int		kind;
+} cs_req_t;
+
+static bool cs_enabled = false;
+static uint64_t cs_interval = 0;
+static uint64_t cs_next = ~0ULL;
+static uint64_t cs_last = 0;
+static const char *cs_out_name = "cachestats.csv";
+static FILE *cs_out = NULL;
+static bool cs_json = false;
+static bool cs_first_row = true;
+
+static cs_counts_t cs_total;
+static cs_counts_t cs_at_last;
+static uint64_t cs_start = 0;
+static Testbench *cs_tb;
+
+/* The request being sent, and those awaiting responses (in order) */
+static bool cs_in_req = false;
+static uint64_t cs_req_start;
+static unsigned int cs_req_beats;
+static std::deque<cs_req_t> cs_outstanding;
+static unsigned int cs_num_outstanding[CS_NUM];
+
+void	cachestats_enable(void)
+{
+	cs_enabled = true;
+}
+
+void	cachestats_set_interval(uint64_t cycles)
+{
+	cs_enabled = true;
+	cs_interval = cycles;
+}
+
+void	cachestats_set_output(const char *filename)
+{
+	cs_out_name = strdup(filename);
+}
+
+static void	cs_write_row(uint64_t now)
+{
+	if (!cs_out)
+		return;
+
+	const cs_counts_t *n = &cs_total;
+	const cs_counts_t *l = &cs_at_last;
+
+	if (cs_json) {
+		fprintf(cs_out, "%s    { \"cycle\": %lu, \"instrs\": %lu, \"memops\": %lu",
+			cs_first_row ? "" : ",\n", now, n->instrs - l->instrs,
+			n->memops - l->memops);
+		for (int u = 0; u < CS_NUM; u++)
+			fprintf(cs_out, ", \"%s\": { \"packets\": %lu, \"busy\": %lu, "
+				"\"latency\": %lu }", cs_names[u],
+				n->k[u].pkts - l->k[u].pkts, n->k[u].busy - l->k[u].busy,
+				n->k[u].latency - l->k[u].latency);
+		fprintf(cs_out, " }");
+	} else {
+		fprintf(cs_out, "%lu,%lu,%lu", now, n->instrs - l->instrs, n->memops - l->memops);
+		for (int u = 0; u < CS_NUM; u++)
+			fprintf(cs_out, ",%lu,%lu,%lu", n->k[u].pkts - l->k[u].pkts,
+				n->k[u].busy - l->k[u].busy, n->k[u].latency - l->k[u].latency);
+		fprintf(cs_out, "\n");
+	}
+	cs_first_row = false;
+	cs_at_last = cs_total;
+	cs_last = now;
+}
+
+static void	cachestats_monitor(Testbench *tb, void *arg)
+{
+	auto *c = CPU(tb);
+	uint64_t now = tb->get_tickcount();
+
+	if (CPU_COMMIT(c)) {
+		cs_total.instrs++;
+		cs_total.memops += imix_is_memop(CPU_MEM_INSTR(c));
+	}
+
+	if (CPU_MIC_REQ_BEAT(tb)) {
+		if (!cs_in_req) {
+			cs_req_start = now;
+			cs_req_beats = 0;
+		}
+		cs_req_beats++;
+		cs_in_req = !CPU_MIC_REQ_LAST(tb);
+		if (!cs_in_req) {
+			int kind = cs_req_beats > 1 ? CS_WRITE : CS_READ;
+
+			if (cs_outstanding.size() >= CS_MAX_OUTSTANDING) {
+				/* Responses lost?  Don't grow without bound */
+				cs_num_outstanding[cs_outstanding.front().kind]--;
+				cs_outstanding.pop_front();
+			}
+			cs_outstanding.push_back({ cs_req_start, kind });
+			cs_num_outstanding[kind]++;
+			cs_total.k[kind].pkts++;
+		}
+	}
+
+	for (int u = 0; u < CS_NUM; u++)
+		cs_total.k[u].busy += cs_num_outstanding[u] != 0;
+
+	if (CPU_MIC_RESP_BEAT(tb) && CPU_MIC_RESP_LAST(tb) && !cs_outstanding.empty()) {
+		const cs_req_t &r = cs_outstanding.front();
+
+		cs_total.k[r.kind].latency += now - r.start;
+		cs_num_outstanding[r.kind]--;
+		cs_outstanding.pop_front();
+	}
+
+	if (now >= cs_next) {
+		cs_write_row(now);
+		cs_next += cs_interval;
+	}
+}
+
+/* Rows are every cs_interval simulated cycles, not counting a jump */
+static void	cachestats_jumped(Testbench *tb, uint64_t from, uint64_t to)
+{
+	if (cs_next > from)
+		cs_next += to - from;
+}
+
+int	cachestats_init(Testbench *tb)
+{
+	if (!cs_enabled)
+		return 0;
+
+	cs_tb = tb;
+	cs_start = cs_last = tb->get_tickcount();
+
+	if (cs_interval) {
+		size_t l = strlen(cs_out_name);
+
+		cs_json = l > 5 && !strcmp(cs_out_name + l - 5, ".json");
+		cs_out = fopen(cs_out_name, "w");
+		if (!cs_out) {
+			fprintf(stderr, "Cache stats: can't open '%s'\n", cs_out_name);
+			return 1;
+		}
+		if (cs_json) {
+			fprintf(cs_out, "{\n  \"interval\": %lu,\n  \"series\": [\n", cs_interval);
+		} else {
+			fprintf(cs_out, "cycle,instrs,memops");
+			for (int u = 0; u < CS_NUM; u++)
+				fprintf(cs_out, ",%s,%s_busy,%s_latency",
+					cs_names[u], cs_names[u], cs_names[u]);
+			fprintf(cs_out, "\n");
+		}
+		cs_next = cs_start + cs_interval;
+		printf("Cache stats: writing every %lu cycles to '%s'\n", cs_interval, cs_out_name);
+		if (monitor_add_jump(cachestats_jumped) != 0)
+			return 1;
+	}
+	return monitor_add(cachestats_monitor, NULL);
+}
+
+void	cachestats_report(void)
+{
+	if (!cs_enabled)
+		return;
+
+	const cs_counts_t *n = &cs_total;
+
+	printf("Cache stats: %lu cycles, %lu instructions, %lu memory instructions\n"
+	       "  %-7s %12s %10s %10s %12s %9s\n", cs_tb->get_tickcount() - cs_start,
+	       n->instrs, n->memops, "", "packets", "per 1K ins", "per 1K mem",
+	       "busy cycles", "avg lat");
+	for (int u = 0; u < CS_NUM; u++) {
+		const cs_kind_t *k = &n->k[u];
+
+		printf("  %-7s %12lu %10.2f %10.2f %12lu %9.1f\n", cs_names[u], k->pkts,
+		       n->instrs ? k->pkts * 1000.0 / n->instrs : 0.0,
+		       n->memops ? k->pkts * 1000.0 / n->memops : 0.0,
+		       k->busy, k->pkts ? (double)k->latency / k->pkts : 0.0);
+	}
+}
+
+void	cachestats_finish(void)
+{
+	if (!cs_out)
+		return;
+
+	if (cs_tb->get_tickcount() != cs_last)
+		cs_write_row(cs_tb->get_tickcount());
+	if (cs_json) {
+		const cs_counts_t *n = &cs_total;
+
+		fprintf(cs_out, "\n  ],\n  \"totals\": {\n    \"instrs\": %lu,\n    \"memops\": %lu",
+			n->instrs, n->memops);
+		for (int u = 0; u < CS_NUM; u++)
+			fprintf(cs_out, ",\n    \"%s\": { \"packets\": %lu, \"busy\": %lu, "
+				"\"latency\": %lu }", cs_names[u], n->k[u].pkts, n->k[u].busy,
+				n->k[u].latency);
+		fprintf(cs_out, "\n  }\n}\n");
+	}
+	fclose(cs_out);
+	cs_out = NULL;
+}
@@ -0,0 +1,508 @@
+/* MR-sys verilated sim incremental checkpoints
+ *
+ * Copyright 2020-2022 Matt Evans
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#ifdef CKPT_ZSTD
+#include <zstd.h>
+#endif
+
+#include "testbench.h"
+#include "checkpoint.h"
+
+/* A VerilatedSave image is mostly the two 16MB RAM banks, and successive
+ * saves of a running system differ in only a small fraction of it.
+ *
+ * Rather than saving the image as a flat file, it's serialised to memory and
+ * cut into pages.  Each page is identified by a hash of its contents, and a
+ * checkpoint file holds the list of page hashes plus the (compressed)
+ * contents of only those pages not already held by its parent checkpoint
+ * (and so on, up the chain).  The RAM arrays sit at the same offsets in the
+ * image every time, so unchanged RAM pages hash the same from one
+ * generation to the next; identical pages (e.g. zeroes) are stored once.
+ *
+ * The parent is named in the file (by absolute path, so a chain can be
+ * restored from another directory), so a restore needs the chain of files
+ * back to the first (full) one.  A save never overwrites a file in its own
+ * chain, and is written to a temporary file then renamed into place.
+ */
+
+#define CKPT_MAGIC		"MRCKPT01"
+#define CKPT_PAGE_SIZE		4096
+#define CKPT_COMP_NONE		0
+#define CKPT_COMP_ZSTD		1
+#define CKPT_ZSTD_LEVEL		1
+
+typedef struct {
+	char		magic[8];
+	uint64_t	stream_len;
+	uint32_t	page_size;
+	uint32_t	npages;
+	uint32_t	compression;
+	uint32_t	nstored;
+	char		parent[PATH_MAX];
+	// Followed by:
+	//	uint64_t		page_hash[npages];
+	//	ckpt_stored_t		stored[nstored];
+	//	Page data
+} ckpt_hdr_t;
+
+typedef struct {
+	uint64_t	hash;
+	uint64_t	offset;		// In file
+	uint32_t	len;		// == page_size for uncompressed data
+	uint32_t	pad;
+} ckpt_stored_t;
+
+/* Where to find the pages held by the chain ending with the most recently
+ * saved/restored checkpoint, which is the parent of the next save:
+ */
+typedef struct {
+	int		file;		// Index in ckpt_chain_files
+	uint64_t	offset;
+	uint32_t	len;
+} ckpt_loc_t;
+
+static std::vector<std::string> ckpt_chain_files;
+static std::unordered_map<uint64_t, ckpt_loc_t> ckpt_pages;
+static std::string ckpt_parent;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Serialising the model to/from memory
+
+class MemSave : public VerilatedSerialize {
+	std::vector<uint8_t>	*m_out;
+public:
+	MemSave(std::vector<uint8_t> *out) : m_out(out) {
+		m_isOpen = true;
+		m_filename = "(memory)";
+		header();
+	}
+	virtual ~MemSave() { close(); }
+	virtual void	close() {
+		if (!m_isOpen)
+			return;
+		trailer();
+		flush();
+		m_isOpen = false;
+	}
+	virtual void	flush() {
+		m_out->insert(m_out->end(), m_bufp, m_cp);
+		m_cp = m_bufp;
+	}
+};
+
+class MemRestore : public VerilatedDeserialize {
+	const uint8_t	*m_src;
+	const uint8_t	*m_src_end;
+public:
+	MemRestore(const uint8_t *data, size_t len) :
+		m_src(data), m_src_end(data + len) {
+		m_isOpen = true;
+		m_filename = "(memory)";
+		m_cp = m_bufp;
+		m_endp = m_bufp;
+		header();
+	}
+	virtual ~MemRestore() { close(); }
+	virtual void	close() {
+		if (!m_isOpen)
+			return;
+		trailer();
+		m_isOpen = false;
+	}
+	virtual void	fill() {
+		/* Move what's left to the start, then top up the buffer */
+		size_t left = m_endp - m_cp;
+		memmove(m_bufp, m_cp, left);
+		m_cp = m_bufp;
+		m_endp = m_bufp + left;
+
+		size_t n = bufferSize() - left;
+		if (n > (size_t)(m_src_end - m_src))
+			n = m_src_end - m_src;
+		memcpy(m_endp, m_src, n);
+		m_endp += n;
+		m_src += n;
+	}
+};
+
+/* The model's serialisation only exists in --savable builds (SAVABLE=1) */
+int	ckpt_model_to_mem(Testbench *tb, std::vector<uint8_t> *out)
+{
+#ifdef SAVABLE
+	MemSave ms(out);
+
+	ms << *tb->getTop();
+	ms.close();
+	return 0;
+#else
+	fprintf(stderr, "Model built without save/restore support (SAVABLE=0)\n");
+	return -1;
+#endif
+}
+
+int	ckpt_model_from_mem(Testbench *tb, const uint8_t *data, size_t len)
+{
+#ifdef SAVABLE
+	MemRestore mr(data, len);
+
+	mr >> *tb->getTop();
+	mr.close();
+	return 0;
+#else
+	fprintf(stderr, "Model built without save/restore support (SAVABLE=0)\n");
+	return -1;
+#endif
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pages
+
+static uint64_t	page_hash(const uint8_t *p)
+{
+	const uint64_t *w = (const uint64_t *)p;
+	uint64_t h = 0x9e3779b97f4a7c15ULL;
+
+	for (unsigned int i = 0; i < CKPT_PAGE_SIZE/8; i++) {
+		h ^= w[i] * 0xff51afd7ed558ccdULL;
+		h = ((h << 31) | (h >> 33)) * 0xc4ceb9fe1a85ec53ULL;
+	}
+	return h ^ (h >> 29);
+}
+
+static int	read_at(int fd, void *buf, size_t len, off_t offset)
+{
+	uint8_t *p = (uint8_t *)buf;
+	while (len > 0) {
+		ssize_t r = pread(fd, p, len, offset);
+		if (r <= 0) {
+			if (r < 0 && errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += r;
+		offset += r;
+		len -= r;
+	}
+	return 0;
+}
+
+extern int write_all(int fd, const void *buf, size_t len);
+
+static int	read_hdr(int fd, ckpt_hdr_t *h)
+{
+	if (read_at(fd, h, sizeof(*h), 0) ||
+	    memcmp(h->magic, CKPT_MAGIC, 8) ||
+	    h->page_size != CKPT_PAGE_SIZE) {
+		return -1;
+	}
+	h->parent[PATH_MAX-1] = '\0';
+	return 0;
+}
+
+int	ckpt_is_incremental(const char *filename)
+{
+	ckpt_hdr_t h;
+	int fd = open(filename, O_RDONLY);
+
+	if (fd < 0)
+		return 0;
+	int r = read_hdr(fd, &h) == 0;
+	close(fd);
+	return r;
+}
+
+/* Canonical name for a checkpoint file: a relative name is relative to the
+ * directory of the file naming it (rel_to), or the cwd.  Falls back to the
+ * plain name if the file doesn't exist (yet).
+ */
+static std::string	ckpt_path(const std::string &f, const std::string &rel_to)
+{
+	std::string p = f;
+	char rp[PATH_MAX];
+
+	if (p.length() && p[0] != '/' && rel_to.length()) {
+		size_t slash = rel_to.rfind('/');
+		if (slash != std::string::npos)
+			p = rel_to.substr(0, slash + 1) + p;
+	}
+	if (realpath(p.c_str(), rp))
+		return rp;
+	return p;
+}
+
+/* Is filename part of the chain the next save would be based on? */
+int	ckpt_in_chain(const char *filename)
+{
+	std::string f = ckpt_path(filename, "");
+
+	for (unsigned int i = 0; i < ckpt_chain_files.size(); i++) {
+		if (ckpt_chain_files[i] == f)
+			return 1;
+	}
+	return 0;
+}
+
+/* Make filename (and its ancestors) the base for the next save.
+ * Returns 0 for success.
+ */
+int	ckpt_adopt(const char *filename)
+{
+	std::string f = ckpt_path(filename, "");
+
+	ckpt_chain_files.clear();
+	ckpt_pages.clear();
+	ckpt_parent = f;
+
+	/* Walk up the chain; a page found nearer the leaf wins, though
+	 * identical hashes mean identical data anyway.
+	 */
+	while (f.length()) {
+		ckpt_hdr_t h;
+		int fd = open(f.c_str(), O_RDONLY);
+
+		if (fd < 0) {
+			printf("Can't open checkpoint '%s' (errno %d)\n", f.c_str(), errno);
+			goto fail;
+		}
+		if (read_hdr(fd, &h)) {
+			printf("Checkpoint '%s' is bad\n", f.c_str());
+			close(fd);
+			goto fail;
+		}
+
+		std::vector<ckpt_stored_t> st(h.nstored);
+		off_t o = sizeof(h) + (off_t)h.npages * sizeof(uint64_t);
+		if (read_at(fd, st.data(), h.nstored * sizeof(ckpt_stored_t), o)) {
+			printf("Checkpoint '%s' is truncated\n", f.c_str());
+			close(fd);
+			goto fail;
+		}
+		close(fd);
+
+		int idx = ckpt_chain_files.size();
+		ckpt_chain_files.push_back(f);
+		for (unsigned int i = 0; i < h.nstored; i++) {
+			ckpt_loc_t l = { idx, st[i].offset, st[i].len };
+			ckpt_pages.emplace(st[i].hash, l);
+		}
+
+		if (ckpt_chain_files.size() > 100000) {
+			printf("Checkpoint chain from '%s' loops?\n", filename);
+			goto fail;
+		}
+		h.parent[PATH_MAX-1] = '\0';
+		f = h.parent[0] ? ckpt_path(h.parent, f) : "";
+	}
+	return 0;
+
+fail:
+	ckpt_chain_files.clear();
+	ckpt_pages.clear();
+	ckpt_parent = "";
+	return -1;
+}
+
+int	ckpt_save(Testbench *tb, const char *filename)
+{
+	std::vector<uint8_t> img;
+
+	if (ckpt_in_chain(filename)) {
+		printf("Won't overwrite '%s', part of the checkpoint chain being saved ", filename);
+		return -1;
+	}
+	if (ckpt_model_to_mem(tb, &img) != 0)
+		return -1;
+
+	uint64_t stream_len = img.size();
+	uint32_t npages = (stream_len + CKPT_PAGE_SIZE - 1) / CKPT_PAGE_SIZE;
+	img.resize((size_t)npages * CKPT_PAGE_SIZE, 0);
+
+	ckpt_hdr_t h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, CKPT_MAGIC, 8);
+	h.stream_len = stream_len;
+	h.page_size = CKPT_PAGE_SIZE;
+	h.npages = npages;
+#ifdef CKPT_ZSTD
+	h.compression = CKPT_COMP_ZSTD;
+#else
+	h.compression = CKPT_COMP_NONE;
+#endif
+	strncpy(h.parent, ckpt_parent.c_str(), PATH_MAX-1);
+
+	/* Find the pages that are new relative to the chain: */
+	std::vector<uint64_t> hashes(npages);
+	std::vector<uint32_t> new_pages;
+	std::unordered_set<uint64_t> seen;
+
+	for (uint32_t i = 0; i < npages; i++) {
+		uint64_t hv = page_hash(&img[(size_t)i * CKPT_PAGE_SIZE]);
+		hashes[i] = hv;
+		if (ckpt_pages.count(hv) == 0 && seen.insert(hv).second)
+			new_pages.push_back(i);
+	}
+	h.nstored = new_pages.size();
+
+	/* Compress them: */
+	std::vector<ckpt_stored_t> st(h.nstored);
+	std::vector<uint8_t> data;
+	uint64_t data_base = sizeof(h) + (uint64_t)npages * sizeof(uint64_t) +
+		(uint64_t)h.nstored * sizeof(ckpt_stored_t);
+#ifdef CKPT_ZSTD
+	ZSTD_CCtx *cctx = ZSTD_createCCtx();
+	uint8_t cbuf[ZSTD_COMPRESSBOUND(CKPT_PAGE_SIZE)];
+#endif
+
+	for (uint32_t i = 0; i < h.nstored; i++) {
+		const uint8_t *p = &img[(size_t)new_pages[i] * CKPT_PAGE_SIZE];
+		size_t len = CKPT_PAGE_SIZE;
+
+#ifdef CKPT_ZSTD
+		size_t c = ZSTD_compressCCtx(cctx, cbuf, sizeof(cbuf), p,
+					     CKPT_PAGE_SIZE, CKPT_ZSTD_LEVEL);
+		if (!ZSTD_isError(c) && c < CKPT_PAGE_SIZE) {
+			p = cbuf;
+			len = c;
+		}
+#endif
+		st[i].hash = hashes[new_pages[i]];
+		st[i].offset = data_base + data.size();
+		st[i].len = len;
+		st[i].pad = 0;
+		data.insert(data.end(), p, p + len);
+	}
+#ifdef CKPT_ZSTD
+	ZSTD_freeCCtx(cctx);
+#endif
+
+	std::string tmp = std::string(filename) + ".tmp";
+	int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		printf("Can't create checkpoint '%s' (errno %d)\n", tmp.c_str(), errno);
+		return -1;
+	}
+	if (write_all(fd, &h, sizeof(h)) ||
+	    write_all(fd, hashes.data(), npages * sizeof(uint64_t)) ||
+	    write_all(fd, st.data(), h.nstored * sizeof(ckpt_stored_t)) ||
+	    write_all(fd, data.data(), data.size())) {
+		printf("Write to checkpoint '%s' failed (errno %d)\n", tmp.c_str(), errno);
+		close(fd);
+		unlink(tmp.c_str());
+		return -1;
+	}
+	close(fd);
+	if (rename(tmp.c_str(), filename) != 0) {
+		printf("Can't rename '%s' to '%s' (errno %d)\n", tmp.c_str(), filename, errno);
+		unlink(tmp.c_str());
+		return -1;
+	}
+
+	printf("(%d of %d pages new, %ld bytes) ", h.nstored, npages, (long)data.size());
+
+	/* This becomes the parent of the next generation: */
+	std::string f = ckpt_path(filename, "");
+	int idx = ckpt_chain_files.size();
+	ckpt_chain_files.push_back(f);
+	for (uint32_t i = 0; i < h.nstored; i++) {
+		ckpt_loc_t l = { idx, st[i].offset, st[i].len };
+		ckpt_pages.emplace(st[i].hash, l);
+	}
+	ckpt_parent = f;
+	return 0;
+}
+
+int	ckpt_restore(Testbench *tb, const char *filename)
+{
+	ckpt_hdr_t h;
+	int fd = open(filename, O_RDONLY);
+
+	if (fd < 0 || read_hdr(fd, &h)) {
+		printf("Can't read checkpoint '%s'\n", filename);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	std::vector<uint64_t> hashes(h.npages);
+	int r = read_at(fd, hashes.data(), h.npages * sizeof(uint64_t), sizeof(h));
+	close(fd);
+	if (r || ckpt_adopt(filename))
+		return -1;
+
+	std::vector<uint8_t> img((size_t)h.npages * CKPT_PAGE_SIZE);
+	std::vector<int> fds(ckpt_chain_files.size(), -1);
+	std::vector<uint8_t> cbuf(CKPT_PAGE_SIZE);
+#ifdef CKPT_ZSTD
+	ZSTD_DCtx *dctx = ZSTD_createDCtx();
+#endif
+	r = 0;
+
+	for (uint32_t i = 0; i < h.npages && !r; i++) {
+		auto it = ckpt_pages.find(hashes[i]);
+		uint8_t *to = &img[(size_t)i * CKPT_PAGE_SIZE];
+
+		if (it == ckpt_pages.end()) {
+			printf("Checkpoint page %d missing from chain\n", i);
+			r = -1;
+			break;
+		}
+		const ckpt_loc_t &l = it->second;
+		if (fds[l.file] < 0 &&
+		    (fds[l.file] = open(ckpt_chain_files[l.file].c_str(), O_RDONLY)) < 0) {
+			r = -1;
+			break;
+		}
+		if (l.len == CKPT_PAGE_SIZE) {
+			r = read_at(fds[l.file], to, CKPT_PAGE_SIZE, l.offset);
+		} else {
+#ifdef CKPT_ZSTD
+			r = read_at(fds[l.file], cbuf.data(), l.len, l.offset);
+			if (!r && ZSTD_decompressDCtx(dctx, to, CKPT_PAGE_SIZE,
+						      cbuf.data(), l.len) != CKPT_PAGE_SIZE)
+				r = -1;
+#else
+			printf("Checkpoint is compressed, but built without CKPT_ZSTD\n");
+			r = -1;
+#endif
+		}
+		if (r)
+			printf("Can't read page %d from '%s'\n", i,
+			       ckpt_chain_files[l.file].c_str());
+	}
+#ifdef CKPT_ZSTD
+	ZSTD_freeDCtx(dctx);
+#endif
+	for (unsigned int i = 0; i < fds.size(); i++) {
+		if (fds[i] >= 0)
+			close(fds[i]);
+	}
+	if (r)
+		return r;
+
+	return ckpt_model_from_mem(tb, img.data(), h.stream_len);
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright 2020-2022 Matt Evans
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <vector>
+
+/* Serialise the model to/from memory, instead of a file: */
+int	ckpt_model_to_mem(Testbench *tb, std::vector<uint8_t> *out);
+int	ckpt_model_from_mem(Testbench *tb, const uint8_t *data, size_t len);
+
+/* Incremental checkpoint files: */
+int	ckpt_is_incremental(const char *filename);
+int	ckpt_save(Testbench *tb, const char *filename);
+int	ckpt_restore(Testbench *tb, const char *filename);
+int	ckpt_adopt(const char *filename);
+int	ckpt_in_chain(const char *filename);
+
+#endif
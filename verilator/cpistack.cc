@@ -0,0 +1,221 @@
+/* MR-sys verilated sim CPI stack/stall attribution
+ *
+ * Copyright 2020-2022 Matt Evans
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+#include "testbench.h"
+#include "monitor.h"
+#include "cpu_signals.h"
+#include "cpistack.h"
+
+/* Every cycle is put in one bucket: either an instruction committed
+ * ("base"), or the reason it didn't.  Only signals the register dump and
+ * checker already rely on are used (the commit/stall counters, MEM's
+ * redirect and the CPU's MIC handshakes), so misses aren't told apart by
+ * cache or TLB; they all show up as memory time.  The causes are checked in
+ * order:
+ *
+ *	mic		The CPU's MIC request is waiting for the interconnect
+ *	memory		A CPU MIC request is outstanding (a cache fill, table
+ *			walk, writeback or uncached access)
+ *	redirect	Refilling after MEM redirected fetch (branch, exception)
+ *	interlock	Pipeline stalled (WB's stall counter), none of the above
+ *	empty		Nothing committed, nothing stalled: a bubble
+ *
+ * Cycles are also accumulated per PC region (of CPU_MEM_PC, or the fetch PC
+ * when refilling), to find where the cycles go.
+ */
+
+enum {
+	CPI_BASE = 0,
+	CPI_MIC,
+	CPI_MEMORY,
+	CPI_REDIRECT,
+	CPI_INTERLOCK,
+	CPI_EMPTY,
+	CPI_NUM
+};
+
+static const char *cpi_names[CPI_NUM] = {
+	"base", "mic", "memory", "redirect", "interlock", "empty"
+};
+
+typedef struct {
+	uint64_t	cycles[CPI_NUM];
+	uint64_t	instrs;
+} cpi_counts_t;
+
+static bool cpi_enabled = false;
+static uint32_t cpi_region_shift = 16;
+static const char *cpi_out_name = "cpi.csv";
+
+static cpi_counts_t cpi_total;
+static std::unordered_map<uint32_t, cpi_counts_t> cpi_regions;
+static uint32_t cpi_cur_region = ~0U;
+static cpi_counts_t *cpi_cur = NULL;
+
+static uint32_t last_committed;
+static uint32_t last_stalled;
+static bool redirect_pending = false;
+static cpu_mic_t cpi_mic;
+
+void	cpi_enable(void)
+{
+	cpi_enabled = true;
+}
+
+void	cpi_set_region(uint32_t size)
+{
+	if (size == 0 || (size & (size - 1))) {
+		fprintf(stderr, "CPI region size must be a power of two\n");
+		exit(1);
+	}
+	cpi_region_shift = __builtin_ctz(size);
+}
+
+void	cpi_set_output(const char *filename)
+{
+	cpi_out_name = strdup(filename);
+}
+
+static void	cpi_monitor(Testbench *tb, void *arg)
+{
+	auto *c = CPU(tb);
+	uint32_t committed = CPU_COMMITTED(c);
+	uint32_t stalled = CPU_STALLED(c);
+	uint32_t pc = CPU_MEM_PC(c);
+	int cause;
+
+	if (committed != last_committed) {
+		cause = CPI_BASE;
+		redirect_pending = false;
+	} else if (CPU_MIC_BLOCKED(tb)) {
+		cause = CPI_MIC;
+	} else if (cpi_mic.outstanding) {
+		cause = CPI_MEMORY;
+	} else if (redirect_pending) {
+		cause = CPI_REDIRECT;
+		pc = CPU_FETCH_PC(c);
+	} else if (stalled != last_stalled) {
+		cause = CPI_INTERLOCK;
+	} else {
+		cause = CPI_EMPTY;
+	}
+
+	if (CPU_REDIRECT(c))
+		redirect_pending = true;
+	cpu_mic_track(tb, &cpi_mic);
+
+	uint32_t region = pc >> cpi_region_shift;
+	if (region != cpi_cur_region) {
+		cpi_cur = &cpi_regions[region];
+		cpi_cur_region = region;
+	}
+	cpi_cur->cycles[cause]++;
+	cpi_total.cycles[cause]++;
+	if (cause == CPI_BASE) {
+		cpi_cur->instrs += committed - last_committed;
+		cpi_total.instrs += committed - last_committed;
+	}
+
+	last_committed = committed;
+	last_stalled = stalled;
+}
+
+int	cpi_init(Testbench *tb)
+{
+	if (!cpi_enabled)
+		return 0;
+
+	last_committed = CPU_COMMITTED(CPU(tb));
+	last_stalled = CPU_STALLED(CPU(tb));
+	printf("CPI stack: %u byte regions\n", 1U << cpi_region_shift);
+	return monitor_add(cpi_monitor, NULL);
+}
+
+static uint64_t	cpi_cycles(const cpi_counts_t *n)
+{
+	uint64_t t = 0;
+	for (int i = 0; i < CPI_NUM; i++)
+		t += n->cycles[i];
+	return t;
+}
+
+void	cpi_report(void)
+{
+	if (!cpi_enabled)
+		return;
+
+	uint64_t cycles = cpi_cycles(&cpi_total);
+	uint64_t instrs = cpi_total.instrs;
+
+	printf("CPI stack: %lu instructions, %lu cycles, CPI %.3f\n", instrs, cycles,
+	       instrs ? (double)cycles / instrs : 0.0);
+	for (int i = 0; i < CPI_NUM; i++) {
+		printf("  %-10s %12lu cycles  %6.3f CPI  %6.2f%%\n", cpi_names[i],
+		       cpi_total.cycles[i],
+		       instrs ? (double)cpi_total.cycles[i] / instrs : 0.0,
+		       cycles ? cpi_total.cycles[i] * 100.0 / cycles : 0.0);
+	}
+
+	/* Per region, busiest first: */
+	std::vector<std::pair<uint64_t, uint32_t> > regions;
+	for (auto &r : cpi_regions)
+		regions.push_back(std::make_pair(cpi_cycles(&r.second), r.first));
+	std::sort(regions.rbegin(), regions.rend());
+
+	printf("  %-8s %12s %7s", "region", "cycles", "CPI");
+	for (int i = 0; i < CPI_NUM; i++)
+		printf(" %9s", cpi_names[i]);
+	printf("\n");
+	for (unsigned int j = 0; j < regions.size() && j < 10; j++) {
+		const cpi_counts_t *n = &cpi_regions[regions[j].second];
+		uint64_t rc = regions[j].first;
+
+		printf("  %08x %12lu %7.3f", regions[j].second << cpi_region_shift, rc,
+		       n->instrs ? (double)rc / n->instrs : 0.0);
+		for (int i = 0; i < CPI_NUM; i++)
+			printf(" %8.2f%%", n->cycles[i] * 100.0 / rc);
+		printf("\n");
+	}
+
+	FILE *f = fopen(cpi_out_name, "w");
+	if (!f) {
+		fprintf(stderr, "CPI stack: can't write '%s'\n", cpi_out_name);
+		return;
+	}
+	fprintf(f, "region,instrs");
+	for (int i = 0; i < CPI_NUM; i++)
+		fprintf(f, ",%s", cpi_names[i]);
+	fprintf(f, "\n");
+	for (auto &r : regions) {
+		const cpi_counts_t *n = &cpi_regions[r.second];
+
+		fprintf(f, "0x%08x,%lu", r.second << cpi_region_shift, n->instrs);
+		for (int i = 0; i < CPI_NUM; i++)
+			fprintf(f, ",%lu", n->cycles[i]);
+		fprintf(f, "\n");
+	}
+	fclose(f);
+	printf("CPI stack: per-region counts written to '%s'\n", cpi_out_name);
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright 2020-2022 Matt Evans
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef CPISTACK_H
+#define CPISTACK_H
+
+#include <inttypes.h>
+
+void	cpi_enable(void);
+void	cpi_set_region(uint32_t size);
+void	cpi_set_output(const char *filename);
+int	cpi_init(Testbench *tb);
+void	cpi_report(void);
+
+#endif
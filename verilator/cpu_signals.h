@@ -0,0 +1,136 @@
+/*
+ * Copyright 2020-2022 Matt Evans
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef CPU_SIGNALS_H
+#define CPU_SIGNALS_H
+
+/* The CPU pipeline signals that the performance monitors read.  They're
+ * MR-hw internals, so they're collected here: if MR-hw renames or
+ * restructures something, this is the file to change.  Those outside
+ * CPU_INTERNALS are the ones the register dump and checker have always
+ * read.
+ *
+ * Use as:  auto *c = CPU(tb);  if (CPU_COMMIT(c)) ...
+ */
+#define CPU(tb)			((tb)->getTop()->tb_top->MR->CPU->CPU)
+
+/* Counters, incremented by WB per committed instruction/stalled cycle */
+#define CPU_COMMITTED(c)	((c)->WB->counter_instr_commit)
+#define CPU_STALLED(c)		((c)->WB->counter_stall_cycle)
+
+/* Fetch PC, and the instruction leaving MEM */
+#define CPU_FETCH_PC(c)		((c)->IF->current_pc)
+#define CPU_MEM_VALID(c)	((c)->MEM->memory_valid_r)
+#define CPU_MEM_PC(c)		((c)->MEM->memory_pc_r)
+#define CPU_MEM_MSR(c)		((c)->MEM->memory_msr_r)
+#define CPU_MEM_INSTR(c)	((c)->MEM->memory_instr_r)
+
+/* An instruction completing without a fault (as the checker uses) */
+#define CPU_COMMIT(c)		((c)->MEM->memory_valid_i && (c)->MEM->memory_fault_r == 0)
+
+/* Load data as formatted for writeback, for the load completing with
+ * CPU_COMMIT
+ */
+#define CPU_LD_DATA(c)		((c)->MEM->DTC->DCACHE->DFMTR->data)
+
+/* The instruction completing with CPU_COMMIT writes an SPR (including
+ * SRs/BATs/SDR1, via the 'special' SPR port)
+ */
+#define CPU_SPR_WRITE(c)	((c)->WB->writeback_spr_en_int || (c)->WB->writeback_sspr_en_int)
+
+/* MEM redirecting fetch (taken branch, exception, rfi, context sync) */
+#define CPU_REDIRECT(c)		((c)->MEM->new_pc_valid)
+
+/* Timebase and decrementer (as the register dump reads them); writable,
+ * to skip idle time
+ */
+#define CPU_TB(c)		((c)->DE->TBDEC->as_TB)
+#define CPU_DEC(c)		((c)->DE->TBDEC->as_DEC)
+
+/* An interrupt pending at the INTC (it drives the CPU's external IRQ) */
+#define CPU_INTC_PENDING(tb)	((tb)->getTop()->tb_top->MR->INTC->pending)
+
+/* The CPU's MIC request port (public_flat_rd in src/mr_top.v): a request
+ * the interconnect isn't accepting.
+ */
+#define CPU_MIC_BLOCKED(tb)	((tb)->getTop()->tb_top->MR->r0o_tv && \
+				 !(tb)->getTop()->tb_top->MR->r0o_tr)
+
+/* A beat of a CPU request/response packet transferring, and whether it's
+ * the packet's last
+ */
+#define CPU_MIC_REQ_BEAT(tb)	((tb)->getTop()->tb_top->MR->r0o_tv && \
+				 (tb)->getTop()->tb_top->MR->r0o_tr)
+#define CPU_MIC_REQ_LAST(tb)	((tb)->getTop()->tb_top->MR->r0o_tl)
+#define CPU_MIC_RESP_BEAT(tb)	((tb)->getTop()->tb_top->MR->r0i_tv && \
+				 (tb)->getTop()->tb_top->MR->r0i_tr)
+#define CPU_MIC_RESP_LAST(tb)	((tb)->getTop()->tb_top->MR->r0i_tl)
+
+/* Whether the CPU has MIC requests outstanding, from a request's first beat
+ * to its response's last; cpu_mic_track() is called every cycle.
+ */
+typedef struct {
+	bool		in_req;
+	unsigned int	outstanding;
+} cpu_mic_t;
+
+static inline void	cpu_mic_track(Testbench *tb, cpu_mic_t *m)
+{
+	if (CPU_MIC_REQ_BEAT(tb)) {
+		if (!m->in_req)
+			m->outstanding++;
+		m->in_req = !CPU_MIC_REQ_LAST(tb);
+	}
+	if (CPU_MIC_RESP_BEAT(tb) && CPU_MIC_RESP_LAST(tb) && m->outstanding)
+		m->outstanding--;
+}
+
+/* The rest are guesses at MR-hw internals that haven't been checked
+ * against its RTL (nor made public there), so they're only available in a
+ * CPU_INTERNALS=1 build, as are the features using them: the checker's
+ * store/shadow memory checks, and arch state export's and hybrid
+ * execution's copying of dirty D-cache lines.
+ */
+#ifdef CPU_INTERNALS
+
+/* The load/store completing with CPU_COMMIT: effective and physical
+ * addresses, size (MEM holds log2 bytes) and store data (right-aligned).
+ */
+#define CPU_LS_VALID(c)		((c)->MEM->memory_ls_r)
+#define CPU_LS_STORE(c)		((c)->MEM->memory_store_r)
+#define CPU_LS_EA(c)		((c)->MEM->memory_addr_r)
+#define CPU_LS_PA(c)		((c)->MEM->DTC->paddr)
+#define CPU_LS_SIZE(c)		(1 << (c)->MEM->memory_size_r)
+#define CPU_ST_DATA(c)		((c)->MEM->memory_wdata_r)
+
+/* The D-cache, for copying its dirty lines out (hybrid.cc, arch state
+ * export).  Each line has a valid and dirty bit and tag (the PA above the
+ * index): line i's data is at data[i * CPU_CL_WORDS], as 64-bit words laid
+ * out as in RAM.
+ */
+#define CPU_CL_WORDS		4
+#define CPU_DC_VALID(c)		((c)->MEM->DTC->DCACHE->valid)
+#define CPU_DC_DIRTY(c)		((c)->MEM->DTC->DCACHE->dirty)
+#define CPU_DC_TAG(c)		((c)->MEM->DTC->DCACHE->tags)
+#define CPU_DC_DATA(c)		((c)->MEM->DTC->DCACHE->data)
+#define CPU_DC_LINE_PA(c, i)	(((uint64_t)CPU_DC_TAG(c)[i] * CPU_NR(CPU_DC_VALID(c)) + (i)) * \
+				 CPU_CL_WORDS * 8)
+#define CPU_NR(a)		(sizeof(a) / sizeof((a)[0]))
+
+#endif // CPU_INTERNALS
+
+#endif
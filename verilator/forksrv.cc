@@ -0,0 +1,300 @@
+/* MR-sys verilated sim fork server
+ *
+ * Copyright 2020-2022 Matt Evans
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "forksrv.h"
+
+/* The model is reset (and restored, if asked) once, then the server waits
+ * for requests on a control port.  Each request forks a child that shares
+ * the warm model copy-on-write, sets up its own I/O and runs.
+ *
+ * A request is one line of text:
+ *
+ *	run [limit=N] [init=STR] [console=PORT] [debug=PORT] [mem=PORT]
+ *	    [log=FILE] [save=FILE]
+ *	quit
+ *
+ * limit is in cycles from the fork point.  In init, \n \r \t \s (space)
+ * and \\ are escapes.  PORT 0 picks a free port.  By default, the console
+ * is the control connection itself; otherwise the connection reports
+ * "done cycles=N" when the child finishes.  Either way, the child first
+ * replies "ok pid=P console=C debug=D mem=M" (C is -1 for inline, and all
+ * are -1 under --no-io).
+ *
+ * Without log= or save=, a child's stdout goes to forksrv.log.<pid> and it
+ * saves to <save file>.<pid>; its probe file and stats page (if any) are
+ * also suffixed with .<pid>, so that children don't overwrite each other.
+ *
+ * The request line must arrive within FORKSRV_REQ_TIMEOUT_MS of
+ * connecting, so that a slow (or idle) client can't hold up the server.
+ */
+
+#define FORKSRV_LINE_MAX	4096
+#define FORKSRV_REQ_TIMEOUT_MS	2000
+
+extern int io_console_port;
+extern int io_debug_port;
+extern int io_mem_bd_port;
+
+static int	fs_listen(int port)
+{
+	struct sockaddr_in addr;
+	int s, one = 1;
+
+	if ((s = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+		perror("Fork server: can't create socket\n");
+		return -1;
+	}
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = INADDR_ANY;
+	addr.sin_port = htons(port);
+
+	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) || listen(s, 16)) {
+		perror("Fork server: can't bind()/listen()\n");
+		close(s);
+		return -1;
+	}
+	return s;
+}
+
+static int64_t	fs_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Read up to a newline, within timeout_ms; returns the length, or -1 */
+static int	fs_read_line(int fd, char *buf, int max, int timeout_ms)
+{
+	int64_t deadline = fs_now_ms() + timeout_ms;
+	int n = 0;
+
+	while (n < max - 1) {
+		struct pollfd f = { .fd = fd, .events = POLLIN, .revents = 0 };
+		int64_t left = deadline - fs_now_ms();
+
+		if (left <= 0)
+			return -1;
+		int p = poll(&f, 1, (int)left);
+		if (p < 0 && errno == EINTR)
+			continue;
+		if (p <= 0)
+			return -1;
+
+		ssize_t r = read(fd, &buf[n], 1);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return -1;
+		if (buf[n] == '\n')
+			break;
+		if (buf[n] != '\r')
+			n++;
+	}
+	buf[n] = '\0';
+	return n;
+}
+
+static void	fs_reply(int fd, const char *msg)
+{
+	ssize_t r = write(fd, msg, strlen(msg));
+	(void)r;
+}
+
+static char	*fs_unescape(const char *s)
+{
+	char *out = (char *)malloc(strlen(s) + 1);
+	char *o = out;
+
+	while (*s) {
+		if (*s == '\\' && s[1]) {
+			s++;
+			switch (*s) {
+			case 'n':	*o++ = '\n';	break;
+			case 'r':	*o++ = '\r';	break;
+			case 't':	*o++ = '\t';	break;
+			case 's':	*o++ = ' ';	break;
+			default:	*o++ = *s;	break;
+			}
+			s++;
+		} else {
+			*o++ = *s++;
+		}
+	}
+	*o = '\0';
+	return out;
+}
+
+/* Fills in req from "run" arguments; returns 0, or -1 if they're bad. */
+static int	fs_parse_run(char *args, fork_req_t *req)
+{
+	char *tok, *save;
+
+	req->limit = 0;
+	req->init = NULL;
+	req->console_port = -1;
+	req->debug_port = 0;
+	req->mem_bd_port = 0;
+	req->log = NULL;
+	req->save = NULL;
+
+	for (tok = strtok_r(args, " \t", &save); tok;
+	     tok = strtok_r(NULL, " \t", &save)) {
+		char *val = strchr(tok, '=');
+		if (!val)
+			return -1;
+		*val++ = '\0';
+
+		if (!strcmp(tok, "limit"))
+			req->limit = strtoull(val, NULL, 0);
+		else if (!strcmp(tok, "init"))
+			req->init = fs_unescape(val);
+		else if (!strcmp(tok, "console"))
+			req->console_port = strtol(val, NULL, 0);
+		else if (!strcmp(tok, "debug"))
+			req->debug_port = strtol(val, NULL, 0);
+		else if (!strcmp(tok, "mem"))
+			req->mem_bd_port = strtol(val, NULL, 0);
+		else if (!strcmp(tok, "log"))
+			req->log = strdup(val);
+		else if (!strcmp(tok, "save"))
+			req->save = strdup(val);
+		else
+			return -1;
+	}
+	return 0;
+}
+
+static void	fs_reap(int *nchildren, bool block)
+{
+	int status;
+	pid_t pid;
+
+	while (*nchildren > 0 &&
+	       (pid = waitpid(-1, &status, block ? 0 : WNOHANG)) > 0) {
+		(*nchildren)--;
+		printf("[Fork server: child %d exited (%s %d), %d running]\n", pid,
+		       WIFEXITED(status) ? "status" : "signal",
+		       WIFEXITED(status) ? WEXITSTATUS(status) : WTERMSIG(status),
+		       *nchildren);
+	}
+}
+
+int	fork_server(int port, fork_req_t *req)
+{
+	int lskt = fs_listen(port);
+	int nchildren = 0;
+	char line[FORKSRV_LINE_MAX];
+
+	if (lskt < 0)
+		return -1;
+
+	printf("Fork server: listening on port %d\n", port);
+
+	while (1) {
+		struct pollfd f = { .fd = lskt, .events = POLLIN, .revents = 0 };
+
+		fflush(stdout);
+		int r = poll(&f, 1, 500);
+		fs_reap(&nchildren, false);
+		if (r <= 0)
+			continue;
+
+		int fd = accept(lskt, NULL, NULL);
+		if (fd < 0)
+			continue;
+
+		if (fs_read_line(fd, line, sizeof(line), FORKSRV_REQ_TIMEOUT_MS) < 0) {
+			printf("[Fork server: no request from connection, dropped]\n");
+			close(fd);
+			continue;
+		}
+
+		if (!strcmp(line, "quit")) {
+			fs_reply(fd, "ok\n");
+			close(fd);
+			break;
+		} else if (strncmp(line, "run", 3) != 0 ||
+			   (line[3] != '\0' && line[3] != ' ') ||
+			   fs_parse_run(&line[3], req) != 0) {
+			fs_reply(fd, "error bad request\n");
+			close(fd);
+			continue;
+		}
+
+		fflush(stdout);
+		fflush(stderr);
+		pid_t pid = fork();
+		if (pid == 0) {
+			close(lskt);
+			req->ctl_fd = fd;
+			return 0;
+		}
+		if (pid < 0) {
+			fs_reply(fd, "error fork failed\n");
+		} else {
+			nchildren++;
+			printf("[Fork server: started child %d, %d running]\n",
+			       pid, nchildren);
+		}
+		close(fd);
+		free(req->init);
+		free(req->log);
+		free(req->save);
+	}
+
+	close(lskt);
+	printf("Fork server: waiting for %d children\n", nchildren);
+	fs_reap(&nchildren, true);
+	return 1;
+}
+
+/* Called in the child once its I/O is set up */
+void	fork_server_child_ready(fork_req_t *req)
+{
+	char msg[128];
+
+	snprintf(msg, sizeof(msg), "ok pid=%d console=%d debug=%d mem=%d\n",
+		 getpid(), req->console_port < 0 ? -1 : io_console_port,
+		 io_debug_port, io_mem_bd_port);
+	fs_reply(req->ctl_fd, msg);
+}
+
+void	fork_server_child_done(fork_req_t *req, uint64_t cycles)
+{
+	char msg[64];
+
+	if (req->console_port < 0)
+		return;		// Connection's the console, just close it
+	snprintf(msg, sizeof(msg), "done cycles=%lu\n", cycles);
+	fs_reply(req->ctl_fd, msg);
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright 2020-2022 Matt Evans
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FORKSRV_H
+#define FORKSRV_H
+
+#include <inttypes.h>
+
+/* One "run" request, as seen by the forked child: */
+typedef struct {
+	int		ctl_fd;		// Control connection
+	uint64_t	limit;		// Cycles to run, 0 = unlimited
+	char		*init;		// Console initial string, or NULL
+	int		console_port;	// -1 = console on the control connection
+	int		debug_port;	// 0 = any free port
+	int		mem_bd_port;	// 0 = any free port
+	char		*log;		// Simulator stdout goes here, or NULL
+	char		*save;		// State save filename, or NULL
+} fork_req_t;
+
+/* Returns 0 in a newly-forked child, with *req filled in; returns non-zero
+ * in the server once it's told to quit (or fails).
+ */
+int	fork_server(int port, fork_req_t *req);
+void	fork_server_child_ready(fork_req_t *req);
+void	fork_server_child_done(fork_req_t *req, uint64_t cycles);
+
+#endif
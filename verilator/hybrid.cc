@@ -0,0 +1,387 @@
+/* MR-sys verilated sim hybrid MR-ISS/RTL execution
+ *
+ * Copyright 2020-2022 Matt Evans
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "testbench.h"
+#include "arch_state.h"
+#include "cpu_signals.h"
+#include "monitor.h"
+#include "iss.h"
+#include "imix.h"
+#include "hybrid.h"
+
+#ifdef HYBRID
+
+/* Fast-forwards in MR-ISS, over the model's BRAM arrays, and switches to
+ * the model (RTL) at a trigger:
+ *
+ *	--hybrid-iss <trigger>	Switch from RTL to the ISS (default start)
+ *	--hybrid-rtl <trigger>	Switch from the ISS to RTL
+ *	--hybrid-back <trigger>	Switch back to the ISS (default never)
+ *
+ * where a trigger is one of:
+ *
+ *	start		Immediately (--hybrid-iss only)
+ *	pc:<addr>	The instruction at addr is reached
+ *	instrs:<n>	n instructions have been executed in this phase
+ *	cycle:<n>	n cycles have been simulated in this phase (RTL only)
+ *	uart:<string>	The console outputs string
+ *
+ * and a phase starts at each switch.  With --hybrid-back, the ISS then RTL
+ * phases repeat, e.g. for sampling.
+ *
+ * The ISS has no devices: an access outside RAM is undone, and the model
+ * runs from that instruction for --hybrid-io-cycles before returning to the
+ * ISS.  So the console works, albeit slowly, and uart: is checked then.
+ * External interrupts aren't seen whilst in the ISS (DEC is).
+ *
+ * Switching to the ISS waits for an instruction that doesn't access memory
+ * to commit whilst the CPU has no MIC request outstanding, and takes the
+ * architected state from before it.  Switching to RTL is as -A: the model's
+ * reset (emptying its pipeline, caches and TLBs), then the state loaded,
+ * including the INTC's and console's registers.  The devices are otherwise
+ * reset, e.g. the console's FIFOs are emptied, so an IO window should be
+ * long enough for output to drain.
+ *
+ * The ISS shares RAM with the model but not its D-cache, whose dirty lines
+ * can only be copied out in a CPU_INTERNALS build.  Otherwise, stores the
+ * model's D-cache holds when switching to the ISS are lost to it.
+ *
+ * The cycle count doesn't advance in the ISS, and state dumps/saves whilst
+ * there reflect the model, not the ISS.
+ */
+
+extern volatile uint64_t current_limit;
+
+#define HYBRID_ISS_CHUNK	1000000
+#define HYBRID_IO_CYCLES	10000
+
+enum { TRIG_NONE = 0, TRIG_START, TRIG_PC, TRIG_INSTRS, TRIG_CYCLE, TRIG_UART };
+
+typedef struct {
+	int		type;
+	uint64_t	val;
+	char		*str;
+	unsigned int	match;		// Position in str matched so far
+} trigger_t;
+
+enum { H_RTL_INITIAL = 0, H_ISS, H_RTL_IO, H_RTL_TARGET };
+
+static const char *state_names[] = { "RTL", "ISS", "RTL (IO)", "RTL" };
+
+static bool hybrid_enabled = false;
+static trigger_t trig_iss = { TRIG_START };
+static trigger_t trig_rtl;
+static trigger_t trig_back;
+static uint64_t io_cycles = HYBRID_IO_CYCLES;
+
+static int state = H_RTL_INITIAL;
+static bool want_switch = false;
+static bool quit = false;
+static uint64_t phase_instrs = 0;
+static uint64_t phase_cycle = 0;	// Start of the phase (or IO window)
+static arch_regs_t regs;
+static cpu_mic_t mic;
+
+static uint64_t iss_instrs = 0;
+static uint64_t rtl_instrs = 0;
+static uint64_t switches_iss = 0;
+static uint64_t switches_rtl = 0;
+static uint64_t switches_io = 0;
+
+static int	trig_parse(const char *s, trigger_t *t)
+{
+	memset(t, 0, sizeof(*t));
+
+	if (!strcmp(s, "start")) {
+		t->type = TRIG_START;
+	} else if (!strncmp(s, "pc:", 3)) {
+		t->type = TRIG_PC;
+		t->val = strtoull(s + 3, NULL, 0);
+	} else if (!strncmp(s, "instrs:", 7)) {
+		t->type = TRIG_INSTRS;
+		t->val = strtoull(s + 7, NULL, 0);
+	} else if (!strncmp(s, "cycle:", 6)) {
+		t->type = TRIG_CYCLE;
+		t->val = strtoull(s + 6, NULL, 0);
+	} else if (!strncmp(s, "uart:", 5) && s[5] != '\0') {
+		t->type = TRIG_UART;
+		t->str = strdup(s + 5);
+	} else {
+		fprintf(stderr, "Bad hybrid trigger '%s'\n", s);
+		return -1;
+	}
+	hybrid_enabled = true;
+	return 0;
+}
+
+int	hybrid_set_iss(const char *trig)
+{
+	return trig_parse(trig, &trig_iss);
+}
+
+int	hybrid_set_rtl(const char *trig)
+{
+	if (trig_parse(trig, &trig_rtl))
+		return -1;
+	if (trig_rtl.type == TRIG_START || trig_rtl.type == TRIG_CYCLE) {
+		fprintf(stderr, "--hybrid-rtl trigger can't be start/cycle\n");
+		return -1;
+	}
+	return 0;
+}
+
+int	hybrid_set_back(const char *trig)
+{
+	if (trig_parse(trig, &trig_back))
+		return -1;
+	if (trig_back.type == TRIG_START) {
+		fprintf(stderr, "--hybrid-back trigger can't be start\n");
+		return -1;
+	}
+	return 0;
+}
+
+void	hybrid_set_io_cycles(uint64_t cycles)
+{
+	io_cycles = cycles;
+}
+
+bool	hybrid_in_iss(void)
+{
+	return state == H_ISS;
+}
+
+bool	hybrid_quit(void)
+{
+	return quit;
+}
+
+/* Called once per cycle in RTL phases, after commits are counted */
+static bool	trig_check(Testbench *tb, trigger_t *t, bool commit)
+{
+	auto *c = CPU(tb);
+
+	switch (t->type) {
+	case TRIG_START:
+		return true;
+
+	case TRIG_PC:
+		return commit && CPU_MEM_PC(c) == t->val;
+
+	case TRIG_INSTRS:
+		return phase_instrs >= t->val;
+
+	case TRIG_CYCLE:
+		return tb->get_tickcount() - phase_cycle >= t->val;
+
+	case TRIG_UART:
+		if (tb->getTop()->tb_top->MR->CONSOLE_UART->tx_has_data) {
+			char d = tb->getTop()->tb_top->MR->CONSOLE_UART->next_tx_byte;
+			if (d != t->str[t->match])
+				t->match = 0;
+			if (d == t->str[t->match] && t->str[++t->match] == '\0') {
+				t->match = 0;
+				return true;
+			}
+		}
+		return false;
+	}
+	return false;
+}
+
+static void	enter_phase(Testbench *tb, int s, uint32_t pc)
+{
+	printf("[Hybrid: %s -> %s at cycle %lu, PC %08x, after %lu instrs]\n",
+	       state_names[state], state_names[s], tb->get_tickcount(), pc,
+	       phase_instrs);
+	/* An IO window is part of the ISS phase it interrupts */
+	if (!(state == H_ISS && s == H_RTL_IO) && !(state == H_RTL_IO && s == H_ISS))
+		phase_instrs = 0;
+	phase_cycle = tb->get_tickcount();
+	state = s;
+}
+
+#ifdef CPU_INTERNALS
+static void	dcache_writeback(Testbench *tb)
+{
+	auto *c = CPU(tb);
+	unsigned int lines = CPU_NR(CPU_DC_VALID(c));
+
+	for (unsigned int i = 0; i < lines; i++) {
+		if (!CPU_DC_VALID(c)[i] || !CPU_DC_DIRTY(c)[i])
+			continue;
+
+		uint64_t avail;
+		uint64_t *p = (uint64_t *)tb->ram_ptr(CPU_DC_LINE_PA(c, i), &avail);
+
+		if (p && avail >= CPU_CL_WORDS * 8) {
+			for (int w = 0; w < CPU_CL_WORDS; w++)
+				p[w] = CPU_DC_DATA(c)[i * CPU_CL_WORDS + w];
+		}
+		CPU_DC_DIRTY(c)[i] = 0;
+	}
+}
+#endif
+
+static void	to_iss(Testbench *tb)
+{
+	tb_read_arch_regs(tb, &regs);
+#ifdef CPU_INTERNALS
+	dcache_writeback(tb);
+#endif
+	iss_set_regs(&regs);
+
+	switches_iss++;
+	enter_phase(tb, H_ISS, regs.pc);
+	current_limit = 0;		// Drop out of run()
+}
+
+/* regs still has the INTC/console state from to_iss() */
+static void	to_rtl(Testbench *tb, int s)
+{
+	iss_get_regs(&regs);
+	tb->reset();
+	tb_write_arch_regs(tb, &regs);
+	memset(&mic, 0, sizeof(mic));
+
+	if (s == H_RTL_IO)
+		switches_io++;
+	else
+		switches_rtl++;
+	enter_phase(tb, s, regs.pc);
+}
+
+static void	hybrid_monitor(Testbench *tb, void *arg)
+{
+	auto *c = CPU(tb);
+	bool commit = CPU_COMMIT(c);
+
+	if (state == H_ISS)
+		return;
+
+	cpu_mic_track(tb, &mic);
+	if (commit) {
+		phase_instrs++;
+		rtl_instrs++;
+	}
+
+	if (!want_switch) {
+		switch (state) {
+		case H_RTL_INITIAL:
+			want_switch = trig_check(tb, &trig_iss, commit);
+			break;
+		case H_RTL_IO:
+			if (trig_rtl.type != TRIG_NONE && trig_check(tb, &trig_rtl, commit))
+				enter_phase(tb, H_RTL_TARGET, CPU_MEM_PC(c));
+			else
+				want_switch = tb->get_tickcount() - phase_cycle >= io_cycles;
+			break;
+		case H_RTL_TARGET:
+			want_switch = trig_back.type != TRIG_NONE &&
+				trig_check(tb, &trig_back, commit);
+			break;
+		}
+	}
+
+	/* The state's taken from before this instruction, so it's
+	 * re-executed in the ISS:
+	 */
+	if (want_switch && commit && !imix_is_memop(CPU_MEM_INSTR(c)) && !mic.outstanding) {
+		want_switch = false;
+		phase_instrs--;
+		rtl_instrs--;
+		to_iss(tb);
+	}
+}
+
+/* Runs the ISS until it's time to switch to RTL (or a signal) */
+void	hybrid_run_iss(Testbench *tb)
+{
+	while (state == H_ISS && current_limit != 0) {
+		uint64_t max = HYBRID_ISS_CHUNK;
+		uint32_t stop_pc = ~0U;
+		uint64_t n;
+		uint32_t io_pa;
+
+		if (trig_rtl.type == TRIG_INSTRS) {
+			if (phase_instrs >= trig_rtl.val) {
+				to_rtl(tb, H_RTL_TARGET);
+				break;
+			}
+			if (trig_rtl.val - phase_instrs < max)
+				max = trig_rtl.val - phase_instrs;
+		} else if (trig_rtl.type == TRIG_PC) {
+			stop_pc = trig_rtl.val;
+		}
+
+		int why = iss_run(max, stop_pc, &n, &io_pa);
+
+		phase_instrs += n;
+		iss_instrs += n;
+
+		switch (why) {
+		case ISS_STOP_PC:
+			to_rtl(tb, H_RTL_TARGET);
+			break;
+		case ISS_STOP_IO:
+			to_rtl(tb, H_RTL_IO);
+			break;
+		case ISS_STOP_QUIT:
+			printf("[Hybrid: ISS quit at PC %08x]\n", iss_get_pc());
+			quit = true;
+			return;
+		}
+	}
+}
+
+int	hybrid_init(Testbench *tb)
+{
+	static const uint64_t banks[] = { 0, 0x01000000, RAM_BOOT_BASE };
+
+	if (!hybrid_enabled)
+		return 0;
+
+	iss_init(0);
+	for (unsigned int i = 0; i < sizeof(banks) / sizeof(banks[0]); i++) {
+		uint64_t avail;
+		uint8_t *p = tb->ram_ptr(banks[i], &avail);
+
+		if (!p) {
+			fprintf(stderr, "Hybrid execution needs BRAM (not REAL_RAM)\n");
+			return -1;
+		}
+		iss_add_ram(banks[i], p, avail);
+	}
+	phase_cycle = tb->get_tickcount();
+	return monitor_add(hybrid_monitor, NULL);
+}
+
+void	hybrid_report(void)
+{
+	if (!hybrid_enabled)
+		return;
+
+	printf("Hybrid: %lu instrs in the ISS, %lu in RTL; %lu switches to the ISS, "
+	       "%lu to RTL, %lu for IO\n",
+	       iss_instrs, rtl_instrs, switches_iss, switches_rtl, switches_io);
+}
+
+#endif
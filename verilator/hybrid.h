@@ -0,0 +1,31 @@
+/*
+ * Copyright 2020-2022 Matt Evans
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HYBRID_H
+#define HYBRID_H
+
+/* Hybrid MR-ISS/model execution (HYBRID builds); see hybrid.cc. */
+int	hybrid_set_iss(const char *trig);
+int	hybrid_set_rtl(const char *trig);
+int	hybrid_set_back(const char *trig);
+void	hybrid_set_io_cycles(uint64_t cycles);
+int	hybrid_init(Testbench *tb);
+bool	hybrid_in_iss(void);
+bool	hybrid_quit(void);
+void	hybrid_run_iss(Testbench *tb);
+void	hybrid_report(void);
+
+#endif
@@ -0,0 +1,195 @@
+/* MR-sys verilated sim idle-loop fast-forward
+ *
+ * Copyright 2020-2022 Matt Evans
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "testbench.h"
+#include "monitor.h"
+#include "cpu_signals.h"
+#include "idle.h"
+
+/* When the CPU's idling (committing instructions in an --idle-pc range, or
+ * the same instruction repeatedly, i.e. a tight self-branch) and the system
+ * is quiet:
+ *
+ * - No MIC requests or responses in flight
+ * - No INTC interrupt pending, and MSR[EE] set so the DEC will be taken
+ * - No console output, and no host input (console, debug, memory backdoor)
+ *
+ * then nothing can happen until the DEC fires, so TB/DEC and the cycle count
+ * are jumped forward to just before it.  A jump's at most --idle-max
+ * cycles, so that host input is seen within that.
+ *
+ * Only the CPU's TB/DEC are advanced: other cycle-driven state (e.g. the
+ * APB perf counters) doesn't count skipped cycles, nor do the monitors,
+ * though those with cycle deadlines are told of the jump.  A
+ * device DMAing without MIC traffic at that instant (e.g. waiting on an SD
+ * card) could be skipped past, so --idle-pc ranges should be chosen with
+ * that in mind.  There's no skipping whilst tracing.
+ */
+
+extern volatile uint64_t current_limit;
+
+#define IDLE_MAX_RANGES		8
+#define IDLE_CONFIRM		16		// Idle commits in a row before skipping
+#define IDLE_MARGIN		64		// DEC ticks left to simulate
+#define IDLE_MIN_SKIP		1000
+#define IDLE_DEFAULT_MAX	1000000
+#define IDLE_TB_DIV		1		// Cycles per TB/DEC tick
+
+#define MSR_EE			0x8000
+
+#define MR(tb)			((tb)->getTop()->tb_top->MR)
+
+static bool idle_enabled = false;
+static uint64_t idle_max = IDLE_DEFAULT_MAX;
+
+static struct {
+	uint32_t	lo, hi;
+} idle_ranges[IDLE_MAX_RANGES];
+static int idle_ranges_num = 0;
+
+static uint32_t idle_last_pc = ~0U;
+static unsigned int idle_run = 0;
+
+static Testbench *idle_tb;
+static uint64_t idle_start_cycle;
+static uint64_t idle_skips = 0;
+static uint64_t idle_skipped = 0;
+
+void	idle_enable(void)
+{
+	idle_enabled = true;
+}
+
+/* <lo>-<hi>, inclusive */
+int	idle_add_pc_range(const char *range)
+{
+	char *end;
+
+	if (idle_ranges_num == IDLE_MAX_RANGES) {
+		fprintf(stderr, "Too many idle PC ranges (max %d)\n", IDLE_MAX_RANGES);
+		return -1;
+	}
+	idle_ranges[idle_ranges_num].lo = strtoul(range, &end, 0);
+	if (*end != '-') {
+		fprintf(stderr, "Bad idle PC range '%s' (want <lo>-<hi>)\n", range);
+		return -1;
+	}
+	idle_ranges[idle_ranges_num].hi = strtoul(end + 1, NULL, 0);
+	idle_ranges_num++;
+	idle_enabled = true;
+	return 0;
+}
+
+void	idle_set_max(uint64_t cycles)
+{
+	idle_max = cycles;
+}
+
+static bool	idle_pc(uint32_t pc)
+{
+	if (pc == idle_last_pc)
+		return true;
+	for (int i = 0; i < idle_ranges_num; i++)
+		if (pc >= idle_ranges[i].lo && pc <= idle_ranges[i].hi)
+			return true;
+	return false;
+}
+
+static bool	mic_quiet(Testbench *tb)
+{
+	auto *mr = MR(tb);
+
+	return !(mr->r0o_tv | mr->r0i_tv | mr->r1o_tv | mr->r1i_tv |
+		 mr->r2o_tv | mr->r2i_tv | mr->r3o_tv | mr->r3i_tv |
+		 mr->r4o_tv | mr->r4i_tv | mr->r5o_tv | mr->r5i_tv |
+		 mr->r6o_tv | mr->r6i_tv | mr->r7o_tv | mr->r7i_tv |
+		 mr->c0i_tv | mr->c0o_tv | mr->c1i_tv | mr->c1o_tv |
+		 mr->c2i_tv | mr->c2o_tv | mr->c3i_tv | mr->c3o_tv);
+}
+
+static void	idle_monitor(Testbench *tb, void *arg)
+{
+	auto *c = CPU(tb);
+
+	if (!CPU_COMMIT(c))
+		return;
+
+	uint32_t pc = CPU_MEM_PC(c);
+
+	idle_run = idle_pc(pc) ? idle_run + 1 : 0;
+	idle_last_pc = pc;
+	if (idle_run < IDLE_CONFIRM)
+		return;
+
+	int32_t dec = CPU_DEC(c);
+	uint64_t now = tb->get_tickcount();
+
+	if (!(CPU_MEM_MSR(c) & MSR_EE) || dec <= IDLE_MARGIN ||
+	    CPU_INTC_PENDING(tb) || MR(tb)->CONSOLE_UART->tx_has_data ||
+	    !mic_quiet(tb) || !tb->ioemul_idle() || tb->trace_start() != ~0ULL)
+		return;
+
+	uint64_t ticks = dec - IDLE_MARGIN;
+
+	if (ticks * IDLE_TB_DIV > idle_max)
+		ticks = idle_max / IDLE_TB_DIV;
+	/* Stop at the run loop's limit (checkpoints, signals, -l): */
+	if (current_limit <= now + 1)
+		return;
+	if (ticks * IDLE_TB_DIV > current_limit - now - 1)
+		ticks = (current_limit - now - 1) / IDLE_TB_DIV;
+	if (ticks * IDLE_TB_DIV < IDLE_MIN_SKIP)
+		return;
+
+	CPU_TB(c) += ticks;
+	CPU_DEC(c) -= ticks;
+	tb->set_tickcount(now + ticks * IDLE_TB_DIV);
+	monitors_jumped(tb, now, now + ticks * IDLE_TB_DIV);
+
+	idle_skips++;
+	idle_skipped += ticks * IDLE_TB_DIV;
+	idle_run = 0;
+}
+
+int	idle_init(Testbench *tb)
+{
+	if (!idle_enabled)
+		return 0;
+
+	idle_tb = tb;
+	idle_start_cycle = tb->get_tickcount();
+	printf("Idle skip: up to %lu cycles at a time, %d idle PC range(s)\n",
+	       idle_max, idle_ranges_num);
+	return monitor_add(idle_monitor, NULL);
+}
+
+void	idle_report(void)
+{
+	if (!idle_enabled)
+		return;
+
+	uint64_t cycles = idle_tb->get_tickcount() - idle_start_cycle;
+
+	printf("Idle skip: %lu of %lu cycles skipped (%.1f%%), in %lu jumps\n",
+	       idle_skipped, cycles, cycles ? 100.0 * idle_skipped / cycles : 0.0,
+	       idle_skips);
+}
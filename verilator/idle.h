@@ -0,0 +1,26 @@
+/*
+ * Copyright 2020-2022 Matt Evans
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IDLE_H
+#define IDLE_H
+
+void	idle_enable(void);
+int	idle_add_pc_range(const char *range);
+void	idle_set_max(uint64_t cycles);
+int	idle_init(Testbench *tb);
+void	idle_report(void);
+
+#endif
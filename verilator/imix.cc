@@ -0,0 +1,360 @@
+/* MR-sys verilated sim instruction mix/opcode coverage
+ *
+ * Copyright 2020-2022 Matt Evans
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <vector>
+#include <algorithm>
+
+#include "testbench.h"
+#include "monitor.h"
+#include "cpu_signals.h"
+#include "imix.h"
+
+/* Each committed instruction is counted by primary opcode and, for the
+ * primaries with extended opcodes (19, 31, 59, 63), by the 10-bit extended
+ * opcode, in directly-indexed tables.  Each also accumulates its "latency":
+ * the cycles since the previous commit, i.e. what it added to the run time.
+ *
+ * At exit, the counts are matched against a table of the 32-bit PowerPC
+ * integer, branch, system and load/store instructions to give the mix per
+ * instruction and per class, and to list those never executed.  (FP
+ * arithmetic isn't in the table, but shows up by opcode if it's executed.)
+ */
+
+enum {
+	IC_LOAD = 0,
+	IC_STORE,
+	IC_BRANCH,
+	IC_ALU,
+	IC_MULDIV,
+	IC_CR,
+	IC_SYS,
+	IC_CACHE,
+	IC_OTHER,
+	IC_NUM
+};
+
+static const char *class_names[IC_NUM] = {
+	"load", "store", "branch", "alu", "mul/div", "cr", "system", "cache/tlb", "other"
+};
+
+typedef struct {
+	uint64_t	count;
+	uint64_t	cycles;
+} imix_op_t;
+
+typedef struct {
+	uint8_t		prim;
+	int16_t		xo;		// -1 if primary only
+	uint8_t		cls;
+	bool		oe;		// XO-form: xo | 512 is the OE form
+	const char	*name;
+} imix_name_t;
+
+#define P(p, c, n)		{ p, -1, c, false, n }
+#define X(p, x, c, n)		{ p, x, c, false, n }
+#define XO(p, x, c, n)		{ p, x, c, true, n }
+
+static const imix_name_t imix_names[] = {
+	P(3, IC_SYS, "twi"),		P(7, IC_MULDIV, "mulli"),
+	P(8, IC_ALU, "subfic"),		P(10, IC_ALU, "cmpli"),
+	P(11, IC_ALU, "cmpi"),		P(12, IC_ALU, "addic"),
+	P(13, IC_ALU, "addic."),	P(14, IC_ALU, "addi"),
+	P(15, IC_ALU, "addis"),		P(16, IC_BRANCH, "bc"),
+	P(17, IC_SYS, "sc"),		P(18, IC_BRANCH, "b"),
+	P(20, IC_ALU, "rlwimi"),	P(21, IC_ALU, "rlwinm"),
+	P(23, IC_ALU, "rlwnm"),		P(24, IC_ALU, "ori"),
+	P(25, IC_ALU, "oris"),		P(26, IC_ALU, "xori"),
+	P(27, IC_ALU, "xoris"),		P(28, IC_ALU, "andi."),
+	P(29, IC_ALU, "andis."),	P(32, IC_LOAD, "lwz"),
+	P(33, IC_LOAD, "lwzu"),		P(34, IC_LOAD, "lbz"),
+	P(35, IC_LOAD, "lbzu"),		P(36, IC_STORE, "stw"),
+	P(37, IC_STORE, "stwu"),	P(38, IC_STORE, "stb"),
+	P(39, IC_STORE, "stbu"),	P(40, IC_LOAD, "lhz"),
+	P(41, IC_LOAD, "lhzu"),		P(42, IC_LOAD, "lha"),
+	P(43, IC_LOAD, "lhau"),		P(44, IC_STORE, "sth"),
+	P(45, IC_STORE, "sthu"),	P(46, IC_LOAD, "lmw"),
+	P(47, IC_STORE, "stmw"),	P(48, IC_LOAD, "lfs"),
+	P(49, IC_LOAD, "lfsu"),		P(50, IC_LOAD, "lfd"),
+	P(51, IC_LOAD, "lfdu"),		P(52, IC_STORE, "stfs"),
+	P(53, IC_STORE, "stfsu"),	P(54, IC_STORE, "stfd"),
+	P(55, IC_STORE, "stfdu"),
+
+	X(19, 0, IC_CR, "mcrf"),	X(19, 16, IC_BRANCH, "bclr"),
+	X(19, 33, IC_CR, "crnor"),	X(19, 50, IC_SYS, "rfi"),
+	X(19, 129, IC_CR, "crandc"),	X(19, 150, IC_SYS, "isync"),
+	X(19, 193, IC_CR, "crxor"),	X(19, 225, IC_CR, "crnand"),
+	X(19, 257, IC_CR, "crand"),	X(19, 289, IC_CR, "creqv"),
+	X(19, 417, IC_CR, "crorc"),	X(19, 449, IC_CR, "cror"),
+	X(19, 528, IC_BRANCH, "bcctr"),
+
+	X(31, 0, IC_ALU, "cmp"),	X(31, 4, IC_SYS, "tw"),
+	XO(31, 8, IC_ALU, "subfc"),	XO(31, 10, IC_ALU, "addc"),
+	X(31, 11, IC_MULDIV, "mulhwu"),	X(31, 19, IC_CR, "mfcr"),
+	X(31, 20, IC_LOAD, "lwarx"),	X(31, 23, IC_LOAD, "lwzx"),
+	X(31, 24, IC_ALU, "slw"),	X(31, 26, IC_ALU, "cntlzw"),
+	X(31, 28, IC_ALU, "and"),	X(31, 32, IC_ALU, "cmpl"),
+	XO(31, 40, IC_ALU, "subf"),	X(31, 54, IC_CACHE, "dcbst"),
+	X(31, 55, IC_LOAD, "lwzux"),	X(31, 60, IC_ALU, "andc"),
+	X(31, 75, IC_MULDIV, "mulhw"),	X(31, 83, IC_SYS, "mfmsr"),
+	X(31, 86, IC_CACHE, "dcbf"),	X(31, 87, IC_LOAD, "lbzx"),
+	XO(31, 104, IC_ALU, "neg"),	X(31, 119, IC_LOAD, "lbzux"),
+	X(31, 124, IC_ALU, "nor"),	XO(31, 136, IC_ALU, "subfe"),
+	XO(31, 138, IC_ALU, "adde"),	X(31, 144, IC_CR, "mtcrf"),
+	X(31, 146, IC_SYS, "mtmsr"),	X(31, 150, IC_STORE, "stwcx."),
+	X(31, 151, IC_STORE, "stwx"),	X(31, 183, IC_STORE, "stwux"),
+	XO(31, 200, IC_ALU, "subfze"),	XO(31, 202, IC_ALU, "addze"),
+	X(31, 210, IC_SYS, "mtsr"),	X(31, 215, IC_STORE, "stbx"),
+	XO(31, 232, IC_ALU, "subfme"),	XO(31, 234, IC_ALU, "addme"),
+	XO(31, 235, IC_MULDIV, "mullw"), X(31, 242, IC_SYS, "mtsrin"),
+	X(31, 246, IC_CACHE, "dcbtst"),	X(31, 247, IC_STORE, "stbux"),
+	XO(31, 266, IC_ALU, "add"),	X(31, 278, IC_CACHE, "dcbt"),
+	X(31, 279, IC_LOAD, "lhzx"),	X(31, 284, IC_ALU, "eqv"),
+	X(31, 306, IC_CACHE, "tlbie"),	X(31, 310, IC_LOAD, "eciwx"),
+	X(31, 311, IC_LOAD, "lhzux"),	X(31, 316, IC_ALU, "xor"),
+	X(31, 339, IC_SYS, "mfspr"),	X(31, 343, IC_LOAD, "lhax"),
+	X(31, 370, IC_CACHE, "tlbia"),	X(31, 371, IC_SYS, "mftb"),
+	X(31, 375, IC_LOAD, "lhaux"),	X(31, 407, IC_STORE, "sthx"),
+	X(31, 412, IC_ALU, "orc"),	X(31, 438, IC_STORE, "ecowx"),
+	X(31, 439, IC_STORE, "sthux"),	X(31, 444, IC_ALU, "or"),
+	XO(31, 459, IC_MULDIV, "divwu"), X(31, 467, IC_SYS, "mtspr"),
+	X(31, 470, IC_CACHE, "dcbi"),	X(31, 476, IC_ALU, "nand"),
+	XO(31, 491, IC_MULDIV, "divw"),	X(31, 512, IC_CR, "mcrxr"),
+	X(31, 533, IC_LOAD, "lswx"),	X(31, 534, IC_LOAD, "lwbrx"),
+	X(31, 535, IC_LOAD, "lfsx"),	X(31, 536, IC_ALU, "srw"),
+	X(31, 566, IC_CACHE, "tlbsync"), X(31, 567, IC_LOAD, "lfsux"),
+	X(31, 595, IC_SYS, "mfsr"),	X(31, 597, IC_LOAD, "lswi"),
+	X(31, 598, IC_SYS, "sync"),	X(31, 599, IC_LOAD, "lfdx"),
+	X(31, 631, IC_LOAD, "lfdux"),	X(31, 659, IC_SYS, "mfsrin"),
+	X(31, 661, IC_STORE, "stswx"),	X(31, 662, IC_STORE, "stwbrx"),
+	X(31, 663, IC_STORE, "stfsx"),	X(31, 695, IC_STORE, "stfsux"),
+	X(31, 725, IC_STORE, "stswi"),	X(31, 727, IC_STORE, "stfdx"),
+	X(31, 759, IC_STORE, "stfdux"),	X(31, 790, IC_LOAD, "lhbrx"),
+	X(31, 792, IC_ALU, "sraw"),	X(31, 824, IC_ALU, "srawi"),
+	X(31, 854, IC_SYS, "eieio"),	X(31, 918, IC_STORE, "sthbrx"),
+	X(31, 922, IC_ALU, "extsh"),	X(31, 954, IC_ALU, "extsb"),
+	X(31, 982, IC_CACHE, "icbi"),	X(31, 983, IC_STORE, "stfiwx"),
+	X(31, 1014, IC_CACHE, "dcbz"),
+};
+
+#define IMIX_NAMES	(sizeof(imix_names) / sizeof(imix_names[0]))
+
+/* Primaries with extended opcodes -> index into imix_ext (0 if none) */
+static int8_t ext_of[64];
+static const uint8_t ext_prim[5] = { 0, 19, 31, 59, 63 };
+
+static imix_op_t imix_prim[64];
+static imix_op_t imix_ext[5][1024];
+
+static bool imix_enabled = false;
+static const char *imix_out_name = NULL;
+static uint64_t imix_last_commit;
+
+void	imix_enable(void)
+{
+	imix_enabled = true;
+}
+
+void	imix_set_output(const char *filename)
+{
+	imix_enabled = true;
+	imix_out_name = strdup(filename);
+}
+
+static void	imix_monitor(Testbench *tb, void *arg)
+{
+	auto *c = CPU(tb);
+
+	if (!CPU_COMMIT(c))
+		return;
+
+	uint32_t inst = CPU_MEM_INSTR(c);
+	uint64_t now = tb->get_tickcount();
+	uint64_t lat = now - imix_last_commit;
+	unsigned int prim = inst >> 26;
+	imix_op_t *op;
+
+	if (ext_of[prim])
+		op = &imix_ext[ext_of[prim]][(inst >> 1) & 0x3ff];
+	else
+		op = &imix_prim[prim];
+	op->count++;
+	op->cycles += lat;
+	imix_last_commit = now;
+}
+
+/* Whether an instruction accesses memory: a load, store or cache/TLB op */
+bool	imix_is_memop(uint32_t inst)
+{
+	static bool prim_mem[64];
+	static bool x31_mem[1024];
+	static bool built = false;
+
+	if (!built) {
+		for (unsigned int i = 0; i < IMIX_NAMES; i++) {
+			const imix_name_t *n = &imix_names[i];
+			bool mem = n->cls == IC_LOAD || n->cls == IC_STORE || n->cls == IC_CACHE;
+
+			if (n->xo < 0)
+				prim_mem[n->prim] = mem;
+			else if (n->prim == 31)
+				x31_mem[n->xo] = mem;
+		}
+		built = true;
+	}
+	if ((inst >> 26) == 31)
+		return x31_mem[(inst >> 1) & 0x3ff];
+	return prim_mem[inst >> 26];
+}
+
+int	imix_init(Testbench *tb)
+{
+	if (!imix_enabled)
+		return 0;
+
+	for (int e = 1; e < 5; e++)
+		ext_of[ext_prim[e]] = e;
+	imix_last_commit = tb->get_tickcount();
+	return monitor_add(imix_monitor, NULL);
+}
+
+typedef struct {
+	char		name[16];
+	int		cls;
+	imix_op_t	n;
+} imix_row_t;
+
+void	imix_report(void)
+{
+	if (!imix_enabled)
+		return;
+
+	/* Gather the named instructions, taking what they've counted out of a
+	 * copy of the tables so that whatever's left is unknown:
+	 */
+	static imix_op_t prim[64];
+	static imix_op_t ext[5][1024];
+	std::vector<imix_row_t> rows;
+	std::vector<const char *> never;
+	uint64_t total = 0, total_cycles = 0;
+	imix_op_t classes[IC_NUM] = {};
+
+	memcpy(prim, imix_prim, sizeof(prim));
+	memcpy(ext, imix_ext, sizeof(ext));
+
+	for (unsigned int i = 0; i < IMIX_NAMES; i++) {
+		const imix_name_t *nm = &imix_names[i];
+		imix_row_t r = {};
+		imix_op_t *a, *b = NULL;
+
+		if (nm->xo < 0) {
+			a = &prim[nm->prim];
+		} else {
+			a = &ext[ext_of[nm->prim]][nm->xo];
+			if (nm->oe)
+				b = &ext[ext_of[nm->prim]][nm->xo | 512];
+		}
+		strncpy(r.name, nm->name, sizeof(r.name) - 1);
+		r.cls = nm->cls;
+		r.n = *a;
+		*a = (imix_op_t){};
+		if (b) {
+			r.n.count += b->count;
+			r.n.cycles += b->cycles;
+			*b = (imix_op_t){};
+		}
+		if (r.n.count)
+			rows.push_back(r);
+		else
+			never.push_back(nm->name);
+	}
+
+	/* Anything left over isn't in the name table: */
+	for (int p = 0; p < 64; p++) {
+		if (prim[p].count) {
+			imix_row_t r = {};
+			snprintf(r.name, sizeof(r.name), "op%d", p);
+			r.cls = IC_OTHER;
+			r.n = prim[p];
+			rows.push_back(r);
+		}
+	}
+	for (int e = 1; e < 5; e++) {
+		for (int x = 0; x < 1024; x++) {
+			if (ext[e][x].count) {
+				imix_row_t r = {};
+				snprintf(r.name, sizeof(r.name), "op%d/%d", ext_prim[e], x);
+				r.cls = IC_OTHER;
+				r.n = ext[e][x];
+				rows.push_back(r);
+			}
+		}
+	}
+
+	for (auto &r : rows) {
+		total += r.n.count;
+		total_cycles += r.n.cycles;
+		classes[r.cls].count += r.n.count;
+		classes[r.cls].cycles += r.n.cycles;
+	}
+	std::sort(rows.begin(), rows.end(),
+		  [](const imix_row_t &a, const imix_row_t &b) { return a.n.count > b.n.count; });
+
+	printf("Instruction mix: %lu instructions, %lu cycles\n", total, total_cycles);
+	if (!total)
+		return;
+
+	printf("  %-10s %12s %7s %9s %7s\n", "class", "count", "mix", "avg cyc", "cycles");
+	for (int i = 0; i < IC_NUM; i++) {
+		if (!classes[i].count)
+			continue;
+		printf("  %-10s %12lu %6.2f%% %9.2f %6.2f%%\n", class_names[i],
+		       classes[i].count, classes[i].count * 100.0 / total,
+		       (double)classes[i].cycles / classes[i].count,
+		       classes[i].cycles * 100.0 / total_cycles);
+	}
+
+	printf("  %-10s %12s %7s %9s %7s\n", "instr", "count", "mix", "avg cyc", "cycles");
+	for (auto &r : rows) {
+		printf("  %-10s %12lu %6.2f%% %9.2f %6.2f%%\n", r.name, r.n.count,
+		       r.n.count * 100.0 / total, (double)r.n.cycles / r.n.count,
+		       r.n.cycles * 100.0 / total_cycles);
+	}
+
+	printf("  Never executed (%lu of %lu):", never.size(), IMIX_NAMES);
+	for (unsigned int i = 0; i < never.size(); i++)
+		printf("%s%s", (i % 12) ? " " : "\n    ", never[i]);
+	printf("\n");
+
+	if (imix_out_name) {
+		FILE *f = fopen(imix_out_name, "w");
+		if (!f) {
+			fprintf(stderr, "Instruction mix: can't write '%s'\n", imix_out_name);
+			return;
+		}
+		fprintf(f, "instr,class,count,cycles\n");
+		for (auto &r : rows)
+			fprintf(f, "%s,%s,%lu,%lu\n", r.name, class_names[r.cls], r.n.count,
+				r.n.cycles);
+		for (auto n : never)
+			fprintf(f, "%s,,0,0\n", n);
+		fclose(f);
+	}
+}
@@ -20,8 +20,13 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
 #include <poll.h>
+#include <sched.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
 #include "testbench.h"
 
 
@@ -30,58 +35,78 @@
 
 #define CONSOLE_PORT 	2000
 #define DEBUG_PORT 	2001
+#define MEM_BACKDOOR_PORT	2002
 
 // Initial console string
 extern char *uart_init_string;
 static int uart_init_string_len = -1;
 static int uart_init_string_pos = 0;
 
-const int poll_interval_max = 10000;
-const int poll_interval_min = 100;
-const int poll_interval_delta = 100;
-static int poll_interval_cur = poll_interval_max;
+/* Ports can be changed (e.g. by the fork server); 0 picks a free port, and
+ * the port actually used is written back once listening.
+ */
+int io_console_port = CONSOLE_PORT;
+int io_debug_port = DEBUG_PORT;
+int io_mem_bd_port = MEM_BACKDOOR_PORT;
+
+/* If >= 0, an already-connected console to use instead of listening: */
+int io_console_fd = -1;
+
+/* The sim finishes when the console prints this (if set): */
+char *io_exit_string = NULL;
+static unsigned int io_exit_match = 0;
+
+/* Console bytes output, for status reporting, and bytes the IO thread
+ * couldn't take (reported at exit):
+ */
+uint64_t io_console_tx_bytes = 0;
+uint64_t io_console_tx_dropped = 0;
+
+/* Output batches are flushed after this many cycles without a new byte: */
+uint64_t io_tx_idle_cycles = 256;
+
+/* The IO thread is woken for output, so this timeout is just a backstop. */
+const int io_thread_poll_ms = 100;
 
 /* This function should be as fast as possible:
  *
  * - Look for received data that needs to be dealt with
- * - Look for any socket activity to manage
+ *
+ * Socket activity is managed by the IO thread, so this is just a look
+ * at the RX rings.
  */
 uint64_t	Testbench::io_poll_work(void)
 {
 	uint64_t work = 0;
 
-	// Sets bits corresponding to input streams
-	work = io_poll_sockets();
-
 	/***** Console UART *****/
-	if (uart_init_string_pos < uart_init_string_len) {
-		// May already be set due to socket input
+	if (uart_init_string_pos < uart_init_string_len ||
+	    !uart_rx_ring.empty()) {
 		work |= IO_WORK_UART;
 	}
 
 	/***** Debug channel *****/
-	// Nothing: only input from socket.
+	if (!dbg_rx_ring.empty()) {
+		work |= IO_WORK_DBG;
+	}
 	return work;
 }
 
 uint8_t		Testbench::io_dbg_rx_data(void)
 {
-	uint8_t d;
-	/* uart_poll_socket() said data was waiting */
-	assert(dbg_skt != -1);
-	int r = read(dbg_skt, &d, 1);
-	// could poll here, and flag more_work_to_do as more bytes await
+	uint8_t d = 0;
+	/* io_poll_work() said data was waiting */
+	dbg_rx_ring.pop(&d);
 	return d;
 }
 
 uint8_t 	Testbench::io_uart_rx_data(void)
 {
-	uint8_t d;
+	uint8_t d = 0;
 	if (uart_init_string_pos < uart_init_string_len) {
 		d = uart_init_string[uart_init_string_pos++];
-	} else /* uart_poll_socket() said yes */ {
-		assert(uart_skt != -1);
-		int r = read(uart_skt, &d, 1);
+	} else /* io_poll_work() said yes */ {
+		uart_rx_ring.pop(&d);
 	}
 	return d;
 }
@@ -101,29 +126,79 @@ static int	accept_conn(int lskt)
 	return s;
 }
 
-uint64_t Testbench::io_poll_sockets(void)
+static void	drop_conn(int *fd)
 {
-	static int poll_count = 0;
-	/* Hack:  Avoid doing a syscall every tick by polling
-	 * fairly rarely - this will still give good interactive
-	 * speeds but might not transfer data particularly quickly.
-	 *
-	 * The proper fix is to move polling into another thread, such that
-	 * this test is one memory access in the common case.
-	 */
-	if (++poll_count < poll_interval_cur)
+	fprintf(stderr, "[Connection dropped on fd %d]\n", *fd);
+	close(*fd);
+	*fd = -1;
+}
+
+/* Move as much as possible from a socket into an RX ring.  Returns 0, or
+ * -1 if the connection has gone away.
+ */
+template <typename R>
+static int	skt_to_ring(int fd, R *ring)
+{
+	uint8_t buf[4096];
+	uint32_t s = ring->space();
+
+	if (s > sizeof(buf))
+		s = sizeof(buf);
+	if (s == 0)
 		return 0;
-	poll_count = 0;
 
-	//////////////////////////////////////////////////////////////////////
+	ssize_t r = read(fd, buf, s);
+	if (r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR))
+		return -1;
+	if (r > 0)
+		ring->push(buf, r);
+	return 0;
+}
 
-	uint64_t work = 0;
+/* Drain a TX ring into a socket (or into the bin, if nobody's connected).
+ * Everything queued goes in one writev(), even if the ring has wrapped.
+ * Returns 0, or -1 if the connection has gone away.
+ */
+template <typename R>
+static int	ring_to_skt(int fd, R *ring)
+{
+	const uint8_t *p[2];
+	uint32_t n[2];
+	struct iovec iov[2];
+	int segs;
+
+	while ((segs = ring->peekv(p, n)) > 0) {
+		uint32_t total = 0;
+
+		for (int i = 0; i < segs; i++) {
+			iov[i].iov_base = (void *)p[i];
+			iov[i].iov_len = n[i];
+			total += n[i];
+		}
+		if (fd == -1) {
+			ring->consume(total);
+			continue;
+		}
+		ssize_t r = writev(fd, iov, segs);
+		if (r < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				return 0;	// Try again when POLLOUT
+			return -1;
+		}
+		ring->consume(r);
+		if ((uint32_t)r < total)
+			return 0;
+	}
+	return 0;
+}
 
+void	Testbench::io_poll_sockets(void)
+{
 	const int num_services = 2;
 	int num = num_services;
 
-	// Poll on at least each service's listenFD:
-	struct pollfd f[num_services * 2] = {
+	// Poll on at least each service's listenFD, plus the wakeup:
+	struct pollfd f[num_services * 2 + 1] = {
 		[0] = {
                         .fd = uart_listen_skt,
                         .events = POLLIN,
@@ -137,119 +212,421 @@ uint64_t Testbench::io_poll_sockets(void)
 	};
 
 	// And, optionally poll on each service's connectionFD:
-	struct {
-		int *fd;
-		uint64_t work_type;
-	} client_fds[num_services];
+	int *client_fds[num_services];
 
+	/* Only ask for input when there's somewhere to put it; otherwise
+	 * the sim is applying backpressure and we'd spin.
+	 */
 	if (uart_skt != -1) {
 		f[num].fd = uart_skt;
-		f[num].events = POLLIN;
+		f[num].events = (uart_rx_ring.space() ? POLLIN : 0) |
+			(uart_tx_ring.empty() ? 0 : POLLOUT);
 		f[num].revents = 0;
-		client_fds[num-num_services].fd = &uart_skt;
-		client_fds[num-num_services].work_type = IO_WORK_UART;
+		client_fds[num-num_services] = &uart_skt;
 		num++;
 	}
 
 	if (dbg_skt != -1) {
 		f[num].fd = dbg_skt;
-		f[num].events = POLLIN;
+		f[num].events = (dbg_rx_ring.space() ? POLLIN : 0) |
+			(dbg_tx_ring.empty() ? 0 : POLLOUT);
 		f[num].revents = 0;
-		client_fds[num-num_services].fd = &dbg_skt;
-		client_fds[num-num_services].work_type = IO_WORK_DBG;
+		client_fds[num-num_services] = &dbg_skt;
 		num++;
 	}
+	int nclients = num;
+
+	f[num].fd = io_wake_fd;
+	f[num].events = POLLIN;
+	f[num].revents = 0;
+	num++;
 
-	if (poll(f, num, 0) > 0) {
+	if (poll(f, num, io_thread_poll_ms) > 0) {
 		int lskts[] = { uart_listen_skt, dbg_listen_skt };
 		int *fds[] = { &uart_skt, &dbg_skt };
 
 		for (int i = 0; i < num_services; i++) {
-			if (f[i].revents != 0)
+			if (f[i].revents != 0) {
+				if (*fds[i] != -1)
+					drop_conn(fds[i]);
 				*fds[i] = accept_conn(lskts[i]);
+			}
+		}
+
+		if (f[nclients].revents & POLLIN) {
+			uint64_t v;
+			read(io_wake_fd, &v, sizeof(v));
 		}
 
-		for (int i = num_services; i < num; i++) {
+		for (int i = num_services; i < nclients; i++) {
+			int *fd = client_fds[i-num_services];
+
+			if (*fd != f[i].fd)
+				continue;	// Replaced by a new connection above
 			if (f[i].revents & (POLLERR | POLLHUP)) {
-				fprintf(stderr, "[Connection dropped on fd %d]\n",
-					*client_fds[i-num_services].fd);
-				*client_fds[i-num_services].fd = -1;
+				drop_conn(fd);
 			} else if (f[i].revents & POLLIN) {
-				work |= client_fds[i-num_services].work_type;
+				int r;
+				if (fd == &uart_skt)
+					r = skt_to_ring(*fd, &uart_rx_ring);
+				else
+					r = skt_to_ring(*fd, &dbg_rx_ring);
+				if (r < 0)
+					drop_conn(fd);
 			}
 		}
 	}
 
-	/* Hack on a hack: adjust the poll interval.  If we've had work the past
-	 * N times we've looked, poll more frequently.  If we haven't, poll less
-	 * frequently.  Bound by max/min.  (For simplicity, N=1)
-	 */
-	static int busy_last_time = 0;
-	if (work && busy_last_time && poll_interval_cur > poll_interval_min) {
-		poll_interval_cur -= poll_interval_delta;
-	}
-	if (!work && !busy_last_time && poll_interval_cur < poll_interval_max) {
-		poll_interval_cur += poll_interval_delta;
-	}
-	busy_last_time = !!work;
+	/* Output from the sim */
+	if (ring_to_skt(uart_skt, &uart_tx_ring) < 0)
+		drop_conn(&uart_skt);
+	if (ring_to_skt(dbg_skt, &dbg_tx_ring) < 0)
+		drop_conn(&dbg_skt);
+}
 
-	return work;
+void	*Testbench::io_thread_entry(void *arg)
+{
+	((Testbench *)arg)->io_thread_main();
+	return NULL;
 }
 
-void Testbench::ioemul_init(void)
+void	Testbench::io_thread_main(void)
 {
-	struct sockaddr_in listenaddr;
+	while (1) {
+		io_poll_sockets();
+	}
+}
 
-	/* Init UART sockets */
-	uart_skt = -1;
+int	listen_on(int *port)
+{
+	struct sockaddr_in listenaddr;
+	socklen_t alen = sizeof(listenaddr);
+	int s;
 
-        if ((uart_listen_skt = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+        if ((s = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
                 perror("Can't create listening socket\n");
-                return;
+                return -1;
         }
 
-        /* Bind the local address to the sending socket, any port number */
+        /* Bind the local address to the sending socket */
         listenaddr.sin_family = AF_INET;
         listenaddr.sin_addr.s_addr = INADDR_ANY;
-        listenaddr.sin_port = htons(CONSOLE_PORT);
+        listenaddr.sin_port = htons(*port);
 
-        if (bind(uart_listen_skt, (struct sockaddr *)&listenaddr, sizeof(listenaddr))) {
+        if (bind(s, (struct sockaddr *)&listenaddr, sizeof(listenaddr))) {
                 perror("Can't bind() socket\n");
-                return;
+                close(s);
+                return -1;
         }
-        if (listen(uart_listen_skt, 1)) {
+        if (listen(s, 1)) {
                 perror("Can't listen() on socket\n");
-                return;
+                close(s);
+                return -1;
         }
+        if (getsockname(s, (struct sockaddr *)&listenaddr, &alen) == 0)
+                *port = ntohs(listenaddr.sin_port);
+        return s;
+}
+
+void Testbench::ioemul_init(void)
+{
+	/* Output batching */
+	uart_txb.len = 0;
+	uart_txb.flush_on_nl = true;
+	uart_txb.echo = stdout;
+	uart_txb.ring = &uart_tx_ring;
+	uart_txb.lossless = false;
+
+	dbg_txb.len = 0;
+	dbg_txb.flush_on_nl = false;
+	dbg_txb.echo = NULL;
+	dbg_txb.ring = &dbg_tx_ring;
+	dbg_txb.lossless = true;
+
+	mem_bd.pending = 0;
+	pthread_mutex_init(&mem_bd.lock, NULL);
+	pthread_cond_init(&mem_bd.done, NULL);
+
+	if (uart_init_string)
+		uart_init_string_len = strlen(uart_init_string);
+
+	if ((io_wake_fd = eventfd(0, EFD_NONBLOCK)) == -1) {
+		perror("Can't create eventfd\n");
+		return;
+	}
+
+	/* Init UART sockets */
+	if (io_console_fd >= 0) {
+		uart_skt = io_console_fd;
+		uart_listen_skt = -1;	// Ignored by poll()
+		if (fcntl(uart_skt, F_SETFL, O_NONBLOCK) == -1) {
+			perror("Can't set console non-blocking\n");
+		}
+		printf("Console UART: using fd %d\n", uart_skt);
+	} else {
+		uart_skt = -1;
+
+		if ((uart_listen_skt = listen_on(&io_console_port)) < 0)
+			return;
 
-	printf("Console UART: listening on port %d (fd %d)\n",
-	       CONSOLE_PORT, uart_listen_skt);
+		printf("Console UART: listening on port %d (fd %d)\n",
+		       io_console_port, uart_listen_skt);
+	}
 
 
 	/* Init debug sockets */
 	dbg_skt = -1;
 
-        if ((dbg_listen_skt = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-                perror("Can't create listening socket\n");
-                return;
-        }
+	if ((dbg_listen_skt = listen_on(&io_debug_port)) < 0)
+		return;
 
-        listenaddr.sin_port = htons(DEBUG_PORT);
+	printf("Debug requester: listening on port %d (fd %d)\n",
+	       io_debug_port, dbg_listen_skt);
 
-        if (bind(dbg_listen_skt, (struct sockaddr *)&listenaddr, sizeof(listenaddr))) {
-                perror("Can't bind() socket\n");
-                return;
-        }
-        if (listen(dbg_listen_skt, 1)) {
-                perror("Can't listen() on socket\n");
-                return;
-        }
+	/* Init memory backdoor socket */
+	if ((mem_bd_listen_skt = listen_on(&io_mem_bd_port)) < 0)
+		return;
 
-	printf("Debug requester: listening on port %d (fd %d)\n",
-	       DEBUG_PORT, dbg_listen_skt);
+	printf("Memory backdoor: listening on port %d (fd %d)\n",
+	       io_mem_bd_port, mem_bd_listen_skt);
 
-	if (uart_init_string)
-		uart_init_string_len = strlen(uart_init_string);
+	/* Sockets are now owned by the IO threads.  They shouldn't
+	 * take the sim's signals (they're handled in the main loop):
+	 */
+	sigset_t ss, oss;
+	sigfillset(&ss);
+	pthread_sigmask(SIG_BLOCK, &ss, &oss);
+	if (pthread_create(&io_thread, NULL, io_thread_entry, this)) {
+		perror("Can't create IO thread\n");
+	} else {
+		io_running = true;
+	}
+	if (pthread_create(&mem_bd_thread, NULL, mem_bd_thread_entry, this)) {
+		perror("Can't create memory backdoor thread\n");
+	}
+	pthread_sigmask(SIG_SETMASK, &oss, NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Memory backdoor
+//
+// Bulk loads/reads of sim RAM, without going through r_debug and the MIC.
+// Requests are a mem_bd_req_t header (little-endian), followed by len bytes
+// of data for a write.  The response is a mem_bd_resp_t, followed by len
+// bytes of data for a successful read.  A bad request gets an error status
+// (and a write's data is discarded), leaving the connection usable.
+//
+// Like r_debug, this goes straight to memory; the CPU caches aren't
+// involved, so the usual care is needed around regions the CPU has cached.
+
+typedef struct {
+	uint32_t	cmd;
+	uint32_t	len;
+	uint64_t	addr;
+} mem_bd_req_t;
+
+typedef struct {
+	uint32_t	status;		// MEM_BD_OK etc.
+	uint32_t	len;
+} mem_bd_resp_t;
+
+#define MEM_BD_OK		0
+#define MEM_BD_NOT_RAM		1	// Some of the range isn't RAM
+#define MEM_BD_BAD_REQ		2	// Unknown cmd, or len too big
+
+#define MEM_BD_MAX_LEN		(64*1024*1024)
+
+/* Copies to/from RAM, which might span banks.  Returns 0, or -1 if any
+ * of the range isn't RAM.
+ */
+int	Testbench::mem_copy(uint64_t addr, uint8_t *buf, uint64_t len, bool write)
+{
+	while (len > 0) {
+		uint64_t avail;
+		uint8_t *p = ram_ptr(addr, &avail);
+
+		if (!p)
+			return -1;
+		if (avail > len)
+			avail = len;
+		if (write)
+			memcpy(p, buf, avail);
+		else
+			memcpy(buf, p, avail);
+		addr += avail;
+		buf += avail;
+		len -= avail;
+	}
+	return 0;
+}
+
+/* Called from ioemul(), i.e. from the sim thread between clock edges */
+void	Testbench::io_mem_backdoor(void)
+{
+	if (mem_copy(mem_bd.addr, mem_bd.buf, mem_bd.len, mem_bd.cmd == MEM_BD_WRITE))
+		mem_bd.status = MEM_BD_NOT_RAM;
+	else
+		mem_bd.status = MEM_BD_OK;
+
+	pthread_mutex_lock(&mem_bd.lock);
+	mem_bd.pending.store(0, std::memory_order_release);
+	pthread_cond_signal(&mem_bd.done);
+	pthread_mutex_unlock(&mem_bd.lock);
+}
+
+static int	read_all(int fd, void *buf, size_t len)
+{
+	uint8_t *p = (uint8_t *)buf;
+	while (len > 0) {
+		ssize_t r = read(fd, p, len);
+		if (r <= 0) {
+			if (r < 0 && errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += r;
+		len -= r;
+	}
+	return 0;
+}
+
+/* Also used by checkpoint.cc */
+int	write_all(int fd, const void *buf, size_t len)
+{
+	const uint8_t *p = (const uint8_t *)buf;
+	while (len > 0) {
+		ssize_t r = write(fd, p, len);
+		if (r <= 0) {
+			if (r < 0 && errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += r;
+		len -= r;
+	}
+	return 0;
+}
+
+void	*Testbench::mem_bd_thread_entry(void *arg)
+{
+	((Testbench *)arg)->mem_bd_thread_main();
+	return NULL;
+}
+
+void	Testbench::mem_bd_thread_main(void)
+{
+	uint8_t *buf = (uint8_t *)malloc(MEM_BD_MAX_LEN);
+
+	while (1) {
+		int s = accept_conn(mem_bd_listen_skt);
+		if (s < 0)
+			continue;
+		/* This thread can just block: */
+		fcntl(s, F_SETFL, 0);
+
+		mem_bd_req_t req;
+		while (read_all(s, &req, sizeof(req)) == 0) {
+			mem_bd_resp_t resp;
+
+			resp.status = MEM_BD_OK;
+			resp.len = 0;
+
+			if ((req.cmd != MEM_BD_READ && req.cmd != MEM_BD_WRITE) ||
+			    req.len > MEM_BD_MAX_LEN) {
+				fprintf(stderr, "[Memory backdoor: bad request %u len %lu]\n",
+					req.cmd, (unsigned long)req.len);
+
+				/* Skip a write's data, to stay in step */
+				uint64_t skip = (req.cmd == MEM_BD_WRITE) ? req.len : 0;
+				while (skip > 0) {
+					uint64_t l = skip > MEM_BD_MAX_LEN ? MEM_BD_MAX_LEN : skip;
+
+					if (read_all(s, buf, l) < 0)
+						break;
+					skip -= l;
+				}
+				resp.status = MEM_BD_BAD_REQ;
+				if (skip > 0 || write_all(s, &resp, sizeof(resp)) < 0)
+					break;
+				continue;
+			}
+			if (req.cmd == MEM_BD_WRITE &&
+			    read_all(s, buf, req.len) < 0)
+				break;
+
+			/* Hand over to the sim thread, and wait for it: */
+			mem_bd.cmd = req.cmd;
+			mem_bd.addr = req.addr;
+			mem_bd.len = req.len;
+			mem_bd.buf = buf;
+			pthread_mutex_lock(&mem_bd.lock);
+			mem_bd.pending.store(1, std::memory_order_release);
+			while (mem_bd.pending.load(std::memory_order_acquire))
+				pthread_cond_wait(&mem_bd.done, &mem_bd.lock);
+			pthread_mutex_unlock(&mem_bd.lock);
+
+			resp.status = mem_bd.status;
+			if (req.cmd == MEM_BD_READ && resp.status == 0)
+				resp.len = req.len;
+			if (write_all(s, &resp, sizeof(resp)) < 0 ||
+			    write_all(s, buf, resp.len) < 0)
+				break;
+		}
+		fprintf(stderr, "[Connection dropped on fd %d]\n", s);
+		::close(s);
+	}
+}
+
+void	Testbench::io_tx_flush(io_txbuf_t *b)
+{
+	if (b->echo) {
+		fwrite(b->data, 1, b->len, b->echo);
+		fflush(b->echo);
+	}
+	uint64_t v = 1;
+	unsigned int done = b->ring->push(b->data, b->len);
+
+	/* The IO thread can't keep up.  The debug stream is a protocol and
+	 * mustn't lose bytes, so wait for it to make space; the console's
+	 * already echoed to stdout, so its overflow is just counted.
+	 */
+	while (done < b->len && b->lossless && io_running) {
+		write(io_wake_fd, &v, sizeof(v));
+		sched_yield();
+		done += b->ring->push(b->data + done, b->len - done);
+	}
+	if (done < b->len && !b->lossless)
+		io_console_tx_dropped += b->len - done;
+	b->len = 0;
+
+	write(io_wake_fd, &v, sizeof(v));
+}
+
+void	Testbench::ioemul_flush(void)
+{
+	if (io_wake_fd == -1)
+		return;		// IO was never set up (--no-io)
+	if (uart_txb.len)
+		io_tx_flush(&uart_txb);
+	if (dbg_txb.len)
+		io_tx_flush(&dbg_txb);
+}
+
+/* Flush, and give the IO thread a chance to send it all before exit */
+void	Testbench::ioemul_drain(void)
+{
+	ioemul_flush();
+	for (int i = 0; io_running && i < 1000; i++) {
+		if (uart_tx_ring.drained() && dbg_tx_ring.drained())
+			break;
+		usleep(1000);
+	}
+}
+
+/* No host input waiting (checked before skipping idle cycles) */
+bool	Testbench::ioemul_idle(void)
+{
+	return io_poll_work() == 0 && !mem_bd.pending.load(std::memory_order_acquire);
 }
 
 void Testbench::ioemul(void)
@@ -258,6 +635,9 @@ void Testbench::ioemul(void)
 
 	work = io_poll_work();
 
+	if (mem_bd.pending.load(std::memory_order_acquire))
+		io_mem_backdoor();
+
 	//////////////////////////////////////////////////////////////////////
 	// UART TX
 	/* Look for console UART stuff */
@@ -265,15 +645,27 @@ void Testbench::ioemul(void)
 		/* The verilog connects consume strobe to has_data, so this is present for
 		 * just one cycle.
 		 */
-		printf("%c", m_core->tb_top->MR->CONSOLE_UART->next_tx_byte);
-		if (uart_skt != -1)
-			write(uart_skt,
-			      &m_core->tb_top->MR->CONSOLE_UART->next_tx_byte, 1);
+		uint8_t d = m_core->tb_top->MR->CONSOLE_UART->next_tx_byte;
+		io_tx_byte(&uart_txb, d);
+		io_console_tx_bytes++;
+
+		if (io_exit_string) {
+			if (d != io_exit_string[io_exit_match])
+				io_exit_match = 0;
+			if (d == io_exit_string[io_exit_match] &&
+			    io_exit_string[++io_exit_match] == '\0') {
+				printf("\n[Exit string seen at cycle %lu]\n", m_tickcount);
+				Verilated::gotFinish(true);
+				io_exit_match = 0;
+			}
+		}
+	} else if (uart_txb.len &&
+		   m_tickcount - uart_txb.last_tick >= io_tx_idle_cycles) {
+		io_tx_flush(&uart_txb);
 	}
 
 	//////////////////////////////////////////////////////////////////////
 	// UART RX
-	int wait = 0;
 	// Ther's a data readable; write it if the FIFO's okay with that:
 	if (work & IO_WORK_UART &&
 	    m_core->tb_top->MR->CONSOLE_UART->rx_has_space) {
@@ -287,9 +679,10 @@ void Testbench::ioemul(void)
 	// DBG TX
 	if (m_core->tb_top->dbg_tx_has_data) { // Stuff to TX
 		/* Verilog connects tx_consume to tx_has_data, so this condition is present for one cycle */
-		if (dbg_skt != -1) {
-			write(dbg_skt, &m_core->tb_top->dbg_tx_data, 1);
-		}
+		io_tx_byte(&dbg_txb, m_core->tb_top->dbg_tx_data);
+	} else if (dbg_txb.len &&
+		   m_tickcount - dbg_txb.last_tick >= io_tx_idle_cycles) {
+		io_tx_flush(&dbg_txb);
 	}
 
 	// DBG RX
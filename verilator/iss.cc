@@ -0,0 +1,297 @@
+/* MR-sys verilated sim glue to MR-ISS
+ *
+ * Copyright 2020-2022 Matt Evans
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "testbench.h"
+#include "arch_state.h"
+#include "iss.h"
+
+#if defined(CHECKER) || defined(HYBRID)
+
+/* Everything here depends on MR-ISS's API, of which this uses:
+ *
+ * PPCCPUState	get/set of GPR(n), PC, MSR, CR, XER, LR, CTR, SPRG0-3,
+ *		SRR0/1, DAR, DSISR, DEC, TB
+ * PPCInterpreter
+ *		setCPUState(), setMMU(), setPCInst(), decode(inst), and
+ *		read_data, which a load returns in the checker build
+ *		(libiss.a with DUMMY_MEM_ACCESS=1, not accessing memory)
+ *
+ * The rest isn't in MR-ISS yet, so is only used in an ISS_EXT_API build:
+ *
+ * PPCCPUState	get/set of SPR(n) for SDR1/BATs, and SR(n).  Without
+ *		them, those are kept here as last set, and the checker
+ *		doesn't compare them.
+ * PPCInterpreter
+ *		write_addr/write_data/write_size, capturing a store in the
+ *		checker build.  Without them, stores aren't checked.
+ *
+ * The hybrid build (libiss.a with memory, and ISS_EXT_API) uses:
+ * PPCMMU	addRAM(pa, host ptr, size), and setIOHandler(fn), where fn is
+ *		called for a physical access outside RAM before it's made,
+ *		and returns false to refuse it
+ * PPCInterpreter
+ *		step(), fetching, executing and taking exceptions (including
+ *		DEC) for one instruction, returning false without changing
+ *		any state if an access was refused
+ *
+ * The ISS calls lprintf() and sim_quit(), provided here.
+ */
+
+#include "MR-ISS/PPCCPUState.h"
+#ifdef CHECKER
+#define DUMMY_MEM_ACCESS 1
+#endif
+#include "MR-ISS/PPCInterpreter.h"
+#include "MR-ISS/PPCMMU.h"
+
+#define SPR_SDR1	25
+#define SPR_IBAT0U	528
+#define SPR_DBAT0U	536
+
+uint32_t log_enables_mask = 0;
+static PPCCPUState pcs;
+static PPCInterpreter interp;
+static PPCMMU mmu;
+
+#ifndef ISS_EXT_API
+/* SDR1, BATs and SRs as last set, as they can't be read from MR-ISS */
+static arch_regs_t iss_unreadable;
+#endif
+
+void	iss_init(uint32_t log_flags)
+{
+        interp.setCPUState(&pcs);
+        interp.setMMU(&mmu);
+
+        log_enables_mask = log_flags;
+}
+
+void	iss_get_regs(arch_regs_t *r)
+{
+	for (int i = 0; i < 32; i++)
+		r->gpr[i] = pcs.getGPR(i);
+	r->pc = pcs.getPC();
+	r->msr = pcs.getMSR();
+	r->cr = pcs.getCR();
+	r->xer = pcs.getXER();
+	r->lr = pcs.getLR();
+	r->ctr = pcs.getCTR();
+	r->sprg[0] = pcs.getSPRG0();
+	r->sprg[1] = pcs.getSPRG1();
+	r->sprg[2] = pcs.getSPRG2();
+	r->sprg[3] = pcs.getSPRG3();
+	r->srr0 = pcs.getSRR0();
+	r->srr1 = pcs.getSRR1();
+	r->dar = pcs.getDAR();
+	r->dsisr = pcs.getDSISR();
+	r->dec = pcs.getDEC();
+	r->tb = pcs.getTB();
+#ifdef ISS_EXT_API
+	r->sdr1 = pcs.getSPR(SPR_SDR1);
+	for (int i = 0; i < 8; i++) {
+		r->ibat[i] = pcs.getSPR(SPR_IBAT0U + i);
+		r->dbat[i] = pcs.getSPR(SPR_DBAT0U + i);
+	}
+	for (int i = 0; i < 16; i++)
+		r->sr[i] = pcs.getSR(i);
+#else
+	r->sdr1 = iss_unreadable.sdr1;
+	memcpy(r->ibat, iss_unreadable.ibat, sizeof(r->ibat));
+	memcpy(r->dbat, iss_unreadable.dbat, sizeof(r->dbat));
+	memcpy(r->sr, iss_unreadable.sr, sizeof(r->sr));
+#endif
+}
+
+void	iss_set_regs(const arch_regs_t *r)
+{
+	for (int i = 0; i < 32; i++)
+		pcs.setGPR(i, r->gpr[i]);
+	pcs.setPC(r->pc);
+	pcs.setMSR(r->msr);
+	pcs.setCTR(r->ctr);
+	pcs.setLR(r->lr);
+	pcs.setXER(r->xer);
+	pcs.setCR(r->cr);
+	pcs.setSPRG0(r->sprg[0]);
+	pcs.setSPRG1(r->sprg[1]);
+	pcs.setSPRG2(r->sprg[2]);
+	pcs.setSPRG3(r->sprg[3]);
+	pcs.setSRR0(r->srr0);
+	pcs.setSRR1(r->srr1);
+	pcs.setDAR(r->dar);
+	pcs.setDSISR(r->dsisr);
+	pcs.setDEC(r->dec);
+	pcs.setTB(r->tb);
+#ifdef ISS_EXT_API
+	pcs.setSPR(SPR_SDR1, r->sdr1);
+	for (int i = 0; i < 8; i++) {
+		pcs.setSPR(SPR_IBAT0U + i, r->ibat[i]);
+		pcs.setSPR(SPR_DBAT0U + i, r->dbat[i]);
+	}
+	for (int i = 0; i < 16; i++)
+		pcs.setSR(i, r->sr[i]);
+#else
+	iss_unreadable = *r;
+#endif
+}
+
+uint32_t	iss_get_pc(void)		{ return pcs.getPC(); }
+void		iss_set_pc(uint32_t v)		{ pcs.setPC(v); }
+uint32_t	iss_get_msr(void)		{ return pcs.getMSR(); }
+void		iss_set_msr(uint32_t v)		{ pcs.setMSR(v); }
+uint32_t	iss_get_gpr(int n)		{ return pcs.getGPR(n); }
+void		iss_set_gpr(int n, uint32_t v)	{ pcs.setGPR(n, v); }
+uint32_t	iss_get_cr(void)		{ return pcs.getCR(); }
+void		iss_set_cr(uint32_t v)		{ pcs.setCR(v); }
+uint32_t	iss_get_xer(void)		{ return pcs.getXER(); }
+void		iss_set_xer(uint32_t v)		{ pcs.setXER(v); }
+
+void	iss_set_timers(uint32_t dec, uint64_t tb)
+{
+	pcs.setDEC(dec);
+	pcs.setTB(tb);
+}
+
+#ifdef CHECKER
+void	iss_exec(uint32_t pc, uint32_t inst, uint64_t load_data, iss_store_t *st)
+{
+	interp.read_data = load_data;
+#ifdef ISS_EXT_API
+	interp.write_size = 0;
+#endif
+
+	interp.setPCInst(pc, inst); // For interpreter's disassembler
+	interp.decode(inst);
+
+#ifdef ISS_EXT_API
+	st->size = interp.write_size;
+	st->addr = interp.write_addr;
+	st->data = interp.write_data;
+#else
+	st->size = 0;
+#endif
+}
+#endif
+
+#ifdef HYBRID
+#ifndef ISS_EXT_API
+#error "Hybrid execution needs MR-ISS's step/RAM/IO API (ISS_EXT_API)"
+#endif
+
+#define ISS_MAX_RAM	4
+#define MSR_IR		0x20
+
+static bool iss_quit = false;
+static uint32_t io_hit_pa;
+static struct {
+	uint32_t	pa;
+	uint64_t	size;
+} iss_ram[ISS_MAX_RAM];
+static int iss_ram_num = 0;
+
+/* An access outside RAM is refused, so the instruction has no effect, for
+ * the model to run it instead.
+ */
+static bool	iss_io(uint32_t pa, int size, bool write, uint64_t *val)
+{
+	io_hit_pa = pa;
+	return false;
+}
+
+static bool	iss_in_ram(uint32_t pa)
+{
+	for (int i = 0; i < iss_ram_num; i++) {
+		if (pa >= iss_ram[i].pa && pa - iss_ram[i].pa < iss_ram[i].size)
+			return true;
+	}
+	return false;
+}
+
+void	iss_add_ram(uint32_t pa, uint8_t *mem, uint64_t size)
+{
+	if (iss_ram_num < ISS_MAX_RAM) {
+		iss_ram[iss_ram_num].pa = pa;
+		iss_ram[iss_ram_num].size = size;
+		iss_ram_num++;
+	}
+	mmu.addRAM(pa, mem, size);
+	mmu.setIOHandler(iss_io);
+}
+
+int	iss_run(uint64_t max, uint32_t stop_pc, uint64_t *executed, uint32_t *io_pa)
+{
+	uint64_t n = 0;
+	int why = ISS_STOP_COUNT;
+
+	iss_quit = false;
+	while (n < max) {
+		uint32_t pc = pcs.getPC();
+
+		if (n && pc == stop_pc) {
+			why = ISS_STOP_PC;
+			break;
+		}
+		/* An untranslated fetch from outside RAM is IO too, and
+		 * can be seen without trying it:
+		 */
+		if (!(pcs.getMSR() & MSR_IR) && !iss_in_ram(pc)) {
+			*io_pa = pc;
+			why = ISS_STOP_IO;
+			break;
+		}
+		if (!interp.step()) {
+			*io_pa = io_hit_pa;
+			why = ISS_STOP_IO;
+			break;
+		}
+		n++;
+		if (iss_quit) {
+			why = ISS_STOP_QUIT;
+			break;
+		}
+	}
+	*executed = n;
+	return why;
+}
+#endif
+
+/* Misc support for MR-ISS junk */
+
+int     lprintf(const char *format, ...)
+{
+        va_list va;
+        va_start(va, format);
+        vfprintf(stderr, format, va);
+        va_end(va);
+        return 0;
+}
+
+void    sim_quit(void)
+{
+        printf("Quitty quit quit\n");
+#ifdef HYBRID
+	iss_quit = true;
+#endif
+}
+
+#endif
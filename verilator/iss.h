@@ -0,0 +1,70 @@
+/*
+ * Copyright 2020-2022 Matt Evans
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISS_H
+#define ISS_H
+
+/* MR-ISS, as used by the checker and hybrid execution.  Only iss.cc
+ * includes MR-ISS headers.  Needs arch_state.h first.
+ */
+
+#if defined(CHECKER) || defined(HYBRID)
+
+void		iss_init(uint32_t log_flags);
+
+void		iss_get_regs(arch_regs_t *r);
+void		iss_set_regs(const arch_regs_t *r);
+
+uint32_t	iss_get_pc(void);
+void		iss_set_pc(uint32_t v);
+uint32_t	iss_get_msr(void);
+void		iss_set_msr(uint32_t v);
+uint32_t	iss_get_gpr(int n);
+void		iss_set_gpr(int n, uint32_t v);
+uint32_t	iss_get_cr(void);
+void		iss_set_cr(uint32_t v);
+uint32_t	iss_get_xer(void);
+void		iss_set_xer(uint32_t v);
+void		iss_set_timers(uint32_t dec, uint64_t tb);
+#endif
+
+#ifdef CHECKER
+typedef struct {
+	uint32_t	addr;		// EA
+	int		size;		// 0 if no store
+	uint64_t	data;
+} iss_store_t;
+
+/* Executes one instruction, given the data any load returns; a store is
+ * captured (in an ISS_EXT_API build; otherwise st->size is 0), not performed.
+ */
+void		iss_exec(uint32_t pc, uint32_t inst, uint64_t load_data, iss_store_t *st);
+#endif
+
+#ifdef HYBRID
+enum { ISS_STOP_COUNT = 0, ISS_STOP_PC, ISS_STOP_IO, ISS_STOP_QUIT };
+
+/* Physical RAM for the ISS, shared (not copied) */
+void		iss_add_ram(uint32_t pa, uint8_t *mem, uint64_t size);
+
+/* Runs until max instructions (or stop_pc, after the first), or an access
+ * (including a fetch) outside RAM: that instruction is refused before it
+ * changes anything, and the access's PA is in *io_pa.  Returns ISS_STOP_*.
+ */
+int		iss_run(uint64_t max, uint32_t stop_pc, uint64_t *executed, uint32_t *io_pa);
+#endif
+
+#endif
@@ -22,9 +22,28 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <time.h>
+#include <getopt.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
 
 #include "testbench.h"
 #include "arch_state.h"
+#include "cpu_signals.h"
+#include "checkpoint.h"
+#include "forksrv.h"
+#include "monitor.h"
+#include "window.h"
+#include "probe.h"
+#include "profile.h"
+#include "cpistack.h"
+#include "micmon.h"
+#include "cachestats.h"
+#include "imix.h"
+#include "status.h"
+#include "idle.h"
+#ifdef HYBRID
+#include "hybrid.h"
+#endif
 
 /* Globals */
 Testbench *tb = 0;
@@ -33,11 +52,78 @@ volatile uint64_t current_limit = 0;
 volatile int sig_request = 0;
 #define SR_DUMP_REGS	1
 #define SR_SAVE_STATE	2
+#define SR_PROFILE	4
+#define SR_STATUS	8
+
+/* Long-only options */
+#define OPT_FORK_SERVER		0x100
+#define OPT_NO_IO		0x101
+#define OPT_PROBE_FILE		0x102
+#define OPT_PROBE_PORT		0x103
+#define OPT_CHECK_FROM		0x104
+#define OPT_CHECK_TO		0x105
+#define OPT_TRACE_DEPTH		0x106
+#define OPT_TRACE_SCOPE		0x107
+#define OPT_TRACE_ROLLOVER	0x108
+#define OPT_TRACE_FLUSH		0x109
+#define OPT_WINDOW_INTERVAL	0x10a
+#define OPT_PROFILE		0x10b
+#define OPT_PROFILE_SYMS	0x10c
+#define OPT_PROFILE_OUT		0x10d
+#define OPT_PROFILE_TOP		0x10e
+#define OPT_CPI			0x10f
+#define OPT_CPI_REGION		0x110
+#define OPT_CPI_OUT		0x111
+#define OPT_MIC			0x112
+#define OPT_MIC_INTERVAL	0x113
+#define OPT_CACHE_STATS		0x114
+#define OPT_CACHE_INTERVAL	0x115
+#define OPT_CACHE_OUT		0x116
+#define OPT_IMIX		0x117
+#define OPT_IMIX_OUT		0x118
+#define OPT_STATUS		0x119
+#define OPT_STATS_SHM		0x11a
+#define OPT_CHECK_FULL		0x11b
+#define OPT_CHECK_MEM		0x11c
+#define OPT_CHECK_HASH		0x11d
+#define OPT_HYBRID_ISS		0x11e
+#define OPT_HYBRID_RTL		0x11f
+#define OPT_HYBRID_BACK		0x120
+#define OPT_HYBRID_IO		0x121
+#define OPT_SAVE_ARCH		0x122
+#define OPT_IDLE_SKIP		0x123
+#define OPT_IDLE_PC		0x124
+#define OPT_IDLE_MAX		0x125
+#define OPT_SAVE_ARCH_SPARSE	0x126
+#define OPT_SAVE_ARCH_PC	0x127
+
 char *save_state_filename = NULL;
 unsigned int save_state_generation = 0;
+int save_state_incremental = 0;
+int save_state_bg = 0;
+uint64_t checkpoint_every = 0;
+extern uint64_t io_tx_idle_cycles;
+extern char *io_exit_string;
+extern int io_console_port;
+extern int io_debug_port;
+extern int io_mem_bd_port;
+extern int io_console_fd;
+extern uint64_t io_console_tx_dropped;
 
-extern void checker(Testbench *tb);
-extern void checker_init(Testbench *tb, uint32_t log_flags);
+/* Run-time features, see run() */
+int io_enabled = 1;
+#ifdef CHECKER
+uint64_t check_from = 0;
+uint64_t check_to = ~0ULL;
+#else
+uint64_t check_from = ~0ULL;
+uint64_t check_to = ~0ULL;
+#endif
+
+monitor_t monitors[MAX_MONITORS];
+int monitors_num = 0;
+monitor_jump_fn_t monitor_jumps[MAX_MONITORS];
+int monitor_jumps_num = 0;
 
 double sc_time_stamp ()
 {
@@ -49,16 +135,71 @@ static void print_help(char *nom)
 	fprintf(stderr, "Syntax:\n\t%s [options]\n\nOptions:\n"
 		"\t-t <VCD filename>\n"
 		"\t-T <trace from cycle N>\n"
+		"\t--trace-depth <N>\tLevels of hierarchy to trace\n"
+		"\t--trace-scope <tb_top.MR.X>\n\t\tOnly trace this subtree (repeatable)\n"
+		"\t--trace-rollover <MB>\tStart a new VCD file every MB\n"
+		"\t--trace-flush <N>\tFlush the trace every N cycles\n"
+		"\t-W start=<trig>[,stop=<trig>][,pre=N][,len=N][,count=N][,file=F]\n"
+		"\t\tTrace a window, triggered by pc:A, fault[:N], uart:S or cycle:N\n"
+		"\t--window-interval <N>\n\t\tSnapshot every N cycles, for windows' pre-trigger history\n"
 		"\t-s <int32 DIP value>\n"
 		"\t-i <initial string to send to console>\n"
 		"\t-l <cycle count limit>\n"
 		"\t-p <initial PC override>\n"
 		"\t-S <state save filename>\n"
 		"\t-x \tSave state at exit\n"
+		"\t-I \tSave incremental/compressed checkpoints\n"
+		"\t-a \tSave state asynchronously (in a forked child)\n"
+		"\t-c, --checkpoint-every <N>\n\t\tSave state in the background every N cycles\n"
+		"\t--fork-server <port>\n\t\tAfter reset/restore, fork a run per request on <port>\n"
+		"\t--no-io \tDon't emulate console/debug/backdoor I/O\n"
+		"\t-P <probe,probe...>\tEnable event probes (branch, syscall, exception, rfi,\n"
+		"\t\tmmu_fault, irq, uart_tx, all)\n"
+		"\t--probe-file <file>\tWrite probe events here (default probes.bin)\n"
+		"\t--probe-port <port>\tControl socket for enabling/disabling probes\n"
+		"\t--profile <N>\tSample the committed PC every N cycles (SIGHUP reports)\n"
+		"\t--profile-syms <file>\n\t\tSymbols for the profile: System.map or ELF (repeatable)\n"
+		"\t--profile-out <file>\tWrite folded profile here (default profile.folded)\n"
+		"\t--profile-top <N>\tShow the top N profile entries (default 30)\n"
+		"\t--cpi\t\tAttribute each cycle to a commit or a stall cause (CPI stack)\n"
+		"\t--cpi-region <size>\tCPI per PC region of this size (default 64K)\n"
+		"\t--cpi-out <file>\tWrite per-region CPI counts here (default cpi.csv)\n"
+		"\t--mic\t\tMonitor MIC ports: traffic, backpressure, latency histograms\n"
+		"\t--mic-interval <N>\tAlso report MIC port utilisation every N cycles\n"
+		"\t--cache-stats\tCount cache/TLB misses and writebacks, from CPU MIC traffic\n"
+		"\t--cache-stats-interval <N>\n\t\tAlso write the counts every N cycles, as a time series\n"
+		"\t--cache-stats-out <file>\n\t\tTime series file, CSV or .json (default cachestats.csv)\n"
+		"\t--imix\t\tInstruction mix/opcode coverage of committed instructions\n"
+		"\t--imix-out <file>\tAlso write the instruction mix as CSV\n"
+		"\t--status <secs>\tPrint a status line (speed, IPC, UART bytes) every <secs>\n"
+		"\t--stats-shm <name>\tPublish live stats/perf counters in /dev/shm/<name>\n"
+		"\t--idle-skip\tJump TB/DEC and time forward when the CPU's idling (tight\n\t\tself-branch) and the system's quiet, to just before the DEC fires\n"
+		"\t--idle-pc <lo>-<hi>\n\t\tAlso treat PCs in [lo, hi] as idle (implies --idle-skip)\n"
+		"\t--idle-max <N>\tSkip at most N cycles at a time (default 1000000)\n"
 		"\t-R <restore file>\n"
 		"\t-A <restore arch state file>\n"
+		"\t--save-arch <file>\tSave arch state (for -A, or MR-ISS) at exit\n"
+		"\t--save-arch-sparse\tElide zero pages, and page-align memory for -A to map\n"
+		"\t\t(not readable by MR-ISS)\n"
+		"\t--save-arch-pc <addr>\tSave it (and exit) when the instruction at addr\n"
+		"\t\tcommits, e.g. after software's cleaned the D-cache\n"
+		"\t-b <flush console/debug output after N idle cycles>\n"
+		"\t-e <string>\tFinish when the console outputs <string>\n"
+		"\t-J <file>\tWrite run statistics (speed, IPC, RSS) as JSON\n"
 #ifdef CHECKER
                 "\t-F <checker log flags>\n"
+		"\t--check-from <N>, --check-to <N>\n\t\tOnly run the checker for cycles [N, M)\n"
+		"\t--check-full\tAlso check MSR, stores, and SPR/SR/BAT state after SPR writes\n"
+#ifdef CPU_INTERNALS
+		"\t--check-mem\tCheck load data against a shadow memory of committed stores\n"
+#endif
+		"\t--check-hash <N>\tCompare state hashes every N instructions (replaying to\n\t\tfind the instruction on a mismatch) instead of every instruction\n"
+#endif
+#ifdef HYBRID
+		"\t--hybrid-iss <trigger>\n\t\tSwitch from RTL to MR-ISS at trigger (default start)\n"
+		"\t--hybrid-rtl <trigger>\n\t\tSwitch from MR-ISS to RTL at trigger (pc:, instrs:, uart:)\n"
+		"\t--hybrid-back <trigger>\n\t\tThen switch back to MR-ISS at trigger (pc:, instrs:, cycle:, uart:)\n"
+		"\t--hybrid-io-cycles <N>\n\t\tRTL cycles to run for an IO access from MR-ISS (default 10000)\n"
 #endif
                 "\t-X <uninitialised random seed>\n"
 		"\n",
@@ -77,6 +218,12 @@ static void	sighandler(int sig)
 	} else if (sig == SIGUSR2) {
 		sig_request |= SR_SAVE_STATE;
 		current_limit = 0;
+	} else if (sig == SIGHUP) {
+		sig_request |= SR_PROFILE;
+		current_limit = 0;
+	} else if (sig == SIGALRM) {
+		sig_request |= SR_STATUS;
+		current_limit = 0;
 	}
 }
 
@@ -84,6 +231,8 @@ static void 	setup_sighandlers(void)
 {
 	signal(SIGUSR1, sighandler);
 	signal(SIGUSR2, sighandler);
+	signal(SIGHUP, sighandler);
+	signal(SIGALRM, sighandler);
 }
 
 static void 	dump_regs(Testbench *tb)
@@ -117,38 +266,159 @@ static void 	dump_regs(Testbench *tb)
 	// Other stats here.
 }
 
+/* Returns 0 on success */
+static int	save_state_to(Testbench *tb, const char *filename)
+{
+	printf("Saving state to '%s': ", filename);
+
+	if (save_state_incremental) {
+		if (ckpt_save(tb, filename) == 0) {
+			printf("State save success\n");
+			return 0;
+		}
+		printf("State save FAILED\n");
+		return -1;
+	}
+
+#ifdef SAVABLE
+	VerilatedSave vs;
+
+	vs.open(filename);
+	if (!vs.isOpen()) {
+		printf("State save FAILED (can't open file)\n");
+		return -1;
+	}
+	vs << *tb->getTop();
+
+	vs.flush();
+	vs.close(); // ??
+	printf("State save success\n");
+	return 0;
+#else
+	printf("State save FAILED (built with SAVABLE=0)\n");
+	return -1;
+#endif
+}
+
+static void	save_state_next_name(char *filename)
+{
+	/* An incremental save can't overwrite one of its own ancestors,
+	 * e.g. the restored sim_dump.bin, so skip past those names:
+	 */
+	do {
+		if (save_state_generation == 0)
+			strncpy(filename, save_state_filename, PATH_MAX);
+		else
+			snprintf(filename, PATH_MAX, "%s.%d", save_state_filename, save_state_generation);
+		save_state_generation++;
+	} while (save_state_incremental && ckpt_in_chain(filename));
+}
+
 static void	save_state(Testbench *tb)
 {
 	char filename[PATH_MAX];
 
 	dump_regs(tb);
 
-	if (save_state_generation == 0)
-		strncpy(filename, save_state_filename, PATH_MAX);
-	else
-		snprintf(filename, PATH_MAX, "%s.%d", save_state_filename, save_state_generation);
-	save_state_generation++;
+	save_state_next_name(filename);
+	save_state_to(tb, filename);
+}
 
-	printf("Saving state to '%s': ", filename);
+/* Asynchronous saves fork(), and the child saves its copy-on-write image of
+ * the model while the parent carries on simulating.
+ */
+#define MAX_ASYNC_SAVES	4
 
-	VerilatedSave vs;
+static struct {
+	pid_t		pid;
+	unsigned int	generation;
+	char		*filename;
+} async_saves[MAX_ASYNC_SAVES];
+static int async_saves_num = 0;
+static unsigned int async_saves_adopted = 0;
 
-	vs.open(filename);
-	if (!vs.isOpen()) {
-		printf("State save FAILED (can't open file)\n");
-	} else {
-		vs << *tb->getTop();
+static void	save_state_reap(bool block)
+{
+	for (int i = 0; i < async_saves_num; ) {
+		int status;
+		pid_t r = waitpid(async_saves[i].pid, &status, block ? 0 : WNOHANG);
+
+		if (r == 0) {
+			i++;
+			continue;
+		}
+		if (r > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+			printf("[Background save to '%s' complete]\n",
+			       async_saves[i].filename);
+			/* The parent didn't see which pages the child wrote,
+			 * so pick them up from the file for the next save:
+			 */
+			if (save_state_incremental &&
+			    async_saves[i].generation >= async_saves_adopted) {
+				ckpt_adopt(async_saves[i].filename);
+				async_saves_adopted = async_saves[i].generation;
+			}
+		} else {
+			/* Not adopted: the next incremental save still
+			 * builds on the last good one
+			 */
+			printf("[Background save to '%s' FAILED]\n",
+			       async_saves[i].filename);
+		}
+		free(async_saves[i].filename);
+		async_saves[i] = async_saves[--async_saves_num];
+	}
+}
+
+static void	save_state_async(Testbench *tb)
+{
+	char filename[PATH_MAX];
+
+	while (async_saves_num == MAX_ASYNC_SAVES) {
+		save_state_reap(true);
+	}
 
-		vs.flush();
-		vs.close(); // ??
-		printf("State save success\n");
+	unsigned int gen = save_state_generation;
+	save_state_next_name(filename);
+
+	fflush(stdout);
+	fflush(stderr);
+	pid_t pid = fork();
+	if (pid == 0) {
+		/* Child: just the sim thread, with a snapshot of its state.
+		 * The exit status tells save_state_reap() whether to adopt it.
+		 */
+		int r = save_state_to(tb, filename);
+		fflush(stdout);
+		_exit(r == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+	} else if (pid < 0) {
+		printf("Can't fork for background save (errno %d), saving now\n", errno);
+		save_state_to(tb, filename);
+		return;
 	}
+	printf("[Cycle %ld: saving state to '%s' in background (pid %d)]\n",
+	       tb->get_tickcount(), filename, pid);
+
+	async_saves[async_saves_num].pid = pid;
+	async_saves[async_saves_num].generation = gen;
+	async_saves[async_saves_num].filename = strdup(filename);
+	async_saves_num++;
 }
 
 static void	restore_state(Testbench *tb, char *filename)
 {
 	printf("Restoring state from '%s': ", filename);
 
+	if (ckpt_is_incremental(filename)) {
+		if (ckpt_restore(tb, filename) == 0)
+			printf("State restore success\n");
+		else
+			printf("State restore FAILED\n");
+		dump_regs(tb);
+		return;
+	}
+
+#ifdef SAVABLE
 	VerilatedRestore vl;
 
 	vl.open(filename);
@@ -162,6 +432,9 @@ static void	restore_state(Testbench *tb, char *filename)
 		vl.close();
 		printf("State restore success\n");
 	}
+#else
+	printf("State restore FAILED (built with SAVABLE=0)\n");
+#endif
 
 	dump_regs(tb);
 }
@@ -189,6 +462,202 @@ static void	restore_arch_state(Testbench *tb, char *filename)
 	close(fd);
 }
 
+/* <name>.<pid>, for a fork server child's outputs (malloc()ed) */
+static char	*pid_name(const char *name)
+{
+	size_t len = strlen(name) + 16;
+	char *n = (char *)malloc(len);
+
+	snprintf(n, len, "%s.%d", name, getpid());
+	return n;
+}
+
+#define ARCH_SAVE_MAX_CYCLES	100000
+
+static cpu_mic_t save_arch_mic;
+static uint32_t save_arch_pc;
+static bool save_arch_at_pc = false;
+static bool save_arch_reached = false;
+
+/* With --save-arch, tracks the CPU's MIC requests, and stops the run at
+ * --save-arch-pc
+ */
+static void	save_arch_monitor(Testbench *tb, void *arg)
+{
+	auto *c = CPU(tb);
+
+	cpu_mic_track(tb, &save_arch_mic);
+	if (save_arch_at_pc && CPU_COMMIT(c) && CPU_MEM_PC(c) == save_arch_pc) {
+		save_arch_reached = true;
+		current_limit = 0;
+	}
+}
+
+/* The state from before a committing instruction is consistent if the
+ * instruction doesn't access memory, and no MIC request (e.g. a writeback)
+ * is outstanding
+ */
+static bool	save_arch_quiet(Testbench *tb)
+{
+	auto *c = CPU(tb);
+
+	return CPU_COMMIT(c) && !imix_is_memop(CPU_MEM_INSTR(c)) &&
+		!save_arch_mic.outstanding;
+}
+
+/* Runs on to a save_arch_quiet() commit first.  The file's written under a
+ * temporary name and renamed, because a restore maps the file into RAM
+ * (which might be this file).
+ */
+static void	save_arch_state(Testbench *tb, char *filename, bool sparse)
+{
+	char tmpname[PATH_MAX];
+	uint64_t limit = tb->get_tickcount() + ARCH_SAVE_MAX_CYCLES;
+	int fd, r;
+
+	while (!save_arch_quiet(tb)) {
+		if (tb->done() || tb->get_tickcount() >= limit) {
+			printf("Arch state save FAILED (no instruction to save at)\n");
+			return;
+		}
+		tb->tick();
+		cpu_mic_track(tb, &save_arch_mic);
+	}
+
+	snprintf(tmpname, PATH_MAX, "%s.tmp", filename);
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		printf("Can't open state file '%s' (errno %d)\n",
+		       tmpname, errno);
+		return;
+	}
+	r = tb_save_arch_state(fd, tb, sparse);
+	close(fd);
+
+	if (r || rename(tmpname, filename) != 0) {
+		printf("Arch state save FAILED\n");
+		unlink(tmpname);
+		return;
+	}
+	printf("Saved arch state to '%s' at cycle %lu, PC %08x\n", filename,
+	       tb->get_tickcount(), CPU_MEM_PC(CPU(tb)));
+#ifndef CPU_INTERNALS
+	printf("(Memory is RAM's: anything dirty in the D-cache isn't included, so save "
+	       "after software's cleaned it, with --save-arch-pc)\n");
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Run loop
+//
+// The loop is instantiated for each combination of Testbench::FEAT_* bits,
+// and run() splits the run into segments with a constant set of features
+// (trace on from cycle N, checker window, etc.).  With nothing enabled, a
+// segment is just eval()s.
+
+template <unsigned int F>
+static void	run_segment(Testbench *tb, uint64_t end)
+{
+	/* current_limit can drop to 0 under our feet (signals) */
+	while (!tb->done() && tb->get_tickcount() < end &&
+	       tb->get_tickcount() < current_limit) {
+		tb->tick_f<F>();
+#ifdef CHECKER
+		if (F & Testbench::FEAT_CHECKER)
+			checker(tb);
+#endif
+		if (F & Testbench::FEAT_MON)
+			monitors_run(tb);
+	}
+}
+
+typedef void (*run_segment_fn_t)(Testbench *tb, uint64_t end);
+
+static const run_segment_fn_t run_segment_fns[Testbench::FEAT_ALL + 1] = {
+	run_segment<0>,  run_segment<1>,  run_segment<2>,  run_segment<3>,
+	run_segment<4>,  run_segment<5>,  run_segment<6>,  run_segment<7>,
+	run_segment<8>,  run_segment<9>,  run_segment<10>, run_segment<11>,
+	run_segment<12>, run_segment<13>, run_segment<14>, run_segment<15>,
+};
+
+/* Features in effect for a segment starting at (just after) cycle t, and
+ * the cycle at which that changes in *end.
+ */
+static unsigned int	run_features(Testbench *tb, uint64_t t, uint64_t *end)
+{
+	unsigned int f = 0;
+	uint64_t e = ~0ULL;
+	/* tick_f<> traces the cycle it's counting up to: */
+	uint64_t trace_from = tb->trace_start();
+	if (trace_from != ~0ULL && trace_from > 0)
+		trace_from--;
+
+	if (t >= trace_from)
+		f |= Testbench::FEAT_TRACE;
+	else
+		e = trace_from;
+
+	if (io_enabled)
+		f |= Testbench::FEAT_IO;
+
+	if (t >= check_from && t < check_to) {
+		f |= Testbench::FEAT_CHECKER;
+		if (check_to < e)
+			e = check_to;
+	} else if (t < check_from && check_from < e) {
+		e = check_from;
+	}
+
+	if (monitors_num)
+		f |= Testbench::FEAT_MON;
+
+	*end = e;
+	return f;
+}
+
+/* Run until current_limit (or a signal, or $finish) */
+static void	run(Testbench *tb)
+{
+	while (!tb->done() && tb->get_tickcount() < current_limit) {
+		uint64_t end;
+		unsigned int f = run_features(tb, tb->get_tickcount(), &end);
+
+		run_segment_fns[f](tb, end);
+	}
+}
+
+/* Statistics for this run (i.e. since any restore), for tools/sim_bench.py */
+static void	write_stats(Testbench *tb, const char *filename, double host_secs,
+			    uint64_t cycles, uint32_t instrs)
+{
+	struct rusage ru;
+	FILE *f = fopen(filename, "w");
+
+	if (!f) {
+		fprintf(stderr, "Can't open stats file '%s'\n", filename);
+		return;
+	}
+	getrusage(RUSAGE_SELF, &ru);
+
+	fprintf(f, "{\n"
+		"  \"cycles\": %lu,\n"
+		"  \"instructions\": %u,\n"
+		"  \"host_seconds\": %.6f,\n"
+		"  \"cycles_per_sec\": %.1f,\n"
+		"  \"mips\": %.4f,\n"
+		"  \"ipc\": %.4f,\n"
+		"  \"peak_rss_kb\": %ld,\n"
+		"  \"finished\": %s\n"
+		"}\n",
+		cycles, instrs, host_secs,
+		host_secs > 0 ? cycles / host_secs : 0.0,
+		host_secs > 0 ? instrs / host_secs / 1e6 : 0.0,
+		cycles ? (double)instrs / cycles : 0.0,
+		ru.ru_maxrss,
+		tb->done() ? "true" : "false");
+	fclose(f);
+}
+
 int main(int argc, char **argv)
 {
 	char *exe_name = argv[0];
@@ -200,29 +669,83 @@ int main(int argc, char **argv)
 	uint32_t override_pc_val;
 	char *restore_fname = NULL;
 	char *restore_arch_fname = NULL;
+	char *save_arch_fname = NULL;
+	bool save_arch_sparse = false;
 	int save_at_exit = 0;
 #ifdef CHECKER
         uint32_t checker_log_flags = 0;
 #endif
         uint64_t random_seed = time(NULL);
+	int fork_server_port = 0;
+	char *trace_fname = NULL;
+	char *stats_fname = NULL;
+	fork_req_t fork_req;
 
 	save_state_filename = strdup("sim_dump.bin");
 
 	Verilated::commandArgs(argc, argv);
 	tb = new Testbench();
 
-	while ((ch = getopt(argc, argv, "t:s:i:l:T:p:R:S:xA:X:"
+	static const struct option long_opts[] = {
+		{ "checkpoint-every",	required_argument,	NULL, 'c' },
+		{ "fork-server",	required_argument,	NULL, OPT_FORK_SERVER },
+		{ "no-io",		no_argument,		NULL, OPT_NO_IO },
+		{ "trace-depth",	required_argument,	NULL, OPT_TRACE_DEPTH },
+		{ "trace-scope",	required_argument,	NULL, OPT_TRACE_SCOPE },
+		{ "trace-rollover",	required_argument,	NULL, OPT_TRACE_ROLLOVER },
+		{ "trace-flush",	required_argument,	NULL, OPT_TRACE_FLUSH },
+		{ "window-interval",	required_argument,	NULL, OPT_WINDOW_INTERVAL },
+		{ "probe-file",		required_argument,	NULL, OPT_PROBE_FILE },
+		{ "probe-port",		required_argument,	NULL, OPT_PROBE_PORT },
+		{ "profile",		required_argument,	NULL, OPT_PROFILE },
+		{ "profile-syms",	required_argument,	NULL, OPT_PROFILE_SYMS },
+		{ "profile-out",	required_argument,	NULL, OPT_PROFILE_OUT },
+		{ "profile-top",	required_argument,	NULL, OPT_PROFILE_TOP },
+		{ "cpi",		no_argument,		NULL, OPT_CPI },
+		{ "cpi-region",		required_argument,	NULL, OPT_CPI_REGION },
+		{ "cpi-out",		required_argument,	NULL, OPT_CPI_OUT },
+		{ "mic",		no_argument,		NULL, OPT_MIC },
+		{ "mic-interval",	required_argument,	NULL, OPT_MIC_INTERVAL },
+		{ "cache-stats",	no_argument,		NULL, OPT_CACHE_STATS },
+		{ "cache-stats-interval", required_argument,	NULL, OPT_CACHE_INTERVAL },
+		{ "cache-stats-out",	required_argument,	NULL, OPT_CACHE_OUT },
+		{ "imix",		no_argument,		NULL, OPT_IMIX },
+		{ "imix-out",		required_argument,	NULL, OPT_IMIX_OUT },
+		{ "status",		required_argument,	NULL, OPT_STATUS },
+		{ "stats-shm",		required_argument,	NULL, OPT_STATS_SHM },
+		{ "save-arch",		required_argument,	NULL, OPT_SAVE_ARCH },
+		{ "save-arch-sparse",	no_argument,		NULL, OPT_SAVE_ARCH_SPARSE },
+		{ "save-arch-pc",	required_argument,	NULL, OPT_SAVE_ARCH_PC },
+		{ "idle-skip",		no_argument,		NULL, OPT_IDLE_SKIP },
+		{ "idle-pc",		required_argument,	NULL, OPT_IDLE_PC },
+		{ "idle-max",		required_argument,	NULL, OPT_IDLE_MAX },
 #ifdef CHECKER
-                            "F:"
+		{ "check-from",		required_argument,	NULL, OPT_CHECK_FROM },
+		{ "check-to",		required_argument,	NULL, OPT_CHECK_TO },
+		{ "check-full",		no_argument,		NULL, OPT_CHECK_FULL },
+#ifdef CPU_INTERNALS
+		{ "check-mem",		no_argument,		NULL, OPT_CHECK_MEM },
+#endif
+		{ "check-hash",		required_argument,	NULL, OPT_CHECK_HASH },
 #endif
-                            "h")) != -1) {
+#ifdef HYBRID
+		{ "hybrid-iss",		required_argument,	NULL, OPT_HYBRID_ISS },
+		{ "hybrid-rtl",		required_argument,	NULL, OPT_HYBRID_RTL },
+		{ "hybrid-back",	required_argument,	NULL, OPT_HYBRID_BACK },
+		{ "hybrid-io-cycles",	required_argument,	NULL, OPT_HYBRID_IO },
+#endif
+		{ NULL, 0, NULL, 0 }
+	};
+
+	while ((ch = getopt_long(argc, argv, "t:s:i:l:T:p:R:S:xIac:A:X:b:e:J:W:P:"
+#ifdef CHECKER
+                                 "F:"
+#endif
+                                 "h", long_opts, NULL)) != -1) {
                 switch (ch) {
                         case 't':
-				printf("Writing VCD trace to %s\n", optarg);
-				// The docs claim using $dumpfile works; I get
-				// an unsupp PLI error.  This enables VCD
-				// output:
-				tb->opentrace(optarg);
+				// Opened after all the trace options are seen
+				trace_fname = strdup(optarg);
                                 break;
 
 			case 'T':
@@ -268,10 +791,66 @@ int main(int argc, char **argv)
 				printf("Saving state at exit\n");
 				break;
 
+			case 'I':
+				save_state_incremental = 1;
+				printf("Saving incremental checkpoints\n");
+				break;
+
+			case 'a':
+				save_state_bg = 1;
+				printf("Saving state in the background\n");
+				break;
+
+			case 'c':
+				checkpoint_every = strtoull(optarg, NULL, 0);
+				printf("Saving state every %lu cycles\n", checkpoint_every);
+				break;
+
 			case 'A':
 				restore_arch_fname = strdup(optarg);
 				printf("Setting arch restore filename to %s\n", restore_arch_fname);
 				break;
+
+			case OPT_SAVE_ARCH:
+				save_arch_fname = strdup(optarg);
+				break;
+
+			case OPT_SAVE_ARCH_SPARSE:
+				save_arch_sparse = true;
+				break;
+
+			case OPT_SAVE_ARCH_PC:
+				save_arch_pc = strtoul(optarg, NULL, 0);
+				save_arch_at_pc = true;
+				break;
+
+
+			case OPT_IDLE_SKIP:
+				idle_enable();
+				break;
+
+			case OPT_IDLE_PC:
+				if (idle_add_pc_range(optarg) != 0)
+					return 1;
+				break;
+
+			case OPT_IDLE_MAX:
+				idle_set_max(strtoull(optarg, NULL, 0));
+				break;
+
+			case 'b':
+				io_tx_idle_cycles = strtoull(optarg, NULL, 0);
+				printf("Flushing output after %lu idle cycles\n", io_tx_idle_cycles);
+				break;
+
+			case 'e':
+				io_exit_string = strdup(optarg);
+				printf("Finishing at console output '%s'\n", io_exit_string);
+				break;
+
+			case 'J':
+				stats_fname = strdup(optarg);
+				break;
 #ifdef CHECKER
 			case 'F':
 				checker_log_flags = strtoull(optarg, NULL, 0);
@@ -281,6 +860,163 @@ int main(int argc, char **argv)
                         case 'X':
                                 random_seed = strtoull(optarg, NULL, 0);
                                 break;
+
+			case OPT_FORK_SERVER:
+				fork_server_port = strtol(optarg, NULL, 0);
+				break;
+
+			case OPT_TRACE_DEPTH:
+				tb->traceDepth(strtol(optarg, NULL, 0));
+				break;
+
+			case OPT_TRACE_SCOPE:
+				printf("Tracing scope %s\n", optarg);
+				tb->traceScope(optarg);
+				break;
+
+			case OPT_TRACE_ROLLOVER:
+				tb->traceRollover(strtoull(optarg, NULL, 0) * 1024 * 1024);
+				break;
+
+			case OPT_TRACE_FLUSH:
+				tb->traceFlushEvery(strtoull(optarg, NULL, 0));
+				break;
+
+			case 'W':
+				if (window_parse(optarg) != 0)
+					return 1;
+				break;
+
+			case OPT_WINDOW_INTERVAL:
+				window_set_interval(strtoull(optarg, NULL, 0));
+				break;
+
+			case OPT_NO_IO:
+				io_enabled = 0;
+				printf("I/O emulation disabled\n");
+				break;
+
+			case 'P':
+				if (probe_enable(optarg) != 0)
+					return 1;
+				break;
+
+			case OPT_PROBE_FILE:
+				probe_set_file(optarg);
+				break;
+
+			case OPT_PROBE_PORT:
+				probe_set_port(strtol(optarg, NULL, 0));
+				break;
+
+			case OPT_PROFILE:
+				profile_set_interval(strtoull(optarg, NULL, 0));
+				break;
+
+			case OPT_PROFILE_SYMS:
+				profile_add_symbols(optarg);
+				break;
+
+			case OPT_PROFILE_OUT:
+				profile_set_output(optarg);
+				break;
+
+			case OPT_PROFILE_TOP:
+				profile_set_top(strtoul(optarg, NULL, 0));
+				break;
+
+			case OPT_CPI:
+				cpi_enable();
+				break;
+
+			case OPT_CPI_REGION:
+				cpi_set_region(strtoul(optarg, NULL, 0));
+				break;
+
+			case OPT_CPI_OUT:
+				cpi_set_output(optarg);
+				break;
+
+			case OPT_MIC:
+				micmon_enable();
+				break;
+
+			case OPT_MIC_INTERVAL:
+				micmon_set_interval(strtoull(optarg, NULL, 0));
+				break;
+
+			case OPT_CACHE_STATS:
+				cachestats_enable();
+				break;
+
+			case OPT_CACHE_INTERVAL:
+				cachestats_set_interval(strtoull(optarg, NULL, 0));
+				break;
+
+			case OPT_CACHE_OUT:
+				cachestats_set_output(optarg);
+				break;
+
+			case OPT_IMIX:
+				imix_enable();
+				break;
+
+			case OPT_IMIX_OUT:
+				imix_set_output(optarg);
+				break;
+
+			case OPT_STATUS:
+				status_set_interval(strtod(optarg, NULL));
+				break;
+
+			case OPT_STATS_SHM:
+				status_set_shm(optarg);
+				break;
+#ifdef CHECKER
+			case OPT_CHECK_FROM:
+				check_from = strtoull(optarg, NULL, 0);
+				printf("Checking from cycle %lu\n", check_from);
+				break;
+
+			case OPT_CHECK_TO:
+				check_to = strtoull(optarg, NULL, 0);
+				printf("Checking to cycle %lu\n", check_to);
+				break;
+
+			case OPT_CHECK_FULL:
+				checker_set_full();
+				break;
+
+#ifdef CPU_INTERNALS
+			case OPT_CHECK_MEM:
+				checker_set_mem();
+				break;
+#endif
+
+			case OPT_CHECK_HASH:
+				checker_set_hash(strtoull(optarg, NULL, 0));
+				break;
+#endif
+#ifdef HYBRID
+			case OPT_HYBRID_ISS:
+				if (hybrid_set_iss(optarg) != 0)
+					return 1;
+				break;
+
+			case OPT_HYBRID_RTL:
+				if (hybrid_set_rtl(optarg) != 0)
+					return 1;
+				break;
+
+			case OPT_HYBRID_BACK:
+				if (hybrid_set_back(optarg) != 0)
+					return 1;
+				break;
+
+			case OPT_HYBRID_IO:
+				hybrid_set_io_cycles(strtoull(optarg, NULL, 0));
+				break;
+#endif
 			case 'h':
 			default:
 				print_help(exe_name);
@@ -290,12 +1026,22 @@ int main(int argc, char **argv)
 
 	//////////////////////////////////////////////////////////////////////
 
+	if (trace_fname) {
+		printf("Writing trace to %s\n", trace_fname);
+		// The docs claim using $dumpfile works; I get
+		// an unsupp PLI error.  This enables trace
+		// output:
+		tb->opentrace(trace_fname);
+	}
+
         printf("Random seed 0x%016llx\n", random_seed);
         srand48(random_seed);
 
 	setup_sighandlers();
 
-	tb->ioemul_init();
+	/* A fork server's I/O is set up per child, after the fork: */
+	if (io_enabled && !fork_server_port)
+		tb->ioemul_init();
 
 #ifdef CHECKER
         checker_init(tb, checker_log_flags);
@@ -322,57 +1068,210 @@ int main(int argc, char **argv)
 		restore_arch_state(tb, restore_arch_fname);
 	}
 
+	if (fork_server_port) {
+		if (fork_server(fork_server_port, &fork_req) != 0)
+			return 0;
+
+		/* Now in a child, with a private copy of the model.  Outputs
+		 * not given in the request get this child's own names, rather
+		 * than ones shared with its siblings:
+		 */
+		if (!fork_req.log)
+			fork_req.log = pid_name("forksrv.log");
+		if (!freopen(fork_req.log, "w", stdout)) {
+			fprintf(stderr, "Can't open log '%s'\n", fork_req.log);
+			return 1;
+		}
+		if (fork_req.init)
+			uart_init_string = fork_req.init;
+		if (!fork_req.save)
+			fork_req.save = pid_name(save_state_filename);
+		free(save_state_filename);
+		save_state_filename = fork_req.save;
+		char *name = pid_name(probe_get_file());
+		probe_set_file(name);
+		free(name);
+		if (status_get_shm()) {
+			name = pid_name(status_get_shm());
+			status_set_shm(name);
+			free(name);
+		}
+		if (fork_req.limit)
+			tick_limit = tb->get_tickcount() + fork_req.limit;
+		if (io_enabled) {
+			if (fork_req.console_port < 0)
+				io_console_fd = fork_req.ctl_fd;
+			else
+				io_console_port = fork_req.console_port;
+			io_debug_port = fork_req.debug_port;
+			io_mem_bd_port = fork_req.mem_bd_port;
+
+			tb->ioemul_init();
+		} else {
+			io_console_port = io_debug_port = io_mem_bd_port = -1;
+		}
+		fork_server_child_ready(&fork_req);
+	}
+
+	if (probe_init(tb) != 0)
+		return 1;
+
+	if (profile_init(tb) != 0)
+		return 1;
+
+	if (cpi_init(tb) != 0)
+		return 1;
+
+	if (micmon_init(tb) != 0)
+		return 1;
+
+	if (cachestats_init(tb) != 0)
+		return 1;
+
+	if (save_arch_at_pc && !save_arch_fname) {
+		fprintf(stderr, "--save-arch-pc needs --save-arch\n");
+		return 1;
+	}
+	if (save_arch_fname && monitor_add(save_arch_monitor, NULL) != 0)
+		return 1;
+
+	if (imix_init(tb) != 0)
+		return 1;
+
+	if (status_init(tb) != 0)
+		return 1;
+
+	if (idle_init(tb) != 0)
+		return 1;
+
+#ifdef HYBRID
+	if (hybrid_init(tb) != 0)
+		return 1;
+#endif
+
+	/* After any restore, so the first snapshot's of the restored state */
+	if (window_init(tb) != 0)
+		return 1;
+
+	uint64_t next_checkpoint = ~0ULL;
+	if (checkpoint_every)
+		next_checkpoint = tb->get_tickcount() + checkpoint_every;
+
+	struct timespec host_start, host_end;
+	uint64_t start_tick = tb->get_tickcount();
+	uint32_t start_commit = tb->getTop()->tb_top->MR->CPU->CPU->WB->counter_instr_commit;
+	clock_gettime(CLOCK_MONOTONIC, &host_start);
+
 	/* Main loop */
 	do {
 		current_limit = tick_limit;
-		while(!tb->done() && tb->get_tickcount() < current_limit) {
-			tb->tick();
-
-#ifdef BRANCH_TRACE
-                        if (tb->getTop()->tb_top->MR->CPU->CPU->MEM->new_pc_valid) {
-                                printf("%08x\n", tb->getTop()->tb_top->MR->CPU->CPU->MEM->new_pc);
-                        }
-#endif
-#ifdef SYSCALL_TRACE
-                        if (tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_valid_r &&
-                                tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_fault_r == 4) {
-                                printf("+++ STRACE PC %08x: sc(%4d): args=%08x %08x %08x %08x\n",
-                                       tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_pc_r,
-                                       tb->getTop()->tb_top->MR->CPU->CPU->DE->GPRF->registers[0],
-                                       tb->getTop()->tb_top->MR->CPU->CPU->DE->GPRF->registers[3],
-                                       tb->getTop()->tb_top->MR->CPU->CPU->DE->GPRF->registers[4],
-                                       tb->getTop()->tb_top->MR->CPU->CPU->DE->GPRF->registers[5],
-                                       tb->getTop()->tb_top->MR->CPU->CPU->DE->GPRF->registers[6]
-                                        );
-
-                        }
-#endif
-#ifdef CHECKER
-                        checker(tb);
+		if (next_checkpoint < current_limit)
+			current_limit = next_checkpoint;
+#ifdef HYBRID
+		if (hybrid_in_iss())
+			hybrid_run_iss(tb);
+		else
 #endif
-		}
+		run(tb);
 
 		// Broken out of loop e.g. from signal handler?
+		if (sig_request & SR_STATUS) {
+			// Frequent, so doesn't flush the trace etc.
+			sig_request &= ~SR_STATUS;
+			status_update(tb);
+		}
 		if (sig_request) {
+			tb->ioemul_flush();
+			tb->flushtrace();
 			if (sig_request & SR_DUMP_REGS) {
 				dump_regs(tb);
 			}
+			if (sig_request & SR_PROFILE) {
+				profile_report();
+				cpi_report();
+				micmon_report();
+				cachestats_report();
+				imix_report();
+			}
 			if (sig_request & SR_SAVE_STATE) {
-				save_state(tb);
+				if (save_state_bg) {
+					dump_regs(tb);
+					save_state_async(tb);
+				} else {
+					save_state(tb);
+				}
 			}
 			sig_request = 0;
 		}
-	} while (!tb->done() && tb->get_tickcount() < tick_limit);
+
+		if (tb->get_tickcount() >= next_checkpoint) {
+			save_state_async(tb);
+			next_checkpoint += checkpoint_every;
+		}
+		save_state_reap(false);
+		window_reap(false);
+	} while (!tb->done() && tb->get_tickcount() < tick_limit && !save_arch_reached
+#ifdef HYBRID
+		 && !hybrid_quit()
+#endif
+		);
+
+	tb->ioemul_flush();
+	if (io_console_tx_dropped)
+		printf("[Console socket fell behind: %lu bytes not sent]\n",
+		       io_console_tx_dropped);
+#ifdef CHECKER
+	checker_finish();
+#endif
 
         printf("Complete:  Committed %d instructions, %d stall cycles, %lu cycles total\n",
                tb->getTop()->tb_top->MR->CPU->CPU->WB->counter_instr_commit,
                tb->getTop()->tb_top->MR->CPU->CPU->WB->counter_stall_cycle,
                tb->get_tickcount());
 
+	clock_gettime(CLOCK_MONOTONIC, &host_end);
+	double host_secs = (host_end.tv_sec - host_start.tv_sec) +
+		(host_end.tv_nsec - host_start.tv_nsec) / 1e9;
+	printf("Host time: %.3fs, %.0f cycles/s\n", host_secs,
+	       host_secs > 0 ? (tb->get_tickcount() - start_tick) / host_secs : 0.0);
+
+	if (stats_fname)
+		write_stats(tb, stats_fname, host_secs,
+			    tb->get_tickcount() - start_tick,
+			    tb->getTop()->tb_top->MR->CPU->CPU->WB->counter_instr_commit - start_commit);
+
+	status_finish(tb);
 	dump_regs(tb);
 	if (save_at_exit)
 		save_state(tb);
+	if (save_arch_fname)
+		save_arch_state(tb, save_arch_fname, save_arch_sparse);
+	save_state_reap(true);
+	window_finish();
+	probe_finish();
+	profile_report();
+	cpi_report();
+	micmon_report();
+	cachestats_report();
+	cachestats_finish();
+	imix_report();
+	idle_report();
+#ifdef HYBRID
+	hybrid_report();
+#endif
 
+	tb->getTop()->final();
+	tb->close();	// Flushes the trace
+
+	if (fork_server_port) {
+		tb->ioemul_drain();
+		fork_server_child_done(&fork_req, tb->get_tickcount());
+	}
+
+#ifdef PGO_GEN
+	/* The model writes its --prof-pgo profile as it's destroyed */
+	delete tb;
+#endif
         exit(EXIT_SUCCESS);
 }
 
@@ -0,0 +1,265 @@
+/* MR-sys verilated sim MIC bus monitor
+ *
+ * Copyright 2020-2022 Matt Evans
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <deque>
+
+#include "testbench.h"
+#include "monitor.h"
+#include "micmon.h"
+
+/* Passively watches the valid/ready/last handshakes of every MIC port in
+ * mr_top.v (public_flat_rd there).  For each port, in each direction, it
+ * counts packets, beats (transfers) and backpressure cycles (valid, not
+ * ready).  Request-to-response latency is from the first request beat being
+ * accepted to the first response beat being accepted, assuming a port's
+ * responses come back in request order; it goes in a log2 histogram.
+ *
+ * Requester ports 4-7 reach the main MIC via the second-level MIC on
+ * requester port 3 ("cascade"), so their traffic is also counted there.
+ */
+
+#define MICMON_HIST		24
+#define MICMON_MAX_OUTSTANDING	64
+
+typedef struct {
+	uint64_t	pkts;
+	uint64_t	beats;
+	uint64_t	stalls;
+} mic_dir_t;
+
+typedef struct {
+	const char	*name;
+	/* Request and response streams, as seen by the MIC port */
+	const CData	*q_tv, *q_tr, *q_tl;
+	const CData	*r_tv, *r_tr, *r_tl;
+
+	mic_dir_t	req, resp;
+	mic_dir_t	last_req, last_resp;	// At the last interval
+	bool		in_req, in_resp;	// Mid-packet
+	std::deque<uint64_t> outstanding;
+	uint64_t	lat_hist[MICMON_HIST];
+	uint64_t	lat_sum, lat_max, lat_num;
+} mic_port_t;
+
+#define MR(tb)	((tb)->getTop()->tb_top->MR)
+#define REQ_PORT(tb, n, nm)	{ nm, &MR(tb)->r##n##o_tv, &MR(tb)->r##n##o_tr, &MR(tb)->r##n##o_tl, \
+				  &MR(tb)->r##n##i_tv, &MR(tb)->r##n##i_tr, &MR(tb)->r##n##i_tl }
+#define CPL_PORT(tb, n, nm)	{ nm, &MR(tb)->c##n##i_tv, &MR(tb)->c##n##i_tr, &MR(tb)->c##n##i_tl, \
+				  &MR(tb)->c##n##o_tv, &MR(tb)->c##n##o_tr, &MR(tb)->c##n##o_tl }
+
+#define MICMON_PORTS	12
+
+static mic_port_t mic_ports[MICMON_PORTS];
+static bool micmon_enabled = false;
+static uint64_t micmon_interval = 0;
+static uint64_t micmon_next = ~0ULL;
+static uint64_t micmon_start = 0;
+static uint64_t micmon_last = 0;
+static Testbench *micmon_tb;
+
+void	micmon_enable(void)
+{
+	micmon_enabled = true;
+}
+
+void	micmon_set_interval(uint64_t cycles)
+{
+	micmon_enabled = true;
+	micmon_interval = cycles;
+}
+
+static inline void	mic_dir_cycle(mic_dir_t *d, bool *in_pkt, CData tv, CData tr,
+				      CData tl, bool *first)
+{
+	*first = false;
+	if (!tv)
+		return;
+	if (!tr) {
+		d->stalls++;
+		return;
+	}
+	d->beats++;
+	if (!*in_pkt)
+		*first = true;
+	*in_pkt = !tl;
+	if (tl)
+		d->pkts++;
+}
+
+static void	micmon_monitor(Testbench *tb, void *arg)
+{
+	uint64_t now = tb->get_tickcount();
+
+	for (int i = 0; i < MICMON_PORTS; i++) {
+		mic_port_t *p = &mic_ports[i];
+		bool first;
+
+		mic_dir_cycle(&p->req, &p->in_req, *p->q_tv, *p->q_tr, *p->q_tl, &first);
+		if (first) {
+			if (p->outstanding.size() == MICMON_MAX_OUTSTANDING)
+				p->outstanding.pop_front();
+			p->outstanding.push_back(now);
+		}
+
+		mic_dir_cycle(&p->resp, &p->in_resp, *p->r_tv, *p->r_tr, *p->r_tl, &first);
+		if (first && !p->outstanding.empty()) {
+			uint64_t lat = now - p->outstanding.front();
+			int b = lat ? 64 - __builtin_clzll(lat) : 0;
+
+			p->outstanding.pop_front();
+			p->lat_hist[b < MICMON_HIST ? b : MICMON_HIST - 1]++;
+			p->lat_sum += lat;
+			p->lat_num++;
+			if (lat > p->lat_max)
+				p->lat_max = lat;
+		}
+	}
+
+	if (now >= micmon_next) {
+		uint64_t cycles = now - micmon_last;
+
+		printf("MIC @%lu:", now);
+		for (int i = 0; i < MICMON_PORTS; i++) {
+			mic_port_t *p = &mic_ports[i];
+			uint64_t qb = p->req.beats - p->last_req.beats;
+			uint64_t rb = p->resp.beats - p->last_resp.beats;
+			uint64_t qs = p->req.stalls - p->last_req.stalls;
+
+			if (qb || rb || qs)
+				printf("  %s %.1f/%.1f%% (%.1f%% bp)", p->name,
+				       qb * 100.0 / cycles, rb * 100.0 / cycles,
+				       qs * 100.0 / cycles);
+			p->last_req = p->req;
+			p->last_resp = p->resp;
+		}
+		printf("\n");
+		micmon_last = now;
+		micmon_next += micmon_interval;
+	}
+}
+
+/* Reports are every micmon_interval simulated cycles, not counting a jump */
+static void	micmon_jumped(Testbench *tb, uint64_t from, uint64_t to)
+{
+	if (micmon_next > from)
+		micmon_next += to - from;
+}
+
+int	micmon_init(Testbench *tb)
+{
+	if (!micmon_enabled)
+		return 0;
+
+	mic_port_t ports[MICMON_PORTS] = {
+		REQ_PORT(tb, 0, "cpu"),
+		REQ_PORT(tb, 1, "r1"),
+		REQ_PORT(tb, 2, "r2"),
+		REQ_PORT(tb, 3, "cascade"),
+		REQ_PORT(tb, 4, "audio"),
+		REQ_PORT(tb, 5, "sd"),
+		REQ_PORT(tb, 6, "display"),
+		REQ_PORT(tb, 7, "debug"),
+		CPL_PORT(tb, 0, "ram_a"),
+		CPL_PORT(tb, 1, "ram_b"),
+		CPL_PORT(tb, 2, "apb"),
+		CPL_PORT(tb, 3, "boot_ram"),
+	};
+	for (int i = 0; i < MICMON_PORTS; i++)
+		mic_ports[i] = ports[i];
+
+	micmon_tb = tb;
+	micmon_start = micmon_last = tb->get_tickcount();
+	if (micmon_interval) {
+		micmon_next = micmon_start + micmon_interval;
+		printf("MIC monitor: reporting every %lu cycles (req/resp utilisation, req backpressure)\n",
+		       micmon_interval);
+		if (monitor_add_jump(micmon_jumped) != 0)
+			return -1;
+	}
+	return monitor_add(micmon_monitor, NULL);
+}
+
+/* Latency at which the histogram reaches a fraction of the responses; the
+ * answer is a bucket's upper bound (or the max seen, if lower).
+ */
+static uint64_t	lat_percentile(const mic_port_t *p, double frac)
+{
+	uint64_t target = p->lat_num * frac;
+	uint64_t n = 0;
+
+	for (int b = 0; b < MICMON_HIST; b++) {
+		n += p->lat_hist[b];
+		if (n > target) {
+			uint64_t upper = b ? (1ULL << b) - 1 : 0;
+			return upper < p->lat_max ? upper : p->lat_max;
+		}
+	}
+	return p->lat_max;
+}
+
+void	micmon_report(void)
+{
+	if (!micmon_enabled)
+		return;
+
+	uint64_t cycles = micmon_tb->get_tickcount() - micmon_start;
+	if (!cycles)
+		return;
+
+	printf("MIC monitor: %lu cycles\n"
+	       "  %-9s %10s %10s %6s %6s  %10s %10s %6s %6s  %7s %5s %5s %5s %6s\n",
+	       cycles, "port", "req pkts", "beats", "util", "bp",
+	       "resp pkts", "beats", "util", "bp", "lat avg", "p50", "p90", "p99", "max");
+	for (int i = 0; i < MICMON_PORTS; i++) {
+		const mic_port_t *p = &mic_ports[i];
+
+		if (!p->req.beats && !p->resp.beats)
+			continue;
+		printf("  %-9s %10lu %10lu %5.1f%% %5.1f%%  %10lu %10lu %5.1f%% %5.1f%%  %7.1f %5lu %5lu %5lu %6lu\n",
+		       p->name,
+		       p->req.pkts, p->req.beats, p->req.beats * 100.0 / cycles,
+		       p->req.stalls * 100.0 / cycles,
+		       p->resp.pkts, p->resp.beats, p->resp.beats * 100.0 / cycles,
+		       p->resp.stalls * 100.0 / cycles,
+		       p->lat_num ? (double)p->lat_sum / p->lat_num : 0.0,
+		       lat_percentile(p, 0.5), lat_percentile(p, 0.9),
+		       lat_percentile(p, 0.99), p->lat_max);
+	}
+
+	/* Latency histograms, for ports with responses: */
+	for (int i = 0; i < MICMON_PORTS; i++) {
+		const mic_port_t *p = &mic_ports[i];
+
+		if (!p->lat_num)
+			continue;
+		printf("  %-9s latency:", p->name);
+		for (int b = 0; b < MICMON_HIST; b++) {
+			if (!p->lat_hist[b])
+				continue;
+			if (b == 0)
+				printf(" [0] %lu", p->lat_hist[b]);
+			else
+				printf(" [%lu-%lu] %lu", 1UL << (b - 1), (1UL << b) - 1,
+				       p->lat_hist[b]);
+		}
+		printf("\n");
+	}
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2020-2022 Matt Evans
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONITOR_H
+#define MONITOR_H
+
+/* Monitors are called after every cycle, when any are registered (the run
+ * loop is built without the call otherwise).  They look at the model and
+ * collect whatever they're collecting.
+ */
+
+class Testbench;
+
+typedef void (*monitor_fn_t)(Testbench *tb, void *arg);
+
+typedef struct {
+	monitor_fn_t	fn;
+	void		*arg;
+} monitor_t;
+
+#define MAX_MONITORS	16
+
+extern monitor_t monitors[MAX_MONITORS];
+extern int monitors_num;
+
+static inline int	monitor_add(monitor_fn_t fn, void *arg)
+{
+	if (monitors_num == MAX_MONITORS)
+		return -1;
+	monitors[monitors_num].fn = fn;
+	monitors[monitors_num].arg = arg;
+	monitors_num++;
+	return 0;
+}
+
+static inline void	monitors_run(Testbench *tb)
+{
+	for (int i = 0; i < monitors_num; i++)
+		monitors[i].fn(tb, monitors[i].arg);
+}
+
+/* The cycle count can jump forward (idle skip), without the cycles between
+ * being simulated or monitored.  Monitors with cycle deadlines add a hook
+ * to move them on past the jump.
+ */
+typedef void (*monitor_jump_fn_t)(Testbench *tb, uint64_t from, uint64_t to);
+
+extern monitor_jump_fn_t monitor_jumps[MAX_MONITORS];
+extern int monitor_jumps_num;
+
+static inline int	monitor_add_jump(monitor_jump_fn_t fn)
+{
+	if (monitor_jumps_num == MAX_MONITORS)
+		return -1;
+	monitor_jumps[monitor_jumps_num++] = fn;
+	return 0;
+}
+
+static inline void	monitors_jumped(Testbench *tb, uint64_t from, uint64_t to)
+{
+	for (int i = 0; i < monitor_jumps_num; i++)
+		monitor_jumps[i](tb, from, to);
+}
+
+#endif
@@ -0,0 +1,447 @@
+/* MR-sys verilated sim event probes
+ *
+ * Copyright 2020-2022 Matt Evans
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <signal.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <atomic>
+
+#include "testbench.h"
+#include "monitor.h"
+#include "probe.h"
+
+/* Probes watch the model for events, and emit fixed-size binary records into
+ * a ring per probe.  A writer thread drains the rings into the probe file,
+ * which tools/probe_decode.py turns back into text.  Records from different
+ * probes aren't in cycle order in the file; the decoder sorts them.
+ *
+ * Probes are enabled with -P name,name,... and/or over a control socket
+ * (--probe-port), which takes lines of:
+ *
+ *	enable <name>|all
+ *	disable <name>|all
+ *	list
+ *
+ * A full ring stalls the sim until the writer catches up, so nothing's lost.
+ */
+
+extern int listen_on(int *port);
+
+#define PROBE_RING_LOG2		12
+#define PROBE_WRITER_POLL_MS	2
+
+typedef void (*probe_fn_t)(Testbench *tb, int id);
+
+typedef struct {
+	const char	*name;
+	const char	*desc;
+	probe_fn_t	fn;
+	SpscRing<probe_rec_t, PROBE_RING_LOG2> *ring;
+	uint64_t	count;		// Written by the sim thread
+	uint64_t	stalls;
+} probe_t;
+
+static std::atomic<uint32_t> probe_mask(0);
+static const char *probe_filename = "probes.bin";
+static FILE *probe_file = NULL;
+static int probe_port = -1;
+static int probe_listen_skt = -1;
+static int probe_ctl_skt = -1;
+static pthread_t probe_thread;
+static std::atomic<bool> probe_stop(false);
+static bool probe_running = false;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Probes
+
+static inline void	probe_emit(Testbench *tb, int id, uint32_t pc, uint32_t a0,
+				   uint32_t a1 = 0, uint32_t a2 = 0, uint32_t a3 = 0,
+				   uint32_t a4 = 0, uint32_t a5 = 0);
+
+static void	probe_branch(Testbench *tb, int id)
+{
+	if (tb->getTop()->tb_top->MR->CPU->CPU->MEM->new_pc_valid) {
+		probe_emit(tb, id, tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_pc_r,
+			   tb->getTop()->tb_top->MR->CPU->CPU->MEM->new_pc);
+	}
+}
+
+static void	probe_syscall(Testbench *tb, int id)
+{
+	if (tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_valid_r &&
+	    tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_fault_r == 4) {
+		probe_emit(tb, id, tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_pc_r,
+			   tb->getTop()->tb_top->MR->CPU->CPU->DE->GPRF->registers[0],
+			   tb->getTop()->tb_top->MR->CPU->CPU->DE->GPRF->registers[3],
+			   tb->getTop()->tb_top->MR->CPU->CPU->DE->GPRF->registers[4],
+			   tb->getTop()->tb_top->MR->CPU->CPU->DE->GPRF->registers[5],
+			   tb->getTop()->tb_top->MR->CPU->CPU->DE->GPRF->registers[6],
+			   tb->getTop()->tb_top->MR->CPU->CPU->DE->GPRF->registers[7]);
+	}
+}
+
+static void	probe_exception(Testbench *tb, int id)
+{
+	if (tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_valid_r &&
+	    tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_fault_r != 0) {
+		probe_emit(tb, id, tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_pc_r,
+			   tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_fault_r,
+			   tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_msr_r,
+			   tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_instr_r);
+	}
+}
+
+#define INSTR_RFI	0x4c000064
+
+static void	probe_rfi(Testbench *tb, int id)
+{
+	if (tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_valid_r &&
+	    tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_fault_r == 0 &&
+	    tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_instr_r == INSTR_RFI) {
+		probe_emit(tb, id, tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_pc_r,
+			   tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_SRR0,
+			   tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_SRR1);
+	}
+}
+
+/* An MMU fault is the CPU heading for the DSI (0x300) or ISI (0x400)
+ * vector, as probe_irq() spots interrupts; DAR/DSISR/SRR0 are read at the
+ * handler's first commit, by which time they've been written.  (MR-hw's
+ * memory_fault_r codes for these aren't known, so the vector is used.)
+ */
+static uint32_t mmu_fault_vector;
+
+static void	probe_mmu_fault(Testbench *tb, int id)
+{
+	if (mmu_fault_vector &&
+	    tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_valid_i &&
+	    tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_fault_r == 0) {
+		probe_emit(tb, id, tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_SRR0,
+			   tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_DAR,
+			   tb->getTop()->tb_top->MR->CPU->CPU->DE->SPRF->as_DSISR,
+			   mmu_fault_vector);
+		mmu_fault_vector = 0;
+	}
+	if (tb->getTop()->tb_top->MR->CPU->CPU->MEM->new_pc_valid) {
+		uint32_t v = tb->getTop()->tb_top->MR->CPU->CPU->MEM->new_pc & 0x000fffff;
+
+		mmu_fault_vector = (v == 0x300 || v == 0x400) ? v : 0;
+	}
+}
+
+/* The CPU heading for the external interrupt vector, with the INTC state
+ * that got it there:
+ */
+static void	probe_irq(Testbench *tb, int id)
+{
+	if (tb->getTop()->tb_top->MR->CPU->CPU->MEM->new_pc_valid &&
+	    (tb->getTop()->tb_top->MR->CPU->CPU->MEM->new_pc & 0x000fffff) == 0x500) {
+		probe_emit(tb, id, tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_pc_r,
+			   tb->getTop()->tb_top->MR->INTC->pending,
+			   tb->getTop()->tb_top->MR->INTC->enabled);
+	}
+}
+
+static void	probe_uart_tx(Testbench *tb, int id)
+{
+	if (tb->getTop()->tb_top->MR->CONSOLE_UART->tx_has_data) {
+		probe_emit(tb, id, tb->getTop()->tb_top->MR->CPU->CPU->IF->current_pc,
+			   tb->getTop()->tb_top->MR->CONSOLE_UART->next_tx_byte);
+	}
+}
+
+static probe_t probes[] = {
+	{ "branch",	"Taken branch (pc, target)",			probe_branch },
+	{ "syscall",	"sc (pc, r0, r3-r7)",				probe_syscall },
+	{ "exception",	"Faulting instruction (pc, fault, MSR, instr)",	probe_exception },
+	{ "rfi",	"rfi (pc, SRR0, SRR1)",				probe_rfi },
+	{ "mmu_fault",	"DSI/ISI taken (SRR0, DAR, DSISR, vector)",	probe_mmu_fault },
+	{ "irq",	"External interrupt taken (pc, INTC pending, enabled)", probe_irq },
+	{ "uart_tx",	"Console output (pc, byte)",			probe_uart_tx },
+};
+
+#define NUM_PROBES	((int)(sizeof(probes)/sizeof(probes[0])))
+
+static inline void	probe_emit(Testbench *tb, int id, uint32_t pc, uint32_t a0,
+				   uint32_t a1, uint32_t a2, uint32_t a3,
+				   uint32_t a4, uint32_t a5)
+{
+	probe_rec_t r;
+
+	r.cycle = tb->get_tickcount();
+	r.probe = id;
+	r.flags = 0;
+	r.pc = pc;
+	r.arg[0] = a0;
+	r.arg[1] = a1;
+	r.arg[2] = a2;
+	r.arg[3] = a3;
+	r.arg[4] = a4;
+	r.arg[5] = a5;
+
+	while (!probes[id].ring->push(r)) {
+		probes[id].stalls++;
+		sched_yield();
+	}
+	probes[id].count++;
+}
+
+static void	probe_monitor(Testbench *tb, void *arg)
+{
+	uint32_t m = probe_mask.load(std::memory_order_relaxed);
+
+	while (m) {
+		int id = __builtin_ctz(m);
+		probes[id].fn(tb, id);
+		m &= m - 1;
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Control
+
+static int	probe_lookup(const char *name, uint32_t *mask)
+{
+	if (!strcmp(name, "all")) {
+		*mask = (1 << NUM_PROBES) - 1;
+		return 0;
+	}
+	for (int i = 0; i < NUM_PROBES; i++) {
+		if (!strcmp(name, probes[i].name)) {
+			*mask = 1 << i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int	probe_enable(const char *names)
+{
+	char *s = strdup(names);
+	char *tok, *save;
+	int r = 0;
+
+	for (tok = strtok_r(s, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		uint32_t m;
+		if (probe_lookup(tok, &m) != 0) {
+			fprintf(stderr, "Unknown probe '%s'; probes are:\n", tok);
+			for (int i = 0; i < NUM_PROBES; i++)
+				fprintf(stderr, "\t%-12s %s\n", probes[i].name, probes[i].desc);
+			r = -1;
+			break;
+		}
+		probe_mask |= m;
+	}
+	free(s);
+	return r;
+}
+
+void	probe_set_file(const char *filename)
+{
+	probe_filename = strdup(filename);
+}
+
+const char	*probe_get_file(void)
+{
+	return probe_filename;
+}
+
+void	probe_set_port(int port)
+{
+	probe_port = port;
+}
+
+static void	probe_ctl_reply(const char *msg)
+{
+	ssize_t r = write(probe_ctl_skt, msg, strlen(msg));
+	(void)r;
+}
+
+static void	probe_ctl_command(char *line)
+{
+	char cmd[16], arg[32];
+	char msg[128];
+	uint32_t m;
+	int n = sscanf(line, "%15s %31s", cmd, arg);
+
+	if (n == 2 && !strcmp(cmd, "enable") && probe_lookup(arg, &m) == 0) {
+		probe_mask |= m;
+		probe_ctl_reply("ok\n");
+	} else if (n == 2 && !strcmp(cmd, "disable") && probe_lookup(arg, &m) == 0) {
+		probe_mask &= ~m;
+		probe_ctl_reply("ok\n");
+	} else if (n == 1 && !strcmp(cmd, "list")) {
+		for (int i = 0; i < NUM_PROBES; i++) {
+			snprintf(msg, sizeof(msg), "%-12s %-3s %lu\n", probes[i].name,
+				 (probe_mask & (1 << i)) ? "on" : "off", probes[i].count);
+			probe_ctl_reply(msg);
+		}
+		probe_ctl_reply("ok\n");
+	} else {
+		probe_ctl_reply("error\n");
+	}
+}
+
+static void	probe_ctl_poll(void)
+{
+	static char line[128];
+	static int line_len = 0;
+	struct pollfd f[2];
+	int n = 0;
+
+	if (probe_listen_skt >= 0) {
+		f[n].fd = probe_listen_skt;
+		f[n].events = POLLIN;
+		f[n].revents = 0;
+		n++;
+	}
+	if (probe_ctl_skt >= 0) {
+		f[n].fd = probe_ctl_skt;
+		f[n].events = POLLIN;
+		f[n].revents = 0;
+		n++;
+	}
+	if (poll(f, n, PROBE_WRITER_POLL_MS) <= 0)
+		return;
+
+	if (probe_listen_skt >= 0 && f[0].revents) {
+		if (probe_ctl_skt >= 0)
+			close(probe_ctl_skt);
+		probe_ctl_skt = accept(probe_listen_skt, NULL, NULL);
+		line_len = 0;
+		return;
+	}
+
+	char c;
+	ssize_t r = read(probe_ctl_skt, &c, 1);
+	if (r <= 0) {
+		close(probe_ctl_skt);
+		probe_ctl_skt = -1;
+		return;
+	}
+	if (c == '\n') {
+		line[line_len] = '\0';
+		probe_ctl_command(line);
+		line_len = 0;
+	} else if (c != '\r' && line_len < (int)sizeof(line) - 1) {
+		line[line_len++] = c;
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Writer
+
+static void	probe_drain(void)
+{
+	for (int i = 0; i < NUM_PROBES; i++) {
+		const probe_rec_t *p[2];
+		uint32_t n[2];
+		int segs;
+
+		while ((segs = probes[i].ring->peekv(p, n)) > 0) {
+			uint32_t total = 0;
+			for (int s = 0; s < segs; s++) {
+				fwrite(p[s], sizeof(probe_rec_t), n[s], probe_file);
+				total += n[s];
+			}
+			probes[i].ring->consume(total);
+		}
+	}
+}
+
+static void	*probe_thread_main(void *arg)
+{
+	while (!probe_stop.load()) {
+		if (probe_port >= 0)
+			probe_ctl_poll();
+		else
+			usleep(PROBE_WRITER_POLL_MS * 1000);
+		probe_drain();
+	}
+	probe_drain();
+	return NULL;
+}
+
+/* Nothing happens (or costs anything) unless probes are enabled or there's
+ * a control port to enable them later.
+ */
+int	probe_init(Testbench *tb)
+{
+	if (probe_mask == 0 && probe_port < 0)
+		return 0;
+
+	probe_file = fopen(probe_filename, "wb");
+	if (!probe_file) {
+		fprintf(stderr, "Can't open probe file '%s'\n", probe_filename);
+		return -1;
+	}
+
+	probe_file_hdr_t h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, PROBE_MAGIC, sizeof(h.magic));
+	h.rec_size = sizeof(probe_rec_t);
+	h.nprobes = NUM_PROBES;
+	for (int i = 0; i < NUM_PROBES; i++) {
+		probes[i].ring = new SpscRing<probe_rec_t, PROBE_RING_LOG2>;
+		strncpy(h.names[i], probes[i].name, PROBE_NAME_LEN - 1);
+	}
+	fwrite(&h, sizeof(h), 1, probe_file);
+
+	if (probe_port >= 0) {
+		if ((probe_listen_skt = listen_on(&probe_port)) < 0)
+			return -1;
+		printf("Probe control: listening on port %d\n", probe_port);
+	}
+	printf("Probes: writing to '%s'\n", probe_filename);
+
+	sigset_t ss, oss;
+	sigfillset(&ss);
+	pthread_sigmask(SIG_BLOCK, &ss, &oss);
+	if (pthread_create(&probe_thread, NULL, probe_thread_main, NULL)) {
+		perror("Can't create probe thread\n");
+		return -1;
+	}
+	pthread_sigmask(SIG_SETMASK, &oss, NULL);
+	probe_running = true;
+
+	return monitor_add(probe_monitor, NULL);
+}
+
+void	probe_finish(void)
+{
+	if (!probe_running)
+		return;
+
+	probe_stop = true;
+	pthread_join(probe_thread, NULL);
+	fclose(probe_file);
+
+	for (int i = 0; i < NUM_PROBES; i++) {
+		if (probes[i].count)
+			printf("Probe %-12s %lu events (%lu stalls)\n", probes[i].name,
+			       probes[i].count, probes[i].stalls);
+	}
+}
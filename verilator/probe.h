@@ -0,0 +1,52 @@
+/*
+ * Copyright 2020-2022 Matt Evans
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PROBE_H
+#define PROBE_H
+
+#include <inttypes.h>
+
+/* Probe event records, as written to the probe file (and decoded by
+ * tools/probe_decode.py):
+ */
+typedef struct {
+	uint64_t	cycle;
+	uint16_t	probe;
+	uint16_t	flags;
+	uint32_t	pc;
+	uint32_t	arg[6];
+} probe_rec_t;
+
+#define PROBE_MAGIC		"MRPROBE2"
+#define PROBE_MAX		16
+#define PROBE_NAME_LEN		16
+
+typedef struct {
+	char		magic[8];
+	uint32_t	rec_size;
+	uint32_t	nprobes;
+	char		names[PROBE_MAX][PROBE_NAME_LEN];
+	// Followed by probe_rec_t records
+} probe_file_hdr_t;
+
+int	probe_enable(const char *names);
+void	probe_set_file(const char *filename);
+const char	*probe_get_file(void);
+void	probe_set_port(int port);
+int	probe_init(Testbench *tb);
+void	probe_finish(void);
+
+#endif
@@ -0,0 +1,319 @@
+/* MR-sys verilated sim PC sampling profiler
+ *
+ * Copyright 2020-2022 Matt Evans
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+
+#include "testbench.h"
+#include "monitor.h"
+#include "profile.h"
+
+/* Every N cycles, the next instruction to complete has its PC and MSR[PR]
+ * sampled.  Samples are counted per PC, split into supervisor ("kernel",
+ * which includes firmware) and user.  At exit (or SIGHUP) they're bucketed
+ * per symbol from any symbol files given:
+ *
+ *	- System.map style text ("c0001234 T start_kernel")
+ *	- ELF (vmlinux, firmware, user binaries): the symbol table's functions
+ *
+ * User space PCs from different processes all land in the same buckets, so
+ * user symbols are only meaningful when one program dominates.
+ *
+ * Output is folded stacks ("kernel;do_page_fault 1234"), for flamegraph.pl,
+ * plus a top-N table on stdout.  Sampling only reads the model, so the
+ * simulated system isn't perturbed.
+ */
+
+#define MSR_PR		0x00004000
+
+typedef struct {
+	uint32_t	addr;
+	uint32_t	size;		// 0 if unknown: runs to the next symbol
+	std::string	name;
+} prof_sym_t;
+
+static uint64_t prof_interval = 0;
+static uint64_t prof_next = 0;
+static bool prof_pending = false;
+static const char *prof_out_name = "profile.folded";
+static unsigned int prof_top = 30;
+
+static std::unordered_map<uint32_t, uint64_t> prof_samples[2];	// [user]
+static uint64_t prof_total = 0;
+static std::vector<prof_sym_t> prof_syms;
+static std::vector<std::string> prof_sym_files;
+
+void	profile_set_interval(uint64_t cycles)
+{
+	prof_interval = cycles;
+}
+
+void	profile_add_symbols(const char *filename)
+{
+	prof_sym_files.push_back(filename);
+}
+
+void	profile_set_output(const char *filename)
+{
+	prof_out_name = strdup(filename);
+}
+
+void	profile_set_top(unsigned int n)
+{
+	prof_top = n;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Symbols
+
+static int	load_system_map(FILE *f)
+{
+	char line[512], type, name[400];
+	unsigned int addr;
+	int n = 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%x %c %399s", &addr, &type, name) != 3)
+			continue;
+		// Text symbols only
+		if (type != 't' && type != 'T' && type != 'w' && type != 'W')
+			continue;
+		prof_syms.push_back({ addr, 0, name });
+		n++;
+	}
+	return n;
+}
+
+/* ELF is read by hand, so as not to need libelf: either class, either
+ * endianness (MR binaries are ELF32 big-endian, but this needn't care).
+ * Offsets and indices from the file are checked against its size, so that
+ * a truncated or corrupt file can't take reads off the end.
+ */
+static uint64_t	elf_get(const uint8_t *p, int size, bool be)
+{
+	uint64_t v = 0;
+	for (int i = 0; i < size; i++)
+		v |= (uint64_t)p[be ? i : size - 1 - i] << (8 * (size - 1 - i));
+	return v;
+}
+
+static int	load_elf(FILE *f)
+{
+	std::vector<uint8_t> d;
+	uint8_t buf[65536];
+	size_t r;
+
+	while ((r = fread(buf, 1, sizeof(buf), f)) > 0)
+		d.insert(d.end(), buf, buf + r);
+
+	if (d.size() < 64)
+		return -1;
+	bool is64 = d[4] == 2;
+	bool be = d[5] == 2;
+	const uint8_t *p = d.data();
+	unsigned int shdr_size = is64 ? 64 : 40;
+	unsigned int sym_size = is64 ? 24 : 16;
+
+	uint64_t shoff = is64 ? elf_get(p + 0x28, 8, be) : elf_get(p + 0x20, 4, be);
+	unsigned int shentsize = elf_get(p + (is64 ? 0x3a : 0x2e), 2, be);
+	unsigned int shnum = elf_get(p + (is64 ? 0x3c : 0x30), 2, be);
+	int n = 0;
+
+	if (shentsize < shdr_size || shoff > d.size() ||
+	    (uint64_t)shnum * shentsize > d.size() - shoff)
+		return -1;
+
+	for (unsigned int i = 0; i < shnum; i++) {
+		const uint8_t *sh = p + shoff + i * shentsize;
+		uint32_t type = elf_get(sh + 4, 4, be);
+		if (type != 2)		// SHT_SYMTAB
+			continue;
+
+		uint64_t off = is64 ? elf_get(sh + 0x18, 8, be) : elf_get(sh + 0x10, 4, be);
+		uint64_t size = is64 ? elf_get(sh + 0x20, 8, be) : elf_get(sh + 0x14, 4, be);
+		uint32_t link = elf_get(sh + (is64 ? 0x28 : 0x18), 4, be);
+		uint64_t entsize = is64 ? elf_get(sh + 0x38, 8, be) : elf_get(sh + 0x24, 4, be);
+		if (link >= shnum)
+			return -1;
+
+		const uint8_t *strsh = p + shoff + (uint64_t)link * shentsize;
+		uint64_t stroff = is64 ? elf_get(strsh + 0x18, 8, be) : elf_get(strsh + 0x10, 4, be);
+		uint64_t strsize = is64 ? elf_get(strsh + 0x20, 8, be) : elf_get(strsh + 0x14, 4, be);
+
+		if (entsize < sym_size || off > d.size() || size > d.size() - off ||
+		    stroff > d.size() || strsize > d.size() - stroff)
+			return -1;
+		const char *strtab = (const char *)p + stroff;
+
+		for (uint64_t e = 0; e < size / entsize; e++) {
+			const uint8_t *s = p + off + e * entsize;
+			uint32_t name = elf_get(s, 4, be);
+			uint8_t info = s[is64 ? 4 : 12];
+			uint64_t value = is64 ? elf_get(s + 8, 8, be) : elf_get(s + 4, 4, be);
+			uint64_t ssize = is64 ? elf_get(s + 16, 8, be) : elf_get(s + 8, 4, be);
+			uint32_t shndx = elf_get(s + (is64 ? 6 : 14), 2, be);
+
+			if ((info & 0xf) != 2 || shndx == 0)	// Defined STT_FUNC
+				continue;
+			/* The name must be NUL-terminated within the section */
+			if (name >= strsize || !memchr(strtab + name, '\0', strsize - name))
+				continue;
+			prof_syms.push_back({ (uint32_t)value, (uint32_t)ssize, strtab + name });
+			n++;
+		}
+	}
+	return n;
+}
+
+static void	load_symbols(void)
+{
+	for (unsigned int i = 0; i < prof_sym_files.size(); i++) {
+		const char *name = prof_sym_files[i].c_str();
+		FILE *f = fopen(name, "rb");
+		char magic[4];
+		int n;
+
+		if (!f) {
+			fprintf(stderr, "Profile: can't open symbols '%s'\n", name);
+			continue;
+		}
+		if (fread(magic, 1, 4, f) == 4 && !memcmp(magic, "\177ELF", 4)) {
+			rewind(f);
+			n = load_elf(f);
+		} else {
+			rewind(f);
+			n = load_system_map(f);
+		}
+		fclose(f);
+		if (n < 0)
+			fprintf(stderr, "Profile: bad ELF symbols '%s'\n", name);
+		else
+			printf("Profile: %d symbols from '%s'\n", n, name);
+	}
+	std::sort(prof_syms.begin(), prof_syms.end(),
+		  [](const prof_sym_t &a, const prof_sym_t &b) { return a.addr < b.addr; });
+}
+
+static const char	*symbolise(uint32_t pc)
+{
+	auto it = std::upper_bound(prof_syms.begin(), prof_syms.end(), pc,
+				   [](uint32_t v, const prof_sym_t &s) { return v < s.addr; });
+	if (it == prof_syms.begin())
+		return NULL;
+	--it;
+	if (it->size && pc >= it->addr + it->size)
+		return NULL;
+	return it->name.c_str();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Sampling and reporting
+
+static void	profile_monitor(Testbench *tb, void *arg)
+{
+	if (!prof_pending) {
+		if (tb->get_tickcount() < prof_next)
+			return;
+		prof_pending = true;
+	}
+	if (!tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_valid_r)
+		return;
+
+	uint32_t pc = tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_pc_r;
+	bool user = tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_msr_r & MSR_PR;
+
+	prof_samples[user][pc]++;
+	prof_total++;
+	prof_pending = false;
+	prof_next += prof_interval;
+}
+
+/* Samples are every prof_interval simulated cycles, not counting a jump */
+static void	profile_jumped(Testbench *tb, uint64_t from, uint64_t to)
+{
+	if (prof_next > from)
+		prof_next += to - from;
+}
+
+int	profile_init(Testbench *tb)
+{
+	if (!prof_interval)
+		return 0;
+
+	load_symbols();
+	prof_next = tb->get_tickcount() + prof_interval;
+	printf("Profile: sampling every %lu cycles\n", prof_interval);
+	if (monitor_add_jump(profile_jumped) != 0)
+		return -1;
+	return monitor_add(profile_monitor, NULL);
+}
+
+void	profile_report(void)
+{
+	if (!prof_interval)
+		return;
+
+	/* Bucket per symbol; PCs without one are bucketed per 4KB page */
+	std::map<std::string, uint64_t> buckets;
+	static const char *mode[2] = { "kernel", "user" };
+	char name[64];
+
+	for (int u = 0; u < 2; u++) {
+		for (auto &s : prof_samples[u]) {
+			const char *sym = symbolise(s.first);
+			if (!sym) {
+				snprintf(name, sizeof(name), "[%08x]", s.first & ~0xfffU);
+				sym = name;
+			}
+			buckets[std::string(mode[u]) + ";" + sym] += s.second;
+		}
+	}
+
+	FILE *f = fopen(prof_out_name, "w");
+	if (f) {
+		for (auto &b : buckets)
+			fprintf(f, "%s %lu\n", b.first.c_str(), b.second);
+		fclose(f);
+	} else {
+		fprintf(stderr, "Profile: can't write '%s'\n", prof_out_name);
+	}
+
+	std::vector<std::pair<uint64_t, std::string> > top;
+	uint64_t user_total = 0;
+	for (auto &b : buckets) {
+		top.push_back(std::make_pair(b.second, b.first));
+		if (b.first.compare(0, 5, "user;") == 0)
+			user_total += b.second;
+	}
+	std::sort(top.rbegin(), top.rend());
+
+	printf("Profile: %lu samples (%.1f%% user), written to '%s'\n", prof_total,
+	       prof_total ? user_total * 100.0 / prof_total : 0.0, prof_out_name);
+	for (unsigned int i = 0; i < top.size() && i < prof_top; i++) {
+		printf("  %3u %10lu %6.2f%%  %s\n", i + 1, top[i].first,
+		       top[i].first * 100.0 / prof_total, top[i].second.c_str());
+	}
+}
@@ -0,0 +1,151 @@
+/* MR-sys verilated sim single-producer/single-consumer ring
+ *
+ * Copyright 2020-2022 Matt Evans
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <inttypes.h>
+#include <atomic>
+
+/* A lock-free ring with exactly one producer thread and one consumer
+ * thread.  Each side owns one index, and keeps a private copy of the
+ * other side's index that's only refreshed when the ring looks
+ * full/empty.  That makes the common-case "anything there?" test from
+ * the sim loop a single load of a line the consumer already owns.
+ */
+template <typename T, unsigned int SIZE_LOG2>
+class SpscRing {
+	static const uint32_t	SIZE = 1 << SIZE_LOG2;
+	static const uint32_t	MASK = SIZE - 1;
+
+	/* Producer's line */
+	std::atomic<uint32_t>	m_head;
+	uint32_t		m_tail_cache;
+	uint8_t			m_pad0[64 - 8];
+
+	/* Consumer's line */
+	std::atomic<uint32_t>	m_tail;
+	uint32_t		m_head_cache;
+	uint8_t			m_pad1[64 - 8];
+
+	T			m_buf[SIZE];
+
+public:
+	SpscRing(void) : m_head(0), m_tail_cache(0), m_tail(0), m_head_cache(0) {}
+
+	////////////////////////////////////////////////////////////////////////
+	// Consumer side
+
+	bool		empty(void) {
+		uint32_t t = m_tail.load(std::memory_order_relaxed);
+		if (m_head_cache != t)
+			return false;
+		m_head_cache = m_head.load(std::memory_order_acquire);
+		return m_head_cache == t;
+	}
+
+	bool		pop(T *v) {
+		if (empty())
+			return false;
+		uint32_t t = m_tail.load(std::memory_order_relaxed);
+		*v = m_buf[t & MASK];
+		m_tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	/* Returns the number of items readable contiguously from *p,
+	 * which can be less than the total available if the data wraps.
+	 */
+	uint32_t	peek(const T **p) {
+		if (empty())
+			return 0;
+		uint32_t t = m_tail.load(std::memory_order_relaxed);
+		uint32_t n = m_head_cache - t;
+		uint32_t to_end = SIZE - (t & MASK);
+		*p = &m_buf[t & MASK];
+		return n < to_end ? n : to_end;
+	}
+
+	/* As peek(), but returns both halves of wrapped data: the number
+	 * of segments (0-2) is returned, with pointers/lengths in p/n.
+	 */
+	int		peekv(const T *p[2], uint32_t n[2]) {
+		if (empty())
+			return 0;
+		uint32_t t = m_tail.load(std::memory_order_relaxed);
+		uint32_t avail = m_head_cache - t;
+		uint32_t to_end = SIZE - (t & MASK);
+		p[0] = &m_buf[t & MASK];
+		if (avail <= to_end) {
+			n[0] = avail;
+			return 1;
+		}
+		n[0] = to_end;
+		p[1] = &m_buf[0];
+		n[1] = avail - to_end;
+		return 2;
+	}
+
+	void		consume(uint32_t n) {
+		m_tail.store(m_tail.load(std::memory_order_relaxed) + n,
+			     std::memory_order_release);
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	// Producer side
+
+	uint32_t	space(void) {
+		uint32_t h = m_head.load(std::memory_order_relaxed);
+		if (h - m_tail_cache == SIZE)
+			m_tail_cache = m_tail.load(std::memory_order_acquire);
+		return SIZE - (h - m_tail_cache);
+	}
+
+	bool		push(const T &v) {
+		if (space() == 0)
+			return false;
+		uint32_t h = m_head.load(std::memory_order_relaxed);
+		m_buf[h & MASK] = v;
+		m_head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	/* True once the consumer has taken everything pushed so far */
+	bool		drained(void) {
+		return m_head.load(std::memory_order_relaxed) ==
+			m_tail.load(std::memory_order_acquire);
+	}
+
+	/* Push up to n items; returns the number pushed. */
+	uint32_t	push(const T *v, uint32_t n) {
+		uint32_t s = space();
+		if (s < n) {
+			/* Refresh, the consumer might have caught up */
+			m_tail_cache = m_tail.load(std::memory_order_acquire);
+			s = space();
+		}
+		if (n > s)
+			n = s;
+		uint32_t h = m_head.load(std::memory_order_relaxed);
+		for (uint32_t i = 0; i < n; i++)
+			m_buf[(h + i) & MASK] = v[i];
+		m_head.store(h + n, std::memory_order_release);
+		return n;
+	}
+};
+
+#endif
@@ -0,0 +1,200 @@
+/* MR-sys verilated sim status line and shared memory stats page
+ *
+ * Copyright 2020-2022 Matt Evans
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include "testbench.h"
+#include "monitor.h"
+#include "cpu_signals.h"
+#include "status.h"
+
+/* A timer (SIGALRM, dealt with in main()'s loop like the other signals)
+ * periodically prints a status line, and/or updates the stats page.  The
+ * stats page also has a count per line of the CPU's 64-bit perf event
+ * vector (pctrs, public_flat_rd in mr_top.v) of the cycles it was high,
+ * which costs a monitor so is only done when there's a page.
+ */
+
+extern uint64_t io_console_tx_bytes;
+
+static double status_interval = 0;
+static char *status_shm_name = NULL;
+static stats_page_t *page = NULL;
+
+static struct timespec status_start;
+static struct timespec status_last;
+static uint64_t last_cycles;
+static uint32_t last_commit;
+static uint64_t instrs;
+static uint64_t last_instrs;
+
+void	status_set_interval(double secs)
+{
+	status_interval = secs;
+}
+
+void	status_set_shm(const char *name)
+{
+	if (name[0] == '/') {
+		status_shm_name = strdup(name);
+	} else {
+		status_shm_name = (char *)malloc(strlen(name) + 2);
+		sprintf(status_shm_name, "/%s", name);
+	}
+}
+
+const char	*status_get_shm(void)
+{
+	return status_shm_name;
+}
+
+static void	pctrs_monitor(Testbench *tb, void *arg)
+{
+	uint64_t ev = tb->getTop()->tb_top->MR->pctrs;
+
+	while (ev) {
+		page->pctrs[__builtin_ctzll(ev)]++;
+		ev &= ev - 1;
+	}
+}
+
+static double	secs_since(const struct timespec *a, const struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+int	status_init(Testbench *tb)
+{
+	if (!status_interval && !status_shm_name)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &status_start);
+	status_last = status_start;
+	last_cycles = tb->get_tickcount();
+	last_commit = CPU_COMMITTED(CPU(tb));
+
+	if (status_shm_name) {
+		/* A fresh object, rather than truncating one that another
+		 * sim (or reader) might still have mapped:
+		 */
+		shm_unlink(status_shm_name);
+		int fd = shm_open(status_shm_name, O_CREAT | O_EXCL | O_RDWR, 0644);
+		if (fd < 0) {
+			perror("shm_open");
+			return 1;
+		}
+		if (ftruncate(fd, sizeof(stats_page_t)) < 0) {
+			perror("ftruncate");
+			close(fd);
+			return 1;
+		}
+		page = (stats_page_t *)mmap(NULL, sizeof(stats_page_t), PROT_READ | PROT_WRITE,
+					    MAP_SHARED, fd, 0);
+		close(fd);
+		if (page == MAP_FAILED) {
+			perror("mmap");
+			page = NULL;
+			return 1;
+		}
+		page->version = STATS_PAGE_VERSION;
+		page->pid = getpid();
+		page->magic = STATS_PAGE_MAGIC;
+		printf("Stats page: /dev/shm%s\n", status_shm_name);
+
+		if (monitor_add(pctrs_monitor, NULL) != 0)
+			return 1;
+	}
+
+	/* The page is updated every second even without a status line */
+	double secs = status_interval ? status_interval : 1.0;
+	struct itimerval it;
+
+	it.it_interval.tv_sec = (time_t)secs;
+	it.it_interval.tv_usec = (suseconds_t)((secs - (time_t)secs) * 1e6);
+	if (!it.it_interval.tv_sec && !it.it_interval.tv_usec)
+		it.it_interval.tv_usec = 1000;
+	it.it_value = it.it_interval;
+	setitimer(ITIMER_REAL, &it, NULL);
+	return 0;
+}
+
+void	status_update(Testbench *tb)
+{
+	struct timespec now;
+	uint64_t cycles = tb->get_tickcount();
+	uint32_t commit = CPU_COMMITTED(CPU(tb));
+
+	if (!status_interval && !page)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	instrs += (uint32_t)(commit - last_commit);	// Extends the 32-bit counter
+	last_commit = commit;
+
+	double secs = secs_since(&status_last, &now);
+	uint64_t dc = cycles - last_cycles;
+	uint64_t cps = secs > 0 ? dc / secs : 0;
+
+	if (status_interval) {
+		printf("[Status] cycle %lu, %lu instrs, %.0f cycles/s, IPC %.3f, UART %lu bytes\n",
+		       cycles, instrs, (double)cps,
+		       dc ? (double)(instrs - last_instrs) / dc : 0.0, io_console_tx_bytes);
+		fflush(stdout);
+	}
+
+	if (page) {
+		page->seq++;
+		__sync_synchronize();
+		page->cycles = cycles;
+		page->instrs = instrs;
+		page->stall_cycles = CPU_STALLED(CPU(tb));
+		page->uart_tx_bytes = io_console_tx_bytes;
+		page->host_ms = secs_since(&status_start, &now) * 1000;
+		page->cycles_per_sec = cps;
+		__sync_synchronize();
+		page->seq++;
+	}
+
+	status_last = now;
+	last_cycles = cycles;
+	last_instrs = instrs;
+}
+
+void	status_finish(Testbench *tb)
+{
+	struct itimerval it = {};
+
+	if (!status_interval && !page)
+		return;
+
+	setitimer(ITIMER_REAL, &it, NULL);
+	if (page) {
+		status_update(tb);
+		page->finished = 1;
+		munmap(page, sizeof(stats_page_t));
+		shm_unlink(status_shm_name);
+		page = NULL;
+	}
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2020-2022 Matt Evans
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STATUS_H
+#define STATUS_H
+
+#include <inttypes.h>
+
+/* The shared memory stats page (/dev/shm/<name>), read by external tools
+ * such as tools/sim_stats.py.  Fields other than pctrs[] are updated
+ * together, with seq odd whilst they're being written; pctrs[] are counted
+ * every cycle.
+ */
+#define STATS_PAGE_MAGIC	0x4d525354	// "MRST"
+#define STATS_PAGE_VERSION	1
+
+typedef struct {
+	uint32_t	magic;
+	uint32_t	version;
+	volatile uint32_t seq;
+	uint32_t	pid;
+	uint64_t	cycles;
+	uint64_t	instrs;
+	uint64_t	stall_cycles;
+	uint64_t	uart_tx_bytes;
+	uint64_t	host_ms;		// Since the run started
+	uint64_t	cycles_per_sec;		// Over the last update
+	uint32_t	finished;
+	uint32_t	pad;
+	uint64_t	pctrs[64];		// Cycles each perf event line was high
+} stats_page_t;
+
+void	status_set_interval(double secs);
+void	status_set_shm(const char *name);
+const char	*status_get_shm(void);
+int	status_init(Testbench *tb);
+void	status_update(Testbench *tb);
+void	status_finish(Testbench *tb);
+
+#endif
@@ -8,35 +8,97 @@
 
 #include <stdlib.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
 #include "Vtb_top.h"
 #include "verilated.h"
-#include "verilated_vcd_c.h"
 #include "Vtb_top__Syms.h"
+#include "ring.h"
+
+/* The trace format is chosen at build time (TRACE_FST=1 for FST) */
+#if VM_TRACE_FST
+#include "verilated_fst_c.h"
+typedef VerilatedFstC	TraceC;
+#else
+#include "verilated_vcd_c.h"
+typedef VerilatedVcdC	TraceC;
+#endif
+
+/* Where the boot BRAM (RAM_BOOT in src/mr_top.v) appears */
+#define RAM_BOOT_BASE	0xfff00000ULL
 
 
 class Testbench {
 	uint64_t	m_tickcount;
 	uint64_t	m_tick_trace_threshold;
 	Vtb_top		*m_core;
-        VerilatedVcdC	*m_trace;
+        TraceC		*m_trace;
+	int		m_trace_depth;
+	std::vector<std::string> m_trace_scopes;
+	uint64_t	m_trace_rollover;
+	uint64_t	m_trace_flush_cycles;
+	uint64_t	m_trace_next_flush;
 public:
 	Testbench(void) {
 		m_trace = 0;
+		m_trace_depth = 99;
+		m_trace_rollover = 0;
+		m_trace_flush_cycles = 0;
+		m_trace_next_flush = ~0ULL;
 		m_core = new Vtb_top;
 		m_tickcount = 0l;
 		m_tick_trace_threshold = ~0;
                 Verilated::traceEverOn(true);
+		mem_bd.pending = 0;
+		/* Until ioemul_init() (which --no-io skips), there's no IO
+		 * to flush:
+		 */
+		uart_txb.len = 0;
+		uart_txb.ring = &uart_tx_ring;
+		dbg_txb.len = 0;
+		dbg_txb.ring = &dbg_tx_ring;
+		io_wake_fd = -1;
+		io_running = false;
 	}
 
 	Vtb_top *getTop() { return m_core; }
 
+	/* These take effect at opentrace().  Depth is the number of levels
+	 * of hierarchy; scopes restrict tracing to those subtrees (e.g.
+	 * "tb_top.MR.CPU"), and can be given more than once.
+	 */
+	void		traceDepth(int depth) { m_trace_depth = depth; }
+	void		traceScope(const char *scope) { m_trace_scopes.push_back(scope); }
+	void		traceRollover(uint64_t bytes) { m_trace_rollover = bytes; }
+
+	/* The trace writer buffers; this forces a flush every N cycles,
+	 * rather than just when its buffer fills and at close.
+	 */
+	void		traceFlushEvery(uint64_t cycles) { m_trace_flush_cycles = cycles; }
+
+	/* VM_TRACE is 0 if the model was built without --trace (TRACE=0) */
 	virtual	void	opentrace(const char *vcdname) {
+#if VM_TRACE
 		if (!m_trace) {
-			m_trace = new VerilatedVcdC;
-			m_core->trace(m_trace, 99);
+			m_trace = new TraceC;
+			m_core->trace(m_trace, m_trace_depth);
+			for (unsigned int i = 0; i < m_trace_scopes.size(); i++)
+				m_trace->dumpvars(m_trace_depth, m_trace_scopes[i]);
+#if !VM_TRACE_FST
+			if (m_trace_rollover)
+				m_trace->rolloverSize(m_trace_rollover);
+#endif
 			m_trace->open(vcdname);
-			m_tick_trace_threshold = 0;
+			// -T might've been given first
+			if (m_tick_trace_threshold == ~0ULL)
+				m_tick_trace_threshold = 0;
+			if (m_trace_flush_cycles)
+				m_trace_next_flush = m_tick_trace_threshold + m_trace_flush_cycles;
 		}
+#else
+		fprintf(stderr, "Model built without trace support (TRACE=0)\n");
+#endif
 	}
 
 	virtual void 	traceFrom(uint64_t trace_from) {
@@ -46,12 +108,22 @@ public:
 	// Close a trace file
 	virtual void	close(void) {
 		if (m_trace) {
+#if VM_TRACE
 			m_trace->close();
+#endif
 			m_trace = NULL;
 			m_tick_trace_threshold = ~0;
 		}
 	}
 
+	/* Forget the trace without closing it, e.g. in a forked child
+	 * whose parent's still writing it.
+	 */
+	void		abandontrace(void) {
+		m_trace = NULL;
+		m_tick_trace_threshold = ~0;
+	}
+
 	virtual ~Testbench(void) {
 		delete m_core;
 		m_core = NULL;
@@ -67,64 +139,131 @@ public:
 		m_core->reset = 0;
 	}
 
-	virtual void	tick(void) {
+	/* Optional per-cycle work; the run loop is instantiated for each
+	 * combination, so a cycle only pays for what's enabled.
+	 */
+	static const unsigned int FEAT_TRACE	= 1;
+	static const unsigned int FEAT_IO	= 2;
+	static const unsigned int FEAT_CHECKER	= 4;
+	static const unsigned int FEAT_MON	= 8;
+	static const unsigned int FEAT_ALL	= 15;
+
+	template <unsigned int F>
+	void		tick_f(void) {
 		// Increment our own internal time reference
 		m_tickcount++;
 
-		// Make sure any combinatorial logic depending upon
-		// inputs that may have changed before we called tick()
-		// has settled before the rising edge of the clock.
-                //		m_core->clk = 0;
-                //		m_core->eval();
-		// if(m_trace) m_trace->dump(10*m_tickcount-2);
-                // ME: No comb inputs (for now!)
-
-		// Toggle the clock
+		// ME: No comb inputs (for now!), so there's no need to
+		// settle anything before the rising edge.
 
 		// Rising edge
 		m_core->clk = 1;
 		m_core->eval();
 
-		ioemul();
+		if (F & FEAT_IO)
+			ioemul();
 
-		if (m_tickcount >= m_tick_trace_threshold)
+#if VM_TRACE
+		if (F & FEAT_TRACE)
 			m_trace->dump((vluint64_t)(10*m_tickcount));
+#endif
 
 		// Falling edge
 		m_core->clk = 0;
 		m_core->eval();
 
-		if (m_tickcount >= m_tick_trace_threshold) {
-			// This portion, though, is a touch different.
-			// After dumping our values as they exist on the
-			// negative clock edge ...
+#if VM_TRACE
+		if (F & FEAT_TRACE) {
 			m_trace->dump((vluint64_t)(10*m_tickcount+5));
-			//
-			// We'll also need to make sure we flush any I/O to
-			// the trace file, so that we can use the assert()
-			// function between now and the next tick if we want to.
-			m_trace->flush();
+			if (m_tickcount >= m_trace_next_flush) {
+				m_trace->flush();
+				m_trace_next_flush += m_trace_flush_cycles;
+			}
 		}
+#endif
+	}
+
+	virtual void	tick(void) {
+		if (m_tickcount + 1 >= trace_start())
+			tick_f<FEAT_IO | FEAT_TRACE>();
+		else
+			tick_f<FEAT_IO>();
+	}
+
+	/* The first cycle that's traced, or ~0 if there's no trace.
+	 * (tick_f<FEAT_TRACE> is needed from one cycle before this.)
+	 */
+	uint64_t	trace_start(void) {
+		return m_trace ? m_tick_trace_threshold : ~0ULL;
+	}
+
+	/* The trace is written in chunks, so flush it before anyone looks: */
+	void		flushtrace(void) {
+#if VM_TRACE
+		if (m_trace)
+			m_trace->flush();
+#endif
 	}
 
 	virtual void	tick_lite(void) {
 		m_tickcount++;
 		m_core->clk = 1;
 		m_core->eval();
-		if (m_tickcount >= m_tick_trace_threshold)
+#if VM_TRACE
+		if (m_tickcount >= trace_start())
 			m_trace->dump((vluint64_t)(10*m_tickcount));
+#endif
 
 		m_core->clk = 0;
 		m_core->eval();
-		if (m_tickcount >= m_tick_trace_threshold)
+#if VM_TRACE
+		if (m_tickcount >= trace_start())
 			m_trace->dump((vluint64_t)(10*m_tickcount));
+#endif
 	}
 
 	virtual bool	done(void) { return (Verilated::gotFinish()); }
 
         uint64_t 	get_tickcount() { return m_tickcount; }
+	// For restoring a snapshot, which doesn't include the count:
+	void		set_tickcount(uint64_t t) { m_tickcount = t; }
+
+	/* Host pointer to sim RAM at physical address addr, and the number
+	 * of bytes contiguous from there in *avail; NULL if addr isn't RAM.
+	 */
+	uint8_t		*ram_ptr(uint64_t addr, uint64_t *avail) {
+#ifndef REAL_RAM
+		// MR3 platform has two banks, starting at 0 and starting 0x01000000:
+		uint64_t bank_size = sizeof(m_core->tb_top->MR->genblk1__DOT__RAMA_BRAM->RAM);
+		uint8_t *bank;
+
+		if (addr < bank_size) {
+			bank = (uint8_t *)&m_core->tb_top->MR->genblk1__DOT__RAMA_BRAM->RAM[0];
+		} else if (addr >= 0x01000000 && addr < 0x01000000 + bank_size) {
+			bank = (uint8_t *)&m_core->tb_top->MR->genblk1__DOT__RAMB_BRAM->RAM[0];
+			addr -= 0x01000000;
+		} else if (addr >= RAM_BOOT_BASE &&
+			   addr < RAM_BOOT_BASE + sizeof(m_core->tb_top->MR->RAM_BOOT->RAM)) {
+			// Plus the boot BRAM, at the top:
+			bank = (uint8_t *)&m_core->tb_top->MR->RAM_BOOT->RAM[0];
+			bank_size = sizeof(m_core->tb_top->MR->RAM_BOOT->RAM);
+			addr -= RAM_BOOT_BASE;
+		} else {
+			return NULL;
+		}
+		*avail = bank_size - addr;
+		return bank + addr;
+#else
+		return NULL;
+#endif
+	}
+
 	void		ioemul(void);
 	void		ioemul_init(void);
+	void		ioemul_flush(void);
+	void		ioemul_drain(void);
+	bool		ioemul_idle(void);
+	int		mem_copy(uint64_t addr, uint8_t *buf, uint64_t len, bool write);
 
 private:
 	/* IO interfaces */
@@ -132,11 +271,78 @@ private:
 	static const uint64_t	IO_WORK_DBG  	= 0x00000002;
 
 	uint64_t	io_poll_work(void);
-	uint64_t	io_poll_sockets(void);
+	void		io_poll_sockets(void);
 
 	uint8_t		io_dbg_rx_data(void);
 	uint8_t		io_uart_rx_data(void);
 
+	/* The socket side of IO runs in its own thread, and passes
+	 * bytes to/from ioemul() through these rings:
+	 */
+	static const unsigned int IO_RING_LOG2	= 16;
+
+	SpscRing<uint8_t, IO_RING_LOG2>	uart_rx_ring;
+	SpscRing<uint8_t, IO_RING_LOG2>	uart_tx_ring;
+	SpscRing<uint8_t, IO_RING_LOG2>	dbg_rx_ring;
+	SpscRing<uint8_t, IO_RING_LOG2>	dbg_tx_ring;
+
+	/* Output is gathered into batches before going to the IO
+	 * thread, flushed when full, at newlines (console only) or after
+	 * being idle for a while.
+	 */
+	static const unsigned int IO_TXBUF_SIZE = 4096;
+
+	typedef struct {
+		uint8_t		data[IO_TXBUF_SIZE];
+		unsigned int	len;
+		uint64_t	last_tick;
+		bool		flush_on_nl;
+		FILE		*echo;
+		bool		lossless;	// Wait for ring space, don't drop
+		SpscRing<uint8_t, IO_RING_LOG2>	*ring;
+	} io_txbuf_t;
+
+	io_txbuf_t	uart_txb;
+	io_txbuf_t	dbg_txb;
+
+	void		io_tx_byte(io_txbuf_t *b, uint8_t d) {
+		b->data[b->len++] = d;
+		b->last_tick = m_tickcount;
+		if (b->len == IO_TXBUF_SIZE || (d == '\n' && b->flush_on_nl))
+			io_tx_flush(b);
+	}
+	void		io_tx_flush(io_txbuf_t *b);
+
+	/* Memory backdoor requests are received by their own thread, and
+	 * performed by ioemul() between clock edges:
+	 */
+	static const int MEM_BD_READ	= 1;
+	static const int MEM_BD_WRITE	= 2;
+
+	struct {
+		std::atomic<int>	pending;
+		int		cmd;
+		uint64_t	addr;
+		uint64_t	len;
+		uint8_t		*buf;
+		int		status;
+		pthread_mutex_t	lock;
+		pthread_cond_t	done;
+	} mem_bd;
+
+	void		io_mem_backdoor(void);
+	static void	*mem_bd_thread_entry(void *arg);
+	void		mem_bd_thread_main(void);
+	int		mem_bd_listen_skt;
+
+	pthread_t	io_thread;
+	pthread_t	mem_bd_thread;
+	int		io_wake_fd;
+	bool		io_running;	// The IO thread's consuming TX rings
+	static void	*io_thread_entry(void *arg);
+	void		io_thread_main(void);
+
+	/* Owned by the IO thread once it's started: */
 	int		uart_listen_skt;
 	int		uart_skt;
 
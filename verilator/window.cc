@@ -0,0 +1,435 @@
+/* MR-sys verilated sim triggered trace windows
+ *
+ * Copyright 2020-2022 Matt Evans
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/wait.h>
+#include <vector>
+
+#include "testbench.h"
+#include "checkpoint.h"
+#include "monitor.h"
+#include "window.h"
+
+/* A window is traced from a start trigger (less some pre-trigger history)
+ * to a stop trigger, into its own file:
+ *
+ *	-W start=<trigger>[,stop=<trigger>][,pre=N][,len=N][,count=N][,file=F]
+ *
+ * where a trigger is one of:
+ *
+ *	pc:<addr>	An instruction at addr completes without a fault
+ *	fault[:<n>]	An instruction faults (with memory_fault_r == n)
+ *	uart:<string>	The console outputs string
+ *	cycle:<n>	Cycle n is reached (or jumped past, by idle skip); once
+ *
+ * pre is the number of cycles traced before the start trigger, len is the
+ * maximum length after it (the stop trigger can end it earlier) and count
+ * is how many times the window can fire.  Files are F_<k>.vcd (or .fst),
+ * default F "window<n>".
+ *
+ * Tracing the whole run to catch these is far too slow, so the model is
+ * snapshotted into memory every so often.  When a window's start trigger
+ * fires, a child is forked which restores the newest snapshot from before
+ * the pre-trigger history, and re-simulates from there with tracing on,
+ * while the parent carries on untraced.
+ *
+ * The replay is only as deterministic as the sim's inputs: input arriving
+ * from the host (console/debug sockets, memory backdoor) isn't recorded, so
+ * a window across such input won't reproduce it.  The replay checks that
+ * PC/fault start triggers fire again at the same cycle, and says if not.
+ */
+
+#define MAX_WINDOWS		8
+#define WINDOW_DEFAULT_LEN	1000000
+#define WINDOW_MIN_INTERVAL	1000000
+#define MAX_WINDOW_CHILDREN	4
+
+#if VM_TRACE_FST
+#define WINDOW_TRACE_EXT	"fst"
+#else
+#define WINDOW_TRACE_EXT	"vcd"
+#endif
+
+enum { TRIG_NONE = 0, TRIG_PC, TRIG_FAULT, TRIG_UART, TRIG_CYCLE };
+
+typedef struct {
+	int		type;
+	uint64_t	val;
+	bool		any;		// TRIG_FAULT with no number
+	char		*str;
+	unsigned int	match;		// Position in str matched so far
+	bool		hit;		// TRIG_CYCLE has fired
+} trigger_t;
+
+enum { WIN_ARMED = 0, WIN_ACTIVE, WIN_DONE };
+
+typedef struct {
+	trigger_t	start;
+	trigger_t	stop;
+	uint64_t	pre;
+	uint64_t	len;
+	unsigned int	count;
+	char		*file;
+
+	int		state;
+	unsigned int	fired;
+	uint64_t	active_end;
+} window_t;
+
+typedef struct {
+	uint64_t		cycle;
+	std::vector<uint8_t>	data;
+} snapshot_t;
+
+static window_t windows[MAX_WINDOWS];
+static int windows_num = 0;
+
+static std::vector<snapshot_t> snapshots;
+static unsigned int snapshot_next = 0;		// Oldest, next to be replaced
+static uint64_t snapshot_interval = 0;		// 0 = automatic
+static uint64_t snapshot_next_cycle = 0;
+
+static std::vector<pid_t> window_children;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Triggers
+
+static int	trig_parse(const char *s, trigger_t *t)
+{
+	memset(t, 0, sizeof(*t));
+
+	if (!strncmp(s, "pc:", 3)) {
+		t->type = TRIG_PC;
+		t->val = strtoull(s + 3, NULL, 0);
+	} else if (!strcmp(s, "fault")) {
+		t->type = TRIG_FAULT;
+		t->any = true;
+	} else if (!strncmp(s, "fault:", 6)) {
+		t->type = TRIG_FAULT;
+		t->val = strtoull(s + 6, NULL, 0);
+	} else if (!strncmp(s, "uart:", 5) && s[5] != '\0') {
+		t->type = TRIG_UART;
+		t->str = strdup(s + 5);
+	} else if (!strncmp(s, "cycle:", 6)) {
+		t->type = TRIG_CYCLE;
+		t->val = strtoull(s + 6, NULL, 0);
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+/* Called once per cycle, for each trigger that's being watched */
+static bool	trig_check(Testbench *tb, trigger_t *t)
+{
+	switch (t->type) {
+	case TRIG_PC:
+		return tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_valid_r &&
+			tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_fault_r == 0 &&
+			tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_pc_r == t->val;
+
+	case TRIG_FAULT:
+		return tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_valid_r &&
+			tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_fault_r != 0 &&
+			(t->any || tb->getTop()->tb_top->MR->CPU->CPU->MEM->memory_fault_r == t->val);
+
+	case TRIG_UART:
+		if (tb->getTop()->tb_top->MR->CONSOLE_UART->tx_has_data) {
+			char d = tb->getTop()->tb_top->MR->CONSOLE_UART->next_tx_byte;
+			if (d != t->str[t->match])
+				t->match = 0;
+			if (d == t->str[t->match] && t->str[++t->match] == '\0') {
+				t->match = 0;
+				return true;
+			}
+		}
+		return false;
+
+	case TRIG_CYCLE:
+		if (t->hit || tb->get_tickcount() < t->val)
+			return false;
+		t->hit = true;
+		return true;
+	}
+	return false;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Options
+
+int	window_parse(const char *spec)
+{
+	if (windows_num == MAX_WINDOWS) {
+		fprintf(stderr, "Too many windows (max %d)\n", MAX_WINDOWS);
+		return -1;
+	}
+
+	window_t *w = &windows[windows_num];
+	char *s = strdup(spec);
+	char *tok, *save;
+	char name[32];
+
+	memset(w, 0, sizeof(*w));
+	w->len = WINDOW_DEFAULT_LEN;
+	w->count = 1;
+	snprintf(name, sizeof(name), "window%d", windows_num);
+	w->file = strdup(name);
+
+	for (tok = strtok_r(s, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		char *val = strchr(tok, '=');
+		int r = 0;
+
+		if (!val)
+			goto bad;
+		*val++ = '\0';
+
+		if (!strcmp(tok, "start"))
+			r = trig_parse(val, &w->start);
+		else if (!strcmp(tok, "stop"))
+			r = trig_parse(val, &w->stop);
+		else if (!strcmp(tok, "pre"))
+			w->pre = strtoull(val, NULL, 0);
+		else if (!strcmp(tok, "len"))
+			w->len = strtoull(val, NULL, 0);
+		else if (!strcmp(tok, "count"))
+			w->count = strtoul(val, NULL, 0);
+		else if (!strcmp(tok, "file")) {
+			free(w->file);
+			w->file = strdup(val);
+		} else
+			goto bad;
+		if (r)
+			goto bad;
+	}
+	if (w->start.type == TRIG_NONE || w->count == 0)
+		goto bad;
+
+	free(s);
+	windows_num++;
+	return 0;
+
+bad:
+	fprintf(stderr, "Bad window spec '%s'\n", spec);
+	free(s);
+	return -1;
+}
+
+void	window_set_interval(uint64_t cycles)
+{
+	snapshot_interval = cycles;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Snapshots and replay
+
+static void	take_snapshot(Testbench *tb)
+{
+	snapshot_t *s = &snapshots[snapshot_next];
+
+	s->data.clear();	// Keeps the allocation
+	if (ckpt_model_to_mem(tb, &s->data) != 0)
+		return;
+	s->cycle = tb->get_tickcount();
+
+	snapshot_next = (snapshot_next + 1) % snapshots.size();
+	snapshot_next_cycle = s->cycle + snapshot_interval;
+}
+
+/* The newest snapshot at or before cycle t (or the oldest there is) */
+static snapshot_t	*find_snapshot(uint64_t t)
+{
+	snapshot_t *best = NULL;
+	snapshot_t *oldest = NULL;
+
+	for (unsigned int i = 0; i < snapshots.size(); i++) {
+		snapshot_t *s = &snapshots[i];
+		if (s->data.empty())
+			continue;
+		if (s->cycle <= t && (!best || s->cycle > best->cycle))
+			best = s;
+		if (!oldest || s->cycle < oldest->cycle)
+			oldest = s;
+	}
+	return best ? best : oldest;
+}
+
+/* In the child: never returns */
+static void	window_replay(Testbench *tb, window_t *w, snapshot_t *s,
+			      uint64_t start_cycle, const char *filename)
+{
+	int r = ckpt_model_from_mem(tb, s->data.data(), s->data.size());
+	if (r != 0)
+		_exit(EXIT_FAILURE);
+	tb->set_tickcount(s->cycle);
+
+	uint64_t trace_from = start_cycle > w->pre ? start_cycle - w->pre : 0;
+	if (trace_from <= s->cycle)
+		trace_from = s->cycle + 1;
+
+	tb->abandontrace();	// Parent's, if there is one
+	tb->traceFrom(trace_from);
+	tb->opentrace(filename);
+
+	while (!tb->done() && tb->get_tickcount() + 1 < trace_from)
+		tb->tick_f<0>();
+
+	bool check_start = w->start.type == TRIG_PC || w->start.type == TRIG_FAULT;
+	bool diverged = check_start;
+	uint64_t end = start_cycle + w->len;
+	w->stop.match = 0;
+
+	while (!tb->done() && tb->get_tickcount() < end) {
+		tb->tick_f<Testbench::FEAT_TRACE>();
+
+		uint64_t t = tb->get_tickcount();
+		if (check_start && t <= start_cycle && trig_check(tb, &w->start) &&
+		    t == start_cycle)
+			diverged = false;
+		if (t > start_cycle && w->stop.type != TRIG_NONE && trig_check(tb, &w->stop))
+			break;
+	}
+	tb->close();
+
+	printf("[Window '%s': traced cycles %lu-%lu%s]\n", filename, trace_from,
+	       tb->get_tickcount(),
+	       diverged ? ", WARNING: replay didn't hit the start trigger at the same cycle" : "");
+	fflush(stdout);
+	_exit(EXIT_SUCCESS);
+}
+
+/* Replays run alongside the sim, a few at a time; the main loop reaps
+ * finished ones so they don't linger as zombies.
+ */
+void	window_reap(bool block)
+{
+	for (unsigned int i = 0; i < window_children.size(); ) {
+		int status;
+
+		if (waitpid(window_children[i], &status, block ? 0 : WNOHANG) == 0) {
+			i++;
+			continue;
+		}
+		window_children.erase(window_children.begin() + i);
+	}
+}
+
+static void	window_fire(Testbench *tb, window_t *w, uint64_t t)
+{
+	char filename[PATH_MAX];
+	uint64_t from = t > w->pre ? t - w->pre : 0;
+	snapshot_t *s = find_snapshot(from);
+
+	snprintf(filename, sizeof(filename), "%s_%u." WINDOW_TRACE_EXT, w->file, w->fired);
+
+	if (!s) {
+		printf("[Window '%s' triggered at cycle %lu, but there's no snapshot]\n",
+		       filename, t);
+		return;
+	}
+
+	while (window_children.size() == MAX_WINDOW_CHILDREN)
+		window_reap(true);
+
+	printf("[Window '%s' triggered at cycle %lu, replaying from %lu]\n",
+	       filename, t, s->cycle);
+	fflush(stdout);
+	fflush(stderr);
+	pid_t pid = fork();
+	if (pid == 0) {
+		window_replay(tb, w, s, t, filename);
+	} else if (pid < 0) {
+		printf("[Window '%s': can't fork]\n", filename);
+		return;
+	}
+	window_children.push_back(pid);
+}
+
+static void	window_monitor(Testbench *tb, void *arg)
+{
+	uint64_t t = tb->get_tickcount();
+
+	if (t >= snapshot_next_cycle)
+		take_snapshot(tb);
+
+	for (int i = 0; i < windows_num; i++) {
+		window_t *w = &windows[i];
+
+		if (w->state == WIN_ARMED) {
+			if (trig_check(tb, &w->start)) {
+				window_fire(tb, w, t);
+				w->fired++;
+				w->state = WIN_ACTIVE;
+				w->active_end = t + w->len;
+				w->stop.match = 0;
+			}
+		} else if (w->state == WIN_ACTIVE) {
+			/* Not re-armed until this one's over: */
+			if (t >= w->active_end ||
+			    (w->stop.type != TRIG_NONE && trig_check(tb, &w->stop))) {
+				w->state = (w->fired < w->count) ? WIN_ARMED : WIN_DONE;
+				w->start.match = 0;
+			}
+		}
+	}
+}
+
+/* Snapshots are every snapshot_interval simulated cycles, not counting a jump */
+static void	window_jumped(Testbench *tb, uint64_t from, uint64_t to)
+{
+	if (snapshot_next_cycle > from)
+		snapshot_next_cycle += to - from;
+}
+
+int	window_init(Testbench *tb)
+{
+	if (!windows_num)
+		return 0;
+
+	/* Enough snapshots that one's always at least 'pre' cycles back */
+	uint64_t max_pre = 0;
+	for (int i = 0; i < windows_num; i++) {
+		if (windows[i].pre > max_pre)
+			max_pre = windows[i].pre;
+	}
+	if (snapshot_interval == 0)
+		snapshot_interval = max_pre > WINDOW_MIN_INTERVAL ? max_pre : WINDOW_MIN_INTERVAL;
+	snapshots.resize(max_pre / snapshot_interval + 2);
+
+	printf("Trace windows: %d, snapshot every %lu cycles (%lu kept)\n",
+	       windows_num, snapshot_interval, snapshots.size());
+
+	take_snapshot(tb);
+	if (snapshots[0].data.empty()) {
+		fprintf(stderr, "Trace windows need snapshots (SAVABLE=1)\n");
+		return -1;
+	}
+	if (monitor_add_jump(window_jumped) != 0)
+		return -1;
+	return monitor_add(window_monitor, NULL);
+}
+
+void	window_finish(void)
+{
+	window_reap(true);
+}
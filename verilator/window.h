@@ -0,0 +1,27 @@
+/*
+ * Copyright 2020-2022 Matt Evans
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WINDOW_H
+#define WINDOW_H
+
+/* Triggered trace windows; see window.cc for the -W syntax. */
+int	window_parse(const char *spec);
+void	window_set_interval(uint64_t cycles);
+int	window_init(Testbench *tb);
+void	window_reap(bool block);
+void	window_finish(void);
+
+#endif